@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,6 +25,7 @@ int TIV_is_terminator(TIV *tiv)
  *
  * Calls library setupterm() to initialize terminfo database access.
  * Initializes a set of TIV arrays with sequences taken from the database.
+ * The library's own capset, @ref caps_LIB, is initialized at the same time.
  * Call @ref TIV_destroy_arrays with the same array to free the memory,
  * or call @ref TIV_destroy_array for each TIV array.
  *
@@ -47,6 +50,14 @@ int TIV_setup(int count, TIV *tivs[])
       }
    }
 
+   TIV_set_array(caps_LIB);
+   ti_lib_measure();
+#ifdef TI_WITH_STATS
+   ti_stats_init();
+   ti_trace_init();
+#endif
+   ti_record_init();
+
    // Initialise array of TIV arrays
    if (count > 0)
    {
@@ -76,6 +87,7 @@ void TIV_destroy_array(TIV *tiv)
       {
          free(ptr->sequence);
          ptr->sequence = NULL;
+         ptr->padded = 0;
       }
 
       ++ptr;
@@ -87,6 +99,7 @@ void TIV_destroy_array(TIV *tiv)
  *
  * This function is a companion to the @ref TIV_setup function that
  * allocated memory in a set of TIV arrays to start the program.
+ * It also releases @ref caps_LIB and the output buffer.
  *
  * @param "count"   number of elements in the following array
  * @param "tivs"    pointer to an array of TIV arrays that should
@@ -105,6 +118,9 @@ void TIV_destroy_arrays(int count, TIV *tivs[])
          ++tiv;
       }
    }
+
+   TIV_destroy_array(caps_LIB);
+   ti_out_release();
 }
 
 /**
@@ -126,6 +142,8 @@ int TIV_set_sequence(TIV *tiv, const char *seq)
       buff[len] = '\0';
 
       tiv->sequence = buff;
+      // Delays need tputs; other sequences are copied straight out
+      tiv->padded = strstr(buff, "$<") != NULL;
    }
 
    return errno;
@@ -244,7 +262,9 @@ int TIV_string_array_max_length(const char **strings)
  * For example, ESCAPE will be rendered as a red `^[`.
  *
  * Also, a space character will be printed with a different background
- * color to clarify intent.
+ * color to clarify intent.  Well-formed UTF-8 characters are printed
+ * as they are, and bytes that are not part of one are shown in red as
+ * `\xHH`.
  *
  * @param "seq"   The NULL-terminated escape sequence string to print
  */
@@ -253,14 +273,26 @@ void TIV_print_sequence(const char *seq)
    const char *tptr = seq;
    while (*tptr)
    {
-      if (*tptr < ' ')
-         printf("\033[31;1m^%c\033[m", (*tptr + 64));
-      else if (*tptr == ' ')
+      unsigned char chr = *tptr;
+      if (chr < ' ')
+         printf("\033[31;1m^%c\033[m", (chr + 64));
+      else if (chr == ' ')
          printf("\033[44m \033[m");
-      else if (*tptr == 127)  // backspace
+      else if (chr == 127)  // backspace
          printf("\033[31;1m^?\033[m");
+      else if (chr >= 0x80)
+      {
+         int len = ti_utf8_sequence_length(tptr, strnlen(tptr, 4));
+         if (len)
+         {
+            fwrite(tptr, 1, len, stdout);
+            tptr += len;
+            continue;
+         }
+         printf("\033[31;1m\\x%02X\033[m", chr);
+      }
       else
-         printf("%c", *tptr);
+         printf("%c", chr);
 
       ++tptr;
    }
@@ -271,7 +303,12 @@ void TIV_print_sequence(const char *seq)
  *
  * Unprintable character translation inserts a caret (^) in front
  * of the corresponding letter to show as a control character.
- * Output is limited to the length of the submitted buffer.
+ * Well-formed UTF-8 characters are copied whole, and other bytes of
+ * 0x80 and above are written as `\xHH`.  A translation that doesn't
+ * fit is left out rather than split.
+ *
+ * Output is limited to the length of the submitted buffer, including
+ * a NULL terminator.
  *
  * @param "buff"    target character buffer
  * @param "len"     length of @p buff
@@ -281,32 +318,49 @@ void TIV_translate_sequence(char *buff, int len, const char *seq)
 {
    const char *sptr = seq;
    char *ptr = buff;
-   char *end = ptr + len;
+   char *end = ptr + len - 1;   // leave room for the terminator
+
+   if (len <= 0)
+      return;
 
    while (*sptr && ptr < end)
    {
-      if (*sptr >= ' ' && *sptr < 127) // printable characters
-         *ptr = *sptr;
-      else if (*sptr < ' ')            // control characters
+      unsigned char chr = *sptr;
+      char xlate[5];
+      const char *out = xlate;
+      int count = 1;
+
+      if (chr >= ' ' && chr < 127)      // printable characters
+         xlate[0] = chr;
+      else if (chr < ' ')               // control characters
       {
-         if (ptr + 1 < end)
-         {
-            *ptr++ = '^';
-            *ptr = *sptr + 64;
-         }
+         xlate[0] = '^';
+         xlate[1] = chr + 64;
+         count = 2;
       }
-      else if (*sptr == 127)           // backspace
+      else if (chr == 127)              // backspace
       {
-         if (ptr + 1 < end)
-         {
-            *ptr++ = '^';
-            *ptr = '?';
-         }
+         xlate[0] = '^';
+         xlate[1] = '?';
+         count = 2;
+      }
+      else if ((count = ti_utf8_sequence_length(sptr, strnlen(sptr, 4))))
+         out = sptr;                    // whole UTF-8 character
+      else
+      {
+         snprintf(xlate, sizeof(xlate), "\\x%02X", chr);
+         count = 4;
       }
 
-      ++ptr;
-      ++sptr;
+      if (ptr + count > end)
+         break;
+
+      memcpy(ptr, out, count);
+      ptr += count;
+      sptr += out == sptr ? count : 1;
    }
+
+   *ptr = '\0';
 }
 
 /**
@@ -362,6 +416,39 @@ void TIV_dump_array(TIV *tiv, const char **strings)
    }
 }
 
+/**
+ * @brief Print every element of @p tiv array, with strings packed by
+ *        `ti_create_capset_code.sh -p`.
+ *
+ * @param "tiv"       Pointer to array of @ref TIV elements, the last member of
+ *                    which should be an element whose code member is {0};
+ * @param "strings"   Packed strings, like `strings_CONTROL`.
+ * @param "offsets"   Offsets into @p strings of the string of each element,
+ *                    like `desc_CONTROL_offsets`.
+ */
+void TIV_dump_array_packed(TIV *tiv, const char *strings, const unsigned short *offsets)
+{
+   int width = 0;
+   TIV *ptr;
+
+   for (ptr = tiv; !TIV_is_terminator(ptr); ++ptr)
+   {
+      int len = strlen(strings + offsets[ptr->index]);
+      if (len > width)
+         width = len;
+   }
+
+   for (ptr = tiv; !TIV_is_terminator(ptr); ++ptr)
+   {
+      printf("%3d: %2s %-*s  ", ptr->index, ptr->code, width, strings + offsets[ptr->index]);
+      if (ptr->sequence)
+         TIV_print_sequence(ptr->sequence);
+      else
+         printf("N/A");
+      printf("\n");
+   }
+}
+
 /**
  * @brief Returns index into @p tiv array whose sequence member matches the
  *        @p sequence argument.
@@ -371,16 +458,20 @@ void TIV_dump_array(TIV *tiv, const char **strings)
  *
  * @param "tiv"       Pointer to array of @ref TIV elements, the last member of
  *                    which should be an element whose code member is {0};
- * @param "sequence"  Sequence string to seek.
+ * @param "sequence"  Sequence string to seek, may be NULL.
  *
  * @return Index to matching @ref TIV element, otherwise -1 if not found.
  */
 int TIV_find_index_by_sequence(TIV *tiv, const char *sequence)
 {
    TIV *ptr = tiv;
+   if (!ptr || !sequence)
+      return -1;
+
    while (!TIV_is_terminator(ptr))
    {
-      if (strcmp(ptr->sequence, sequence)==0)
+      // Keys the terminal doesn't have are left without a sequence
+      if (ptr->sequence && strcmp(ptr->sequence, sequence)==0)
          return ptr->index;
       ++ptr;
    }
@@ -407,7 +498,7 @@ int TIV_find_index_by_code(TIV *tiv, const char *code)
    TIV *ptr = tiv;
    while (!TIV_is_terminator(ptr))
    {
-      if (memcmp(tiv->code, code, 2)==0)
+      if (memcmp(ptr->code, code, 2)==0)
          return ptr->index;
       ++ptr;
    }
@@ -471,9 +562,39 @@ const char *TIV_get_sequence(const TIV *tiv)
       return NULL;
 }
 
+/**
+ * @brief Send a sequence of @p t to the output buffer.
+ *
+ * Only sequences with `$<n>` padding go through `tputs`, which calls
+ * back for every byte.  The rest are copied whole.
+ *
+ * @param "t"           element whose sequence, or a parameterized
+ *                      form of it, is sent
+ * @param "str"         sequence to send, may be NULL if tiparm failed
+ * @param "linecount"   lines affected, for proportional padding
+ */
+static void send_sequence(const TIV *t, const char *str, int linecount)
+{
+   size_t len = str ? strlen(str) : 0;
+
+   TI_STAT_CAP(t, len);
+   if (len)
+   {
+      ti_out_begin();
+      if (t->padded)
+         tputs(str, linecount, ti_out_putc);
+      else
+         ti_out_write(str, len);
+      ti_out_end();
+   }
+}
+
 /**
  * @brief Simple submission of sequence associated with the indicate TIV element.
  *
+ * The sequence is sent through the output buffer (see @ref ti_out_begin),
+ * so it is held with the rest of a frame if one is being composed.
+ *
  * This is not a "safe" function in that it does not confirm a sane
  * index number (within the range of the array).  If safety is needed,
  * write a wrapper function that confirms the index.
@@ -485,7 +606,7 @@ void TIV_execute(const TIV *tiv, int index)
 {
    const TIV *t = &tiv[index];
    if (t->sequence)
-      tputs(t->sequence, 1, putchar);
+      send_sequence(t, t->sequence, 1);
 }
 
 /**
@@ -503,7 +624,7 @@ void TIV_execute_with_lines(const TIV *tiv, int index, int linecount)
 {
    const TIV *t = &tiv[index];
    if (t->sequence)
-      tputs(t->sequence, linecount, putchar);
+      send_sequence(t, t->sequence, linecount);
 }
 
 /**
@@ -532,7 +653,8 @@ void TIV_execute_params(const TIV *tiv, int index,...)
       va_end(list_args);
 
       const char *str = tiparm(t->sequence, arg1, arg2, arg3, arg4, arg5);
-      tputs(str, 1, putchar);
+      TI_STAT_ADD(TI_STAT_TIPARM, 1);
+      send_sequence(t, str, 1);
    }
 }
 
@@ -563,7 +685,50 @@ void TIV_execute_params_with_lines(const TIV *tiv, int index, int linecount,...)
       va_end(list_args);
 
       const char *str = tiparm(t->sequence, arg1, arg2, arg3, arg4, arg5);
-      tputs(str, linecount, putchar);
+      TI_STAT_ADD(TI_STAT_TIPARM, 1);
+      send_sequence(t, str, linecount);
+   }
+}
+
+/**
+ * @brief Submission of a sequence with a known number of arguments.
+ *
+ * The non-variadic core of the typed inline functions that
+ * `ti_create_capset_code.sh -f` writes for each capability, which
+ * pass the arguments in an array whose size the compiler checks.
+ * Like @ref TIV_execute_params, it does not check @p index.
+ *
+ * @param "tiv"         Array of TIV elements from which the item will be selected
+ * @param "index"       Index into array @p tiv.
+ * @param "linecount"   Number of lines to be affected by the call.
+ * @param "count"       Number of elements in @p parms, at most 9.
+ * @param "parms"       Arguments of the capability.
+ */
+void TIV_execute_parm(const TIV *tiv, int index, int linecount, int count, const int *parms)
+{
+   const TIV *t = &tiv[index];
+   if (t->sequence)
+   {
+      const char *str;
+      switch (count)
+      {
+         case 0: str = tiparm(t->sequence); break;
+         case 1: str = tiparm(t->sequence, parms[0]); break;
+         case 2: str = tiparm(t->sequence, parms[0], parms[1]); break;
+         case 3: str = tiparm(t->sequence, parms[0], parms[1], parms[2]); break;
+         default:
+         {
+            // Longer lists are rare (sgr): pass all nine
+            int all[9] = { 0 };
+            memcpy(all, parms, (count < 9 ? count : 9) * sizeof(int));
+            str = tiparm(t->sequence, all[0], all[1], all[2], all[3], all[4],
+                         all[5], all[6], all[7], all[8]);
+            break;
+         }
+      }
+
+      TI_STAT_ADD(TI_STAT_TIPARM, 1);
+      send_sequence(t, str, linecount);
    }
 }
 
@@ -572,6 +737,15 @@ void TIV_execute_params_with_lines(const TIV *tiv, int index, int linecount,...)
 
 #ifdef SL_CAPS_MAIN
 
+#include "sl_ioctl.c"
+#include "sl_libcaps.c"
+#include "sl_output.c"
+#include "sl_screen.c"
+#include "sl_utf8.c"
+#include "sl_gcache.c"
+#include "sl_frame.c"
+#include "sl_record.c"
+
 // Main
 int main(int argc, const char **argv)
 {
@@ -0,0 +1,219 @@
+/**
+ * @file sl_frame.c
+ * @brief Frame pacing for a @ref TI_SCREEN.
+ *
+ * A producer may change the back buffer of a screen far more often
+ * than anyone can see.  Rather than rendering after every change,
+ * call @ref ti_frame_poll from the event loop: it renders only when
+ * the frame interval has passed, so any number of changes between
+ * frames cost a single render.
+ *
+ * The interval lengthens while the terminal has not drained the
+ * previous frames (a slow serial or SSH link) and returns to the
+ * configured rate when it catches up.  Use @ref ti_frame_present to
+ * render immediately, for example to echo a keypress.
+ *
+ * With non-blocking output (@ref ti_out_open_nonblocking), no frame is
+ * rendered while earlier output is still queued.  Changes keep
+ * collecting in the back buffer, so when the terminal catches up it
+ * receives only the newest state.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "termintel.h"
+
+#define TI_FRAME_DEFAULT_FPS 60
+#define TI_FRAME_MAX_INTERVAL 1000000000LL   // one second, in nanoseconds
+
+/**
+ * @brief Pacing state, times in nanoseconds.
+ */
+static struct ti_frame_state {
+   long long interval;   ///< minimum time between frames, from @ref ti_frame_set_rate
+   long long current;    ///< time between frames, lengthened while the terminal lags
+   long long last;       ///< time of the last present
+} g_frame = {
+   1000000000LL / TI_FRAME_DEFAULT_FPS,
+   1000000000LL / TI_FRAME_DEFAULT_FPS,
+   0
+};
+
+/**
+ * @brief Monotonic clock in nanoseconds.
+ */
+long long ti_clock_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Set the maximum number of frames per second.
+ * @param "fps"   frames per second, 0 for no limit
+ */
+void ti_frame_set_rate(int fps)
+{
+   g_frame.interval = fps > 0 ? 1000000000LL / fps : 0;
+   g_frame.current = g_frame.interval;
+}
+
+/**
+ * @brief Current frame interval in milliseconds, including any slowdown
+ *        for a lagging terminal.
+ */
+int ti_frame_get_interval_ms(void)
+{
+   return (int)((g_frame.current + 999999) / 1000000);
+}
+
+/**
+ * @brief Adjust the frame interval according to the bytes still
+ *        waiting in the terminal's output queue.
+ */
+static void adapt_to_drain(void)
+{
+   int queued = 0;
+   int lagging = ti_out_pending() > 0;
+   if (!lagging)
+   {
+      TI_STAT_ADD(TI_STAT_IOCTL, 1);
+      lagging = ioctl(ti_out_get_fd(), TIOCOUTQ, &queued) == 0 && queued > 0;
+   }
+
+   if (lagging)
+   {
+      // Terminal hasn't caught up: back off
+      long long slower = g_frame.current ? g_frame.current * 2 : 1000000;
+      g_frame.current = slower < TI_FRAME_MAX_INTERVAL ? slower : TI_FRAME_MAX_INTERVAL;
+   }
+   else if (g_frame.current > g_frame.interval)
+   {
+      long long faster = g_frame.current / 2;
+      g_frame.current = faster > g_frame.interval ? faster : g_frame.interval;
+   }
+}
+
+/**
+ * @brief Render the screen now, regardless of the frame rate.
+ *
+ * This is the escape hatch for output that must not wait, like
+ * echoing typed characters.  It also restarts the frame interval.
+ *
+ * @param "scr"   screen to render
+ * @return number of cells sent.
+ */
+int ti_frame_present(TI_SCREEN *scr)
+{
+   // Output was discarded for a stalled terminal: repaint it all
+   if (ti_out_take_dropped())
+      ti_screen_invalidate(scr);
+
+   int changed = ti_screen_render(scr);
+
+   g_frame.last = ti_clock_ns();
+   adapt_to_drain();
+
+   return changed;
+}
+
+/**
+ * @brief Render the screen if it has changes and the frame interval has passed.
+ *
+ * The return value is suitable as the timeout argument of `poll`.
+ * While output is queued for a non-blocking terminal, this function
+ * tries to write it and renders nothing until the queue is empty.
+ *
+ * @param "scr"   screen to render
+ * @return milliseconds until pending changes can be rendered, or -1
+ *         if there is nothing waiting to be rendered.
+ */
+int ti_frame_poll(TI_SCREEN *scr)
+{
+   if (!scr->dirty_rows && !scr->invalid)
+      return -1;
+
+   long long wait = g_frame.last + g_frame.current - ti_clock_ns();
+   if (wait > 0)
+      return (int)((wait + 999999) / 1000000);
+
+   if (ti_out_pending() > 0)
+   {
+      ti_out_flush();
+      if (ti_out_pending() > 0)
+      {
+         g_frame.last = ti_clock_ns();
+         adapt_to_drain();
+         return ti_frame_get_interval_ms();
+      }
+   }
+
+   ti_frame_present(scr);
+   return -1;
+}
+
+// Hide debugging code from Doxygen
+/** @cond */
+
+#ifdef SL_FRAME_MAIN
+
+#include "sl_caps.c"
+#include "sl_ioctl.c"
+#include "sl_libcaps.c"
+#include "sl_output.c"
+#include "sl_screen.c"
+#include "sl_utf8.c"
+#include "sl_gcache.c"
+#include "sl_record.c"
+
+int main(int argc, const char **argv)
+{
+   TI_SCREEN screen;
+   int rows, cols;
+   int frames = 0;
+   char buff[32];
+
+   if (!TIV_setup(0, NULL))
+      return 1;
+
+   ti_get_screen_size(&rows, &cols);
+   if (ti_screen_init(&screen, rows, cols) == 0)
+   {
+      long long start = ti_clock_ns();
+      for (int i=0; i<=1000000; ++i)
+      {
+         snprintf(buff, sizeof(buff), "count: %d", i);
+         ti_screen_put(&screen, rows / 2, 4, buff, TI_ATTR_BOLD);
+         if (ti_frame_poll(&screen) < 0 && !screen.dirty_rows)
+            ++frames;
+      }
+      ti_frame_present(&screen);
+      long long elapsed = ti_clock_ns() - start;
+
+      ti_screen_destroy(&screen);
+      printf("\n%d frames for 1000000 updates in %lld ms.\n", frames, elapsed / 1000000);
+   }
+
+   TIV_destroy_arrays(0, NULL);
+   return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/* Local Variables:          */
+/* compile-command:   "gcc  \*/
+/* -Wall -Werror -pedantic  \*/
+/* -ggdb -std=c99           \*/
+/* -DSL_FRAME_MAIN          \*/
+/* -fsanitize=address       \*/
+/* -ltinfo                  \*/
+/* -o sl_frame              \*/
+/* sl_frame.c"               */
+/* End:                      */
@@ -0,0 +1,446 @@
+/**
+ * @file sl_gcache.c
+ * @brief Grapheme clusters and a cache of measured strings.
+ *
+ * What the user sees as one character may be several codepoints: a
+ * letter with combining accents, a flag made of two regional
+ * indicators, or an emoji joined to others by ZERO WIDTH JOINER.
+ * @ref ti_grapheme_next finds where such a cluster ends and how many
+ * columns it takes.
+ *
+ * Each @ref TI_SCREEN owns a @ref TI_GCACHE.  @ref ti_gcache_layout
+ * returns the clusters and widths of a string, measuring it only the
+ * first time: an interface that redraws the same labels every frame
+ * pays for segmentation once per label.  The cache holds a fixed
+ * number of strings and replaces the least recently used.
+ *
+ * A screen cell holds one code.  A cluster of several codepoints is
+ * interned in the cache and the cell holds its @ref TI_CELL_CLUSTER
+ * code, which @ref ti_screen_render sends as the cluster's bytes.
+ * Interned clusters are kept for the life of the screen, up to a
+ * limit; past it, clusters are shown as their first codepoint.
+ *
+ * The segmentation is a subset of Unicode UAX #29 that covers what
+ * terminals display: combining marks and other zero-width characters,
+ * variation selectors (U+FE0F makes a narrow symbol an emoji two
+ * columns wide), emoji modifiers, ZWJ sequences, regional indicator
+ * pairs and CR LF.  Spacing marks and Hangul syllable rules beyond
+ * the zero-width jamo are not applied.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "termintel.h"
+
+#define TI_GCACHE_WAYS 4               ///< strings per set, replaced least recently used first
+#define TI_GCACHE_SETS 128             ///< must be a power of two
+#define TI_GCACHE_MAX_TEXT 512         ///< bytes, longer strings are not cached
+#define TI_GCACHE_MAX_CLUSTERS 4096    ///< interned clusters per cache
+#define TI_GCACHE_CLUSTER_BYTES 32     ///< longest cluster that can be interned
+
+/** @brief A string and its layout. */
+struct ti_gcache_entry {
+   unsigned int hash;
+   unsigned int len;           ///< bytes of @p text, 0 for an empty slot
+   unsigned int used;          ///< cache clock at last use
+   char *text;                 ///< copy of the string, following @p layout.clusters
+   TI_LAYOUT layout;
+};
+
+/** @brief A cluster of several codepoints, referenced by screen cells. */
+struct ti_gcache_cluster {
+   unsigned char len;
+   unsigned char width;
+   char bytes[TI_GCACHE_CLUSTER_BYTES];
+};
+
+struct ti_gcache {
+   struct ti_gcache_entry entries[TI_GCACHE_SETS * TI_GCACHE_WAYS];
+   unsigned int clock;
+
+   TI_CLUSTER scratch[TI_GCACHE_MAX_TEXT];   ///< layout under construction
+
+   struct ti_gcache_cluster *clusters;   ///< interned, indexed by code - TI_CELL_CLUSTER
+   int cluster_count;
+   unsigned short *cluster_hash;         ///< 1 + index into @p clusters, 0 if free
+};
+
+/** @brief Size of the open-addressed table of interned clusters. */
+#define TI_GCACHE_CLUSTER_SLOTS (TI_GCACHE_MAX_CLUSTERS * 2)
+
+static unsigned int hash_text(const char *text, size_t len)
+{
+   // FNV-1a
+   unsigned int hash = 2166136261u;
+   for (size_t i=0; i<len; ++i)
+   {
+      hash ^= (unsigned char)text[i];
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+static int is_regional(unsigned int code)
+{
+   return code >= 0x1F1E6 && code <= 0x1F1FF;
+}
+
+static int is_emoji_modifier(unsigned int code)
+{
+   return code >= 0x1F3FB && code <= 0x1F3FF;
+}
+
+/**
+ * @brief Find the end of the grapheme cluster at the start of @p text.
+ *
+ * @param "text"    UTF-8 text, need not be NULL-terminated
+ * @param "len"     bytes available at @p text, at least 1
+ * @param "width"   set to the columns of the cluster, 0 to 2, or -1 if
+ *                  it is a control character
+ * @return bytes in the cluster.
+ */
+int ti_grapheme_next(const char *text, size_t len, int *width)
+{
+   unsigned int base, code;
+   size_t pos = ti_utf8_decode_n(text, len, &base);
+
+   int cols = ti_char_width(base);
+   if (cols < 0)
+   {
+      // CR LF is one cluster, other controls stand alone
+      if (base == '\r' && pos < len && text[pos] == '\n')
+         ++pos;
+      *width = -1;
+      return (int)pos;
+   }
+   if (cols == 0)
+      cols = 1;   // a mark without a base is shown by itself
+
+   int pair = is_regional(base);
+
+   while (pos < len)
+   {
+      int count = ti_utf8_decode_n(text + pos, len - pos, &code);
+
+      if (code == 0x200D)
+      {
+         // ZERO WIDTH JOINER takes the next character into the cluster
+         pos += count;
+         if (pos < len)
+         {
+            count = ti_utf8_decode_n(text + pos, len - pos, &code);
+            if (ti_char_width(code) > 0)
+               pos += count;
+         }
+      }
+      else if (pair && is_regional(code))
+      {
+         pos += count;
+         pair = 0;
+         cols = 2;
+      }
+      else if (is_emoji_modifier(code) && cols == 2)
+         pos += count;
+      else if (ti_char_width(code) == 0)
+      {
+         pos += count;
+         if (code == 0xFE0F)
+            cols = 2;      // emoji presentation
+         else if (code == 0xFE0E && base >= 0x2000 && base < 0x3000)
+            cols = 1;      // text presentation of a symbol
+      }
+      else
+         break;
+   }
+
+   *width = cols;
+   return (int)pos;
+}
+
+/**
+ * @brief Create an empty cache.
+ * @return cache, or NULL if out of memory.
+ */
+TI_GCACHE *ti_gcache_create(void)
+{
+   return (TI_GCACHE*)calloc(1, sizeof(TI_GCACHE));
+}
+
+/**
+ * @brief Free a cache and everything it holds.
+ */
+void ti_gcache_destroy(TI_GCACHE *cache)
+{
+   if (cache)
+   {
+      for (int i=0; i<TI_GCACHE_SETS * TI_GCACHE_WAYS; ++i)
+         free(cache->entries[i].layout.clusters);
+      free(cache->clusters);
+      free(cache->cluster_hash);
+      free(cache);
+   }
+}
+
+/**
+ * @brief Get the code that stands for a cluster in a screen cell.
+ *
+ * A cluster of one codepoint is that codepoint.  Longer clusters are
+ * interned and get a @ref TI_CELL_CLUSTER code.
+ *
+ * @param "cache"   cache of the screen that will show the cluster
+ * @param "text"    the cluster, as found by @ref ti_grapheme_next
+ * @param "len"     bytes in the cluster
+ * @param "width"   columns of the cluster
+ * @return code for the cell, the first codepoint if the cluster can't
+ *         be interned.
+ */
+unsigned int ti_gcache_intern(TI_GCACHE *cache, const char *text, size_t len, int width)
+{
+   unsigned int code;
+   if ((size_t)ti_utf8_decode_n(text, len, &code) == len)
+      return code;
+
+   if (len > TI_GCACHE_CLUSTER_BYTES)
+      return code;
+
+   if (!cache->clusters)
+   {
+      cache->clusters = (struct ti_gcache_cluster*)
+         malloc(TI_GCACHE_MAX_CLUSTERS * sizeof(struct ti_gcache_cluster));
+      cache->cluster_hash = (unsigned short*)
+         calloc(TI_GCACHE_CLUSTER_SLOTS, sizeof(unsigned short));
+      if (!cache->clusters || !cache->cluster_hash)
+      {
+         free(cache->clusters);
+         free(cache->cluster_hash);
+         cache->clusters = NULL;
+         cache->cluster_hash = NULL;
+         return code;
+      }
+   }
+
+   unsigned int slot = hash_text(text, len) % TI_GCACHE_CLUSTER_SLOTS;
+   for (;;)
+   {
+      int index = cache->cluster_hash[slot] - 1;
+      if (index < 0)
+         break;
+
+      struct ti_gcache_cluster *cluster = &cache->clusters[index];
+      if (cluster->len == len && memcmp(cluster->bytes, text, len) == 0)
+         return TI_CELL_CLUSTER + index;
+
+      slot = (slot + 1) % TI_GCACHE_CLUSTER_SLOTS;
+   }
+
+   if (cache->cluster_count >= TI_GCACHE_MAX_CLUSTERS)
+      return code;
+
+   int index = cache->cluster_count++;
+   struct ti_gcache_cluster *cluster = &cache->clusters[index];
+   cluster->len = (unsigned char)len;
+   cluster->width = (unsigned char)width;
+   memcpy(cluster->bytes, text, len);
+   cache->cluster_hash[slot] = (unsigned short)(index + 1);
+
+   return TI_CELL_CLUSTER + index;
+}
+
+/**
+ * @brief Get the bytes of an interned cluster.
+ * @param "cache"   cache that interned the cluster
+ * @param "code"    code returned by @ref ti_gcache_intern
+ * @param "len"     set to the bytes in the cluster
+ * @param "width"   if not NULL, set to the columns of the cluster
+ * @return the cluster's UTF-8 bytes, not NULL-terminated, or NULL if
+ *         @p code is not an interned cluster.
+ */
+const char *ti_gcache_cluster(const TI_GCACHE *cache, unsigned int code, int *len, int *width)
+{
+   if (!cache || code < TI_CELL_CLUSTER || code - TI_CELL_CLUSTER >= (unsigned int)cache->cluster_count)
+      return NULL;
+
+   const struct ti_gcache_cluster *cluster = &cache->clusters[code - TI_CELL_CLUSTER];
+   *len = cluster->len;
+   if (width)
+      *width = cluster->width;
+   return cluster->bytes;
+}
+
+/**
+ * @brief Segment and measure a string, saving the result in @p entry.
+ * @return 0 for success, otherwise errno.
+ */
+static int build_layout(TI_GCACHE *cache, struct ti_gcache_entry *entry, const char *text, size_t len)
+{
+   TI_CLUSTER *scratch = cache->scratch;
+   int count = 0, total = 0;
+   size_t pos = 0;
+
+   while (pos < len)
+   {
+      int width;
+      int bytes = ti_grapheme_next(text + pos, len - pos, &width);
+
+      TI_CLUSTER *cluster = &scratch[count++];
+      cluster->offset = (unsigned short)pos;
+      cluster->len = (unsigned short)bytes;
+      if (width < 0)
+      {
+         cluster->code = '?';
+         cluster->width = 1;
+      }
+      else
+      {
+         cluster->code = ti_gcache_intern(cache, text + pos, bytes, width);
+         cluster->width = (unsigned char)width;
+      }
+
+      total += cluster->width;
+      pos += bytes;
+   }
+
+   // Clusters and a copy of the text in one allocation
+   size_t size = count * sizeof(TI_CLUSTER);
+   char *block = (char*)malloc(size + len);
+   if (!block)
+      return ENOMEM;
+
+   memcpy(block, scratch, size);
+   memcpy(block + size, text, len);
+
+   free(entry->layout.clusters);
+   entry->layout.clusters = (TI_CLUSTER*)block;
+   entry->layout.count = count;
+   entry->layout.width = total;
+   entry->text = block + size;
+   entry->len = (unsigned int)len;
+
+   return 0;
+}
+
+/**
+ * @brief Get the grapheme clusters and width of a string.
+ *
+ * The result is cached, so measuring the same string again costs a
+ * hash and a comparison.
+ *
+ * @param "cache"    cache, usually the @p gcache of a @ref TI_SCREEN
+ * @param "text"     UTF-8 text, need not be NULL-terminated
+ * @param "len"      bytes in @p text
+ * @param "layout"   set to the layout, whose clusters are valid until
+ *                   the next call with this cache
+ * @return 0 for success, E2BIG if the text is too long to cache (use
+ *         @ref ti_grapheme_next instead), or ENOMEM.
+ */
+int ti_gcache_layout(TI_GCACHE *cache, const char *text, size_t len, TI_LAYOUT *layout)
+{
+   if (len > TI_GCACHE_MAX_TEXT)
+      return E2BIG;
+
+   unsigned int hash = hash_text(text, len);
+   struct ti_gcache_entry *set = &cache->entries[(hash & (TI_GCACHE_SETS - 1)) * TI_GCACHE_WAYS];
+   struct ti_gcache_entry *victim = set;
+
+   ++cache->clock;
+
+   for (int i=0; i<TI_GCACHE_WAYS; ++i)
+   {
+      struct ti_gcache_entry *entry = &set[i];
+      if (entry->layout.clusters && entry->hash == hash && entry->len == len
+          && memcmp(entry->text, text, len) == 0)
+      {
+         entry->used = cache->clock;
+         *layout = entry->layout;
+         return 0;
+      }
+
+      if (!entry->layout.clusters)
+         victim = entry;
+      else if (victim->layout.clusters && entry->used < victim->used)
+         victim = entry;
+   }
+
+   int rval = build_layout(cache, victim, text, len);
+   if (rval)
+      return rval;
+
+   victim->hash = hash;
+   victim->used = cache->clock;
+   *layout = victim->layout;
+   return 0;
+}
+
+// Hide debugging code from Doxygen
+/** @cond */
+
+#ifdef SL_GCACHE_MAIN
+
+#include <stdio.h>
+#include <time.h>
+
+#include "sl_utf8.c"
+
+static double seconds(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, const char **argv)
+{
+   const char *labels[] = {
+      "Name",
+      "e\xcc\x81t\xc3\xa9",                                             // combining and precomposed
+      "\xf0\x9f\x87\xaf\xf0\x9f\x87\xb5 flag",                          // regional indicator pair
+      "\xf0\x9f\x91\x8d\xf0\x9f\x8f\xbd thumbs",                        // emoji with modifier
+      "\xf0\x9f\x91\xa9\xe2\x80\x8d\xf0\x9f\x92\xbb coder",             // ZWJ sequence
+      "\xe2\x9d\xa4\xef\xb8\x8f heart",                                 // emoji presentation selector
+      NULL
+   };
+
+   TI_GCACHE *cache = ti_gcache_create();
+   TI_LAYOUT layout;
+
+   for (const char **ptr = labels; *ptr; ++ptr)
+   {
+      ti_gcache_layout(cache, *ptr, strlen(*ptr), &layout);
+      printf("%-24s %2d clusters, %2d columns:", *ptr, layout.count, layout.width);
+      for (int i=0; i<layout.count; ++i)
+         printf(" %d", layout.clusters[i].width);
+      printf("\n");
+   }
+
+   // The same labels every frame
+   double start = seconds();
+   long total = 0;
+   for (int frame=0; frame<1000000; ++frame)
+      for (const char **ptr = labels; *ptr; ++ptr)
+      {
+         ti_gcache_layout(cache, *ptr, strlen(*ptr), &layout);
+         total += layout.width;
+      }
+   printf("6 million cached measurements in %.3f s (%ld)\n", seconds() - start, total);
+
+   ti_gcache_destroy(cache);
+   return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/* Local Variables:          */
+/* compile-command:   "gcc  \*/
+/* -Wall -Werror -pedantic  \*/
+/* -ggdb -std=c99           \*/
+/* -DSL_GCACHE_MAIN         \*/
+/* -fsanitize=address       \*/
+/* -o sl_gcache             \*/
+/* sl_gcache.c"              */
+/* End:                      */
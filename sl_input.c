@@ -0,0 +1,998 @@
+/**
+ * @file sl_input.c
+ * @brief Buffered terminal input split into keypress and paste events.
+ *
+ * Where @ref ti_get_keypress reads one burst of input and treats it as
+ * one keypress, a @ref TI_INPUT keeps a ring buffer of everything read
+ * and @ref ti_input_next takes one event at a time from it: a typed
+ * character, a key from a capset, or an escape sequence that is not
+ * recognized.  Several keys arriving in one read are returned as
+ * several events, and a sequence split between reads is put back
+ * together.
+ *
+ * With bracketed paste turned on (@ref ti_input_set_paste), the
+ * terminal marks pasted text, and the text is returned as
+ * @ref TI_EVENT_PASTE events that point into the ring buffer.  The
+ * pasted bytes are neither copied nor examined one at a time: each
+ * event delivers everything read so far, up to the size of the
+ * buffer, so a paste of many megabytes arrives in a few large pieces.
+ *
+ * With mouse tracking turned on (@ref ti_input_set_mouse), SGR 1006
+ * mouse reports are returned as @ref TI_EVENT_MOUSE events.  Motion
+ * reports that are already waiting are collapsed into one event with
+ * the latest position, so an application that falls behind while
+ * the mouse is dragged sees where the mouse is, not where it was.
+ *
+ * Keys that send escape sequences with modifiers, like Ctrl+Shift+Up,
+ * and keys reported by the CSI u keyboard protocol (@ref
+ * ti_input_set_keyboard) are decoded from the sequence into a key code
+ * and modifier flags, without searching a capset.
+ *
+ * The terminal must be in non-canonical mode, for example after
+ * @ref tios_disable_echo or @ref tios_set_raw_mode.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
+
+#include "termintel.h"
+
+#define TI_INPUT_DEFAULT_SIZE (64 * 1024)
+#define TI_INPUT_MIN_SIZE 256
+#define TI_INPUT_ESC_DELAY 25        ///< milliseconds
+#define TI_INPUT_MAX_SEQUENCE 64
+
+/** @brief Results of a tokenizer step */
+enum ti_token_result {
+   TOKEN_MORE,    ///< more input is needed
+   TOKEN_EVENT,   ///< the event was set
+   TOKEN_AGAIN    ///< input was consumed without an event, try again
+};
+
+// Used if terminfo doesn't list the paste capabilities
+static const char default_paste_on[] = "\033[?2004h";
+static const char default_paste_off[] = "\033[?2004l";
+static const char default_paste_start[] = "\033[200~";
+static const char default_paste_end[] = "\033[201~";
+
+// Mouse tracking modes, indexed by enum ti_mouse_mode, always with
+// SGR 1006 encoding, which has no limit on coordinates
+static const char *mouse_modes[] = {
+   "\033[?1006l\033[?1003l\033[?1002l\033[?1000l",
+   "\033[?1000h\033[?1006h",
+   "\033[?1002h\033[?1006h",
+   "\033[?1003h\033[?1006h"
+};
+
+static const char *lib_sequence(int index, const char *fallback)
+{
+   const char *seq = TIV_get_sequence(&caps_LIB[index]);
+   return seq && *seq ? seq : fallback;
+}
+
+/**
+ * @brief Initialize a @ref TI_INPUT.
+ * @param "in"     input to initialize
+ * @param "fd"     file descriptor to read, usually STDIN_FILENO
+ * @param "size"   bytes of input buffer, rounded up to a power of two,
+ *                 or 0 for the default of 64KB.  Pasted text is
+ *                 delivered in pieces of up to this size.
+ * @param "keys"   capset of keys to recognize, like `caps_KEYS`, or NULL
+ * @return 0 for success, otherwise errno.
+ */
+int ti_input_init(TI_INPUT *in, int fd, size_t size, TIV *keys)
+{
+   memset(in, 0, sizeof(TI_INPUT));
+
+   if (size == 0)
+      size = TI_INPUT_DEFAULT_SIZE;
+
+   size_t ring = TI_INPUT_MIN_SIZE;
+   while (ring < size && ring <= ((size_t)-1) / 4)
+      ring <<= 1;
+
+   in->ring = (char*)malloc(ring);
+   if (!in->ring)
+      return ENOMEM;
+
+   in->size = ring;
+   in->fd = fd;
+   in->keys = keys;
+   in->esc_delay = TI_INPUT_ESC_DELAY;
+   return 0;
+}
+
+/**
+ * @brief Free the buffer of a @ref TI_INPUT.
+ */
+void ti_input_destroy(TI_INPUT *in)
+{
+   free(in->ring);
+   in->ring = NULL;
+   in->size = 0;
+}
+
+/**
+ * @brief Turn bracketed paste mode on or off.
+ *
+ * Turn it off before the program exits, or the shell will see the
+ * paste markers.
+ */
+void ti_input_set_paste(int enable)
+{
+   if (enable)
+      ti_out_puts(lib_sequence(LIB_BRACKETED_PASTE_ON, default_paste_on));
+   else
+      ti_out_puts(lib_sequence(LIB_BRACKETED_PASTE_OFF, default_paste_off));
+
+   ti_out_flush();
+   fflush(stdout);
+}
+
+/**
+ * @brief Turn on progressive keyboard enhancement (the CSI u protocol)
+ *        if the terminal supports it, or turn it off.
+ *
+ * The flags are pushed on the terminal's stack and the terminal is
+ * asked for its current flags.  Terminals without the protocol ignore
+ * both.  When the answer arrives, @ref ti_input_next sets @p keyboard
+ * of @p in and from then on decodes keys before searching the capset.
+ *
+ * Call with 0 before the program exits to restore the previous flags.
+ *
+ * @param "in"      input that will read the answer
+ * @param "flags"   TI_KEYBOARD_ flags, or 0 to turn off
+ */
+void ti_input_set_keyboard(TI_INPUT *in, int flags)
+{
+   char buff[32];
+
+   if (flags)
+   {
+      snprintf(buff, sizeof(buff), "\033[>%du\033[?u", flags);
+      ti_out_puts(buff);
+   }
+   else
+   {
+      ti_out_puts("\033[<u");
+      in->keyboard = 0;
+   }
+
+   ti_out_flush();
+   fflush(stdout);
+}
+
+/**
+ * @brief Set the mouse tracking mode.
+ *
+ * Set the mode to TI_MOUSE_OFF before the program exits, or the shell
+ * will receive the mouse reports.
+ *
+ * @param "mode"   one of enum ti_mouse_mode
+ */
+void ti_input_set_mouse(int mode)
+{
+   // Turn off the current mode first, terminals keep the highest one set
+   ti_out_puts(mouse_modes[TI_MOUSE_OFF]);
+   if (mode > TI_MOUSE_OFF && mode <= TI_MOUSE_MOTION)
+      ti_out_puts(mouse_modes[mode]);
+
+   ti_out_flush();
+   fflush(stdout);
+}
+
+static unsigned char peek(const TI_INPUT *in, size_t offset)
+{
+   return (unsigned char)in->ring[(in->head + offset) & (in->size - 1)];
+}
+
+/**
+ * @brief Copy unread bytes into a contiguous buffer.
+ */
+static void copy_out(const TI_INPUT *in, size_t offset, size_t len, char *buff)
+{
+   for (size_t i=0; i<len; ++i)
+      buff[i] = (char)peek(in, offset + i);
+}
+
+/**
+ * @brief Point the slices of @p event at unread bytes.
+ */
+static void set_slices(const TI_INPUT *in, size_t offset, size_t len, TI_EVENT *event)
+{
+   size_t pos = (in->head + offset) & (in->size - 1);
+   size_t first = in->size - pos;
+   if (first > len)
+      first = len;
+
+   event->slices[0].data = in->ring + pos;
+   event->slices[0].len = first;
+   event->slices[1].data = in->ring;
+   event->slices[1].len = len - first;
+}
+
+/**
+ * @brief Find a byte among the unread bytes from @p from to @p to.
+ * @return offset of the byte, or @p to if not found.
+ */
+static size_t find_byte(const TI_INPUT *in, size_t from, size_t to, char byte)
+{
+   while (from < to)
+   {
+      size_t pos = (in->head + from) & (in->size - 1);
+      size_t run = in->size - pos;
+      if (run > to - from)
+         run = to - from;
+
+      const char *hit = (const char*)memchr(in->ring + pos, byte, run);
+      if (hit)
+         return from + (hit - (in->ring + pos));
+      from += run;
+   }
+
+   return to;
+}
+
+// Result of fill() when the terminal was resized, not an errno
+#define FILL_RESIZED (-1)
+
+/**
+ * @brief Wait up to @p timeout_ms for input and add it to the ring.
+ *
+ * After @ref ti_winch_init, also wait for SIGWINCH and handle it with
+ * @ref ti_winch_dispatch.
+ *
+ * @return 0 if input was added, FILL_RESIZED if the terminal size
+ *         changed, ETIMEDOUT if no input came, ENOBUFS if the ring is
+ *         full, EIO at the end of input, otherwise errno.
+ */
+static int fill(TI_INPUT *in, int timeout_ms)
+{
+   size_t space = in->size - (in->tail - in->head);
+   if (space == 0)
+      return ENOBUFS;
+
+   struct pollfd pfd[2] = { { in->fd, POLLIN, 0 }, { ti_winch_fd(), POLLIN, 0 } };
+   int watch_winch = pfd[1].fd >= 0;
+   long long deadline = timeout_ms > 0 ? ti_clock_ns() + (long long)timeout_ms * 1000000 : 0;
+
+   for (;;)
+   {
+      int wait = timeout_ms;
+      if (deadline)
+      {
+         long long remaining = deadline - ti_clock_ns();
+         wait = remaining > 0 ? (int)((remaining + 999999) / 1000000) : 0;
+      }
+
+      // Signals are counted, so only a resize in progress costs a syscall
+      int winch_wait = watch_winch ? ti_winch_dispatch() : -1;
+      if (winch_wait == 0)
+         return FILL_RESIZED;
+      if (winch_wait > 0 && (wait < 0 || winch_wait < wait))
+         wait = winch_wait;
+
+      int ready = poll(pfd, watch_winch ? 2 : 1, wait);
+      if (ready < 0)
+      {
+         int rval = errno;
+         // Keep waiting through SIGWINCH, but not other signals
+         if (rval == EINTR && watch_winch)
+         {
+            winch_wait = ti_winch_dispatch();
+            if (winch_wait == 0)
+               return FILL_RESIZED;
+            if (winch_wait > 0)
+               continue;
+         }
+         return rval;
+      }
+
+      if (pfd[0].revents)
+         break;
+
+      if (ready == 0 && wait != winch_wait)
+         return ETIMEDOUT;
+   }
+
+   size_t pos = in->tail & (in->size - 1);
+   struct iovec iov[2];
+   iov[0].iov_base = in->ring + pos;
+   iov[0].iov_len = in->size - pos < space ? in->size - pos : space;
+   iov[1].iov_base = in->ring;
+   iov[1].iov_len = space - iov[0].iov_len;
+
+   ssize_t got = readv(in->fd, iov, iov[1].iov_len ? 2 : 1);
+   TI_STAT_ADD(TI_STAT_READS, 1);
+   if (got < 0)
+      return errno == EAGAIN ? ETIMEDOUT : errno;
+   if (got == 0)
+      return EIO;
+
+   TI_STAT_ADD(TI_STAT_READ_BYTES, got);
+   TI_TRACE_INPUT();
+   ti_record_input(in->ring + pos, (size_t)got < iov[0].iov_len ? (size_t)got : iov[0].iov_len);
+   if ((size_t)got > iov[0].iov_len)
+      ti_record_input(in->ring, got - iov[0].iov_len);
+   in->tail += got;
+   return 0;
+}
+
+/**
+ * @brief Length of an escape sequence in the unread input.
+ * @param "in"       input
+ * @param "offset"   position of the ESC among the unread bytes
+ * @param "avail"    unread bytes, more than @p offset
+ * @param "final"    set if no more input is coming soon, so a partial
+ *                   sequence must be taken as it is
+ * @return bytes in the sequence, or 0 if more input is needed.
+ */
+static size_t sequence_length(const TI_INPUT *in, size_t offset, size_t avail, int final)
+{
+   avail -= offset;
+   if (avail < 2)
+      return final ? 1 : 0;
+
+   unsigned char second = peek(in, offset + 1);
+   if (second == '[')
+   {
+      // The Linux console's function keys, ESC [ [ A to ESC [ [ E
+      if (avail >= 3 && peek(in, offset + 2) == '[')
+         return avail >= 4 ? 4 : (final ? 3 : 0);
+
+      // CSI: parameter and intermediate bytes, then a final byte
+      size_t i;
+      for (i=2; i<avail && i<TI_INPUT_MAX_SEQUENCE; ++i)
+      {
+         unsigned char chr = peek(in, offset + i);
+         if (chr >= 0x40 && chr <= 0x7E)
+            return i + 1;
+         if (chr < 0x20 || chr > 0x7E)
+            return i;   // malformed: end before the stray byte
+      }
+      return i >= TI_INPUT_MAX_SEQUENCE || final ? i : 0;
+   }
+   else if (second == 'O')
+   {
+      // SS3, used for keypad and function keys
+      if (avail < 3)
+         return final ? avail : 0;
+      return 3;
+   }
+   else if (second == '\033' || second >= 0x80)
+      return 1;   // ESC alone
+   else
+      return 2;   // ESC and a character, usually Alt with a key
+}
+
+/**
+ * @brief Read a number of a mouse report.
+ * @return pointer after the number, or NULL if there is no number.
+ */
+static const char *parse_number(const char *ptr, const char *end, int *value)
+{
+   if (ptr >= end || *ptr < '0' || *ptr > '9')
+      return NULL;
+
+   int val = 0;
+   while (ptr < end && *ptr >= '0' && *ptr <= '9' && val < 100000)
+      val = val * 10 + (*ptr++ - '0');
+
+   *value = val;
+   return ptr;
+}
+
+/**
+ * @brief Decode an SGR 1006 mouse report, `ESC [ < button ; col ; row M`.
+ *
+ * The final byte is `m` for a button release.
+ *
+ * @return 1 if @p seq is a mouse report, otherwise 0.
+ */
+static int parse_mouse(const char *seq, size_t len, TI_EVENT *event)
+{
+   const char *end = seq + len - 1;
+   if (len < 9 || seq[1] != '[' || seq[2] != '<' || (*end != 'M' && *end != 'm'))
+      return 0;
+
+   int button, col, row;
+   const char *ptr = parse_number(seq + 3, end, &button);
+   if (!ptr || *ptr != ';' || !(ptr = parse_number(ptr + 1, end, &col))
+       || *ptr != ';' || !(ptr = parse_number(ptr + 1, end, &row)) || ptr != end)
+      return 0;
+
+   event->type = TI_EVENT_MOUSE;
+   event->mods = (button & 4 ? TI_MOD_SHIFT : 0)
+      | (button & 8 ? TI_MOD_ALT : 0)
+      | (button & 16 ? TI_MOD_CTRL : 0);
+   event->code = button & ~(4 | 8 | 16 | 32);
+   if (*end == 'm')
+      event->action = TI_MOUSE_RELEASE;
+   else if (button & 32)
+      event->action = TI_MOUSE_MOVE;
+   else
+      event->action = TI_MOUSE_PRESS;
+   event->row = row - 1;
+   event->col = col - 1;
+   return 1;
+}
+
+// Keys of `ESC [ number ~` sequences, indexed by number
+static const unsigned int tilde_keys[] = {
+   0,             TI_KEY_HOME,   TI_KEY_INSERT, TI_KEY_DELETE,
+   TI_KEY_END,    TI_KEY_PAGE_UP, TI_KEY_PAGE_DOWN, TI_KEY_HOME,
+   TI_KEY_END,    0,             0,             TI_KEY_F1,
+   TI_KEY_F2,     TI_KEY_F3,     TI_KEY_F4,     TI_KEY_F5,
+   0,             TI_KEY_F6,     TI_KEY_F7,     TI_KEY_F8,
+   TI_KEY_F9,     TI_KEY_F10,    0,             TI_KEY_F11,
+   TI_KEY_F12
+};
+
+// First and last private use codes of the CSI u protocol's keys
+#define CSI_U_FIRST_PRIVATE 57344
+#define CSI_U_LAST_PRIVATE  63743
+#define CSI_U_KEYPAD_BEGIN  57427
+
+/**
+ * @brief Key of a sequence ending with a letter, like `ESC [ 1 ; 5 A`
+ *        or `ESC O P`.
+ * @return key code, or 0 if not a key.
+ */
+static unsigned int letter_key(char letter, int ss3)
+{
+   switch(letter)
+   {
+      case 'A': return TI_KEY_UP;
+      case 'B': return TI_KEY_DOWN;
+      case 'C': return TI_KEY_RIGHT;
+      case 'D': return TI_KEY_LEFT;
+      case 'E': return CSI_U_KEYPAD_BEGIN;
+      case 'F': return TI_KEY_END;
+      case 'H': return TI_KEY_HOME;
+      case 'P': return TI_KEY_F1;
+      case 'Q': return TI_KEY_F2;
+      // `ESC [ 1 ; mods R` is also a cursor position report
+      case 'R': return ss3 ? TI_KEY_F3 : 0;
+      case 'S': return TI_KEY_F4;
+      default:  return 0;
+   }
+}
+
+/**
+ * @brief Read the parameters of a CSI sequence, up to three fields of
+ *        up to three colon-separated values each.
+ * @return 1 if the parameters are well-formed, otherwise 0.
+ */
+static int parse_params(const char *ptr, const char *end, int params[3][3])
+{
+   int field = 0, sub = 0;
+
+   memset(params, 0, 9 * sizeof(int));
+   while (ptr < end)
+   {
+      if (*ptr == ';')
+      {
+         if (++field >= 3)
+            return 0;
+         sub = 0;
+         ++ptr;
+      }
+      else if (*ptr == ':')
+      {
+         if (++sub >= 3)
+            return 0;
+         ++ptr;
+      }
+      else if (!(ptr = parse_number(ptr, end, &params[field][sub])))
+         return 0;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief Decode a key from a CSI u sequence, `ESC [ code ; mods u`, or
+ *        from a sequence of a cursor, editing or function key, with or
+ *        without modifiers.
+ *
+ * The modifiers are encoded as one more than the TI_MOD_ flags, with an
+ * optional colon and the key action.
+ *
+ * @return 1 if the sequence is a key, otherwise 0.
+ */
+static int parse_key(const char *seq, size_t len, TI_EVENT *event)
+{
+   int params[3][3];
+   unsigned int code = 0;
+   char final = seq[len - 1];
+
+   if (len == 3 && seq[1] == 'O')
+   {
+      code = letter_key(final, 1);
+      memset(params, 0, sizeof(params));
+   }
+   else if (len >= 3 && seq[1] == '[')
+   {
+      if (!parse_params(seq + 2, seq + len - 1, params))
+         return 0;
+
+      if (final == 'u')
+      {
+         code = params[0][0];
+         // Shifted key, if the terminal reports alternate keys
+         if (params[0][1] && (params[1][0] - 1) & TI_MOD_SHIFT)
+            code = params[0][1];
+         // Text of the key, if the terminal reports it
+         if (params[2][0])
+            code = params[2][0];
+      }
+      else if (final == '~')
+      {
+         int number = params[0][0];
+         if (number >= CSI_U_FIRST_PRIVATE && number <= CSI_U_LAST_PRIVATE)
+            code = number;
+         else if (number < (int)(sizeof(tilde_keys) / sizeof(tilde_keys[0])))
+            code = tilde_keys[number];
+      }
+      else if (params[0][0] <= 1)
+         code = letter_key(final, 0);
+   }
+
+   if (code == 0 || code > TI_KEY_F12)
+      return 0;
+
+   if (code < 0x20 || code == 0x7F || code >= TI_KEY_INSERT
+       || (code >= CSI_U_FIRST_PRIVATE && code <= CSI_U_LAST_PRIVATE))
+      event->type = TI_EVENT_KEY;
+   else
+      event->type = TI_EVENT_CHAR;
+
+   event->code = code;
+   event->mods = params[1][0] > 1 ? params[1][0] - 1 : 0;
+   event->action = params[1][1] ? params[1][1] : TI_KEY_PRESS;
+   return 1;
+}
+
+/**
+ * @brief Read the terminal's answer to the keyboard flags query,
+ *        `ESC [ ? flags u`.
+ * @return 1 if the sequence is the answer, otherwise 0.
+ */
+static int parse_keyboard_report(TI_INPUT *in, const char *seq, size_t len)
+{
+   int flags;
+
+   if (len < 5 || seq[1] != '[' || seq[2] != '?' || seq[len - 1] != 'u'
+       || parse_number(seq + 3, seq + len - 1, &flags) != seq + len - 1)
+      return 0;
+
+   in->keyboard = flags;
+   return 1;
+}
+
+/**
+ * @brief Replace a motion event with the latest of the motion reports
+ *        that follow it in the input.
+ *
+ * Reports are taken while they move the mouse with the same buttons
+ * and modifiers, including any that are waiting to be read, so that
+ * a flood of motion becomes one event.
+ */
+static void coalesce_motion(TI_INPUT *in, TI_EVENT *event)
+{
+   char buff[TI_INPUT_MAX_SEQUENCE + 1];
+   TI_EVENT next;
+   int read_more = 1;
+
+   for (;;)
+   {
+      size_t avail = in->tail - in->head;
+      size_t offset = in->release;
+
+      if (offset == avail)
+      {
+         // Take reports the terminal has sent but we haven't read yet
+         if (!read_more)
+            return;
+         read_more = 0;
+
+         int rval = fill(in, 0);
+         if (rval == FILL_RESIZED)
+            in->resized = 1;
+         if (rval != 0)
+            return;
+         continue;
+      }
+
+      if (peek(in, offset) != '\033')
+         return;
+
+      size_t len = sequence_length(in, offset, avail, 0);
+      if (len == 0)
+         return;
+
+      copy_out(in, offset, len, buff);
+      if (!parse_mouse(buff, len, &next)
+          || next.action != TI_MOUSE_MOVE
+          || next.code != event->code
+          || next.mods != event->mods)
+         return;
+
+      in->head += offset;
+      in->release = len;
+      event->row = next.row;
+      event->col = next.col;
+      set_slices(in, 0, len, event);
+   }
+}
+
+/**
+ * @brief Take the next piece of pasted text, up to the end marker.
+ */
+static int paste_token(TI_INPUT *in, TI_EVENT *event, int final)
+{
+   const char *marker = lib_sequence(LIB_PASTE_END, default_paste_end);
+   size_t marker_len = strlen(marker);
+   size_t avail = in->tail - in->head;
+   size_t ready = avail;
+   size_t pos = 0;
+
+   while (pos < avail)
+   {
+      size_t found = find_byte(in, pos, avail, marker[0]);
+      if (found == avail)
+         break;
+
+      size_t matched = 1;
+      while (matched < marker_len && found + matched < avail
+             && peek(in, found + matched) == (unsigned char)marker[matched])
+         ++matched;
+
+      if (matched == marker_len)
+      {
+         event->type = TI_EVENT_PASTE;
+         set_slices(in, 0, found, event);
+         in->release = found + marker_len;
+         in->pasting = 0;
+         return TOKEN_EVENT;
+      }
+
+      if (found + matched == avail)
+      {
+         // Could be the start of the marker: hold it back
+         ready = found;
+         break;
+      }
+
+      pos = found + 1;
+   }
+
+   // Collect everything available before delivering it
+   if (ready == 0 || (!final && avail < in->size))
+      return TOKEN_MORE;
+
+   event->type = TI_EVENT_PASTE;
+   event->more = 1;
+   set_slices(in, 0, ready, event);
+   in->release = ready;
+   return TOKEN_EVENT;
+}
+
+/**
+ * @brief Take the next event from the unread input.
+ * @param "in"      input with at least one unread byte
+ * @param "event"   event to set
+ * @param "final"   set if no more input is coming soon
+ * @return one of enum ti_token_result.
+ */
+static int next_token(TI_INPUT *in, TI_EVENT *event, int final)
+{
+   size_t avail = in->tail - in->head;
+   char buff[TI_INPUT_MAX_SEQUENCE + 1];
+
+   memset(event, 0, sizeof(TI_EVENT));
+   event->key_index = -1;
+
+   if (in->pasting)
+      return paste_token(in, event, final);
+
+   unsigned char lead = peek(in, 0);
+   if (lead == '\033')
+   {
+      size_t len = sequence_length(in, 0, avail, final);
+      if (len == 0)
+         return TOKEN_MORE;
+
+      copy_out(in, 0, len, buff);
+      buff[len] = '\0';
+
+      const char *start = lib_sequence(LIB_PASTE_START, default_paste_start);
+      if (strcmp(buff, start) == 0)
+      {
+         in->head += len;
+         in->pasting = 1;
+         return TOKEN_AGAIN;
+      }
+
+      if (parse_mouse(buff, len, event))
+      {
+         set_slices(in, 0, len, event);
+         in->release = len;
+         if (event->action == TI_MOUSE_MOVE)
+            coalesce_motion(in, event);
+         return TOKEN_EVENT;
+      }
+
+      if (parse_keyboard_report(in, buff, len))
+      {
+         in->head += len;
+         return TOKEN_AGAIN;
+      }
+
+      // With the keyboard protocol, every key sequence can be decoded,
+      // otherwise the capset comes first, as with ti_get_keypress
+      int decoded = in->keyboard && parse_key(buff, len, event);
+      if (!decoded && in->keys)
+      {
+         event->key_index = TIV_find_index_by_sequence(in->keys, buff);
+         if (event->key_index >= 0)
+         {
+            event->type = TI_EVENT_KEY;
+            decoded = 1;
+         }
+      }
+
+      if (!decoded && !parse_key(buff, len, event))
+      {
+         if (len == 1)
+         {
+            event->type = TI_EVENT_CHAR;
+            event->code = lead;
+         }
+         else if (len == 2)
+         {
+            // Terminals send ESC before a key typed with Alt
+            event->type = TI_EVENT_CHAR;
+            event->code = (unsigned char)buff[1];
+            event->mods = TI_MOD_ALT;
+         }
+         else
+            event->type = TI_EVENT_UNKNOWN;
+      }
+
+      set_slices(in, 0, len, event);
+      in->release = len;
+      return TOKEN_EVENT;
+   }
+
+   // A character, possibly several UTF-8 bytes
+   size_t need = 1;
+   if (lead >= 0xF0 && lead <= 0xF7)
+      need = 4;
+   else if (lead >= 0xE0)
+      need = 3;
+   else if (lead >= 0xC0)
+      need = 2;
+
+   if (avail < need)
+   {
+      if (!final)
+         return TOKEN_MORE;
+      need = avail;
+   }
+
+   copy_out(in, 0, need, buff);
+   int used = ti_utf8_decode_n(buff, need, &event->code);
+   if (used < 1)
+      used = 1;
+
+   event->type = TI_EVENT_CHAR;
+   set_slices(in, 0, used, event);
+   in->release = used;
+   return TOKEN_EVENT;
+}
+
+/**
+ * @brief Set @p event to report the terminal's new size.
+ */
+static void resize_event(TI_EVENT *event)
+{
+   memset(event, 0, sizeof(TI_EVENT));
+   event->type = TI_EVENT_RESIZE;
+   event->key_index = -1;
+   ti_get_screen_size(&event->row, &event->col);
+}
+
+/**
+ * @brief Wait for and return the next input event.
+ *
+ * An escape sequence is taken as complete when its last byte arrives,
+ * or when no more input arrives within a short delay, which is how a
+ * lone ESC key is recognized.
+ *
+ * After @ref ti_winch_init, a resize of the terminal is returned as a
+ * @ref TI_EVENT_RESIZE event, once the size has settled.
+ *
+ * @param "in"           input initialized with @ref ti_input_init
+ * @param "event"        set to the event
+ * @param "timeout_ms"   milliseconds to wait for input, -1 to wait
+ *                       indefinitely
+ * @return 0 if @p event was set, ETIMEDOUT if no input arrived in
+ *         time, EIO at the end of input, EINTR if a signal arrived,
+ *         otherwise errno.
+ */
+int ti_input_next(TI_INPUT *in, TI_EVENT *event, int timeout_ms)
+{
+   int final = 0;
+
+   // Drop the bytes of the previous event, which the caller is done with
+   in->head += in->release;
+   in->release = 0;
+
+   // A resize met while coalescing mouse motion
+   if (in->resized)
+   {
+      in->resized = 0;
+      resize_event(event);
+      return 0;
+   }
+
+   for (;;)
+   {
+      if (in->tail != in->head)
+      {
+         int result = next_token(in, event, final);
+         if (result == TOKEN_EVENT)
+            return 0;
+         if (result == TOKEN_AGAIN)
+         {
+            final = 0;
+            continue;
+         }
+      }
+
+      // Wait briefly for the rest of a sequence or paste, otherwise as asked
+      int wait;
+      if (in->tail == in->head)
+         wait = timeout_ms;
+      else if (!in->pasting)
+         wait = in->esc_delay;
+      else
+         wait = final ? timeout_ms : 0;
+
+      int rval = fill(in, wait);
+      if (rval == FILL_RESIZED)
+      {
+         resize_event(event);
+         return 0;
+      }
+      else if (rval == 0)
+         final = 0;
+      else if ((rval == ETIMEDOUT || rval == ENOBUFS) && in->tail != in->head && !final)
+         final = 1;
+      else
+         return rval;
+   }
+}
+
+// Hide debugging code from Doxygen
+/** @cond */
+
+#ifdef SL_INPUT_MAIN
+
+#include <unistd.h>
+
+#include "sl_caps.c"
+#include "sl_ioctl.c"
+#include "sl_libcaps.c"
+#include "sl_output.c"
+#include "sl_screen.c"
+#include "sl_utf8.c"
+#include "sl_gcache.c"
+#include "sl_frame.c"
+#include "sl_record.c"
+#include "sl_tios.c"
+
+int main(int argc, const char **argv)
+{
+   TI_INPUT input;
+   TI_EVENT event;
+   int quit = 0;
+
+   if (!TIV_setup(0, NULL))
+      return 1;
+
+   if (ti_input_init(&input, STDIN_FILENO, 0, NULL) == 0)
+   {
+      tios_save_incoming();
+      tios_disable_echo();
+      ti_winch_init(50);
+      ti_input_set_paste(1);
+      ti_input_set_mouse(TI_MOUSE_DRAG);
+      ti_input_set_keyboard(&input, TI_KEYBOARD_DISAMBIGUATE);
+
+      printf("Type keys, paste text or drag the mouse, 'q' to quit.\n");
+
+      size_t pasted = 0;
+      while (!quit && ti_input_next(&input, &event, -1) == 0)
+      {
+         switch(event.type)
+         {
+            case TI_EVENT_CHAR:
+               if (event.code == 'q' && event.mods == 0)
+                  quit = 1;
+               printf("character U+%04X mods %d\n", event.code, event.mods);
+               break;
+
+            case TI_EVENT_KEY:
+               if (event.key_index >= 0)
+                  printf("capset key %d\n", event.key_index);
+               else
+                  printf("key 0x%X mods %d action %d\n", event.code, event.mods, event.action);
+               break;
+
+            case TI_EVENT_PASTE:
+               pasted += event.slices[0].len + event.slices[1].len;
+               if (!event.more)
+               {
+                  printf("pasted %zu bytes\n", pasted);
+                  pasted = 0;
+               }
+               break;
+
+            case TI_EVENT_RESIZE:
+               printf("resized to %d rows, %d columns\n", event.row, event.col);
+               break;
+
+            case TI_EVENT_MOUSE:
+               printf("mouse button %u action %d at %d,%d mods %d\n",
+                      event.code, event.action, event.row, event.col, event.mods);
+               break;
+
+            default:
+            {
+               char buff[TI_INPUT_MAX_SEQUENCE + 1];
+               size_t len = event.slices[0].len;
+               memcpy(buff, event.slices[0].data, len);
+               memcpy(buff + len, event.slices[1].data, event.slices[1].len);
+               buff[len + event.slices[1].len] = '\0';
+               printf("sequence ");
+               TIV_print_sequence(buff);
+               printf("\n");
+               break;
+            }
+         }
+      }
+
+      ti_input_set_keyboard(&input, 0);
+      ti_input_set_mouse(TI_MOUSE_OFF);
+      ti_input_set_paste(0);
+      ti_winch_release();
+      tios_restore_incoming();
+      ti_input_destroy(&input);
+   }
+
+   TIV_destroy_arrays(0, NULL);
+   return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/* Local Variables:          */
+/* compile-command:   "gcc  \*/
+/* -Wall -Werror -pedantic  \*/
+/* -ggdb -std=c99           \*/
+/* -DSL_INPUT_MAIN          \*/
+/* -fsanitize=address       \*/
+/* -ltinfo                  \*/
+/* -o sl_input              \*/
+/* sl_input.c"               */
+/* End:                      */
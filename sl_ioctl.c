@@ -1,10 +1,54 @@
+/**
+ * @file sl_ioctl.c
+ * @brief Terminal size, cached and updated when the terminal is resized.
+ *
+ * Without @ref ti_winch_init, @ref ti_get_screen_size asks the
+ * terminal for its size every time.  After @ref ti_winch_init, the
+ * size is cached and only asked for again after a SIGWINCH.
+ *
+ * Resizing a terminal by dragging its corner sends a stream of
+ * SIGWINCH signals.  The signal handler only writes to a pipe, whose
+ * read end, @ref ti_winch_fd, wakes an event loop.  The loop calls
+ * @ref ti_winch_dispatch, which waits until no signal has come for
+ * the debounce delay, then tells the subscribers the new size once.
+ * @ref ti_input_next does this by itself, and reports the new size
+ * as a @ref TI_EVENT_RESIZE event.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
 #include <sys/ioctl.h>
 #include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
 
-void ti_get_screen_size(int *rows, int *cols)
+#include "termintel.h"
+
+#define TI_WINCH_MAX_SUBSCRIBERS 16
+
+static struct winch_subscriber {
+   TI_RESIZE_HANDLER handler;
+   void *data;
+} g_subscribers[TI_WINCH_MAX_SUBSCRIBERS];
+static int g_subscriber_count = 0;
+
+static int g_winch_pipe[2] = { -1, -1 };
+static struct sigaction g_old_action;
+static volatile sig_atomic_t g_winch_count = 0;
+
+static int g_size_count = -1;       ///< g_winch_count when the cached size was read
+static int g_rows = -1, g_cols = -1;
+static int g_dispatch_count = 0;    ///< g_winch_count of the last dispatch
+static int g_notified_rows = -1, g_notified_cols = -1;
+static long long g_last_signal = 0;
+static int g_debounce_ms = 0;
+
+static void read_screen_size(int *rows, int *cols)
 {
    struct winsize ws;
    int result = ioctl(STDIN_FILENO, TIOCGWINSZ, &ws);
+   TI_STAT_ADD(TI_STAT_IOCTL, 1);
    if (result==0)
    {
       *rows = ws.ws_row;
@@ -13,3 +57,249 @@ void ti_get_screen_size(int *rows, int *cols)
    else
       *rows = *cols = -1;
 }
+
+/**
+ * @brief Get the size of the terminal.
+ *
+ * After @ref ti_winch_init, the size is read from the terminal only
+ * the first time and after each SIGWINCH.
+ *
+ * @param "rows"   set to the number of rows, -1 if unknown
+ * @param "cols"   set to the number of columns, -1 if unknown
+ */
+void ti_get_screen_size(int *rows, int *cols)
+{
+   if (g_winch_pipe[0] < 0)
+   {
+      read_screen_size(rows, cols);
+      return;
+   }
+
+   int count = g_winch_count;
+   if (count != g_size_count || g_rows < 0)
+   {
+      read_screen_size(&g_rows, &g_cols);
+      g_size_count = count;
+   }
+
+   *rows = g_rows;
+   *cols = g_cols;
+}
+
+static void winch_handler(int signal)
+{
+   int saved = errno;
+   ++g_winch_count;
+   // If the pipe is full, it is readable already
+   ssize_t ignored = write(g_winch_pipe[1], "", 1);
+   (void)ignored;
+   errno = saved;
+}
+
+/**
+ * @brief Start caching the terminal size and watching for SIGWINCH.
+ * @param "debounce_ms"   milliseconds with no further SIGWINCH before
+ *                        subscribers are told of a resize
+ * @return 0 for success, otherwise errno.
+ */
+int ti_winch_init(int debounce_ms)
+{
+   if (g_winch_pipe[0] >= 0)
+      return EBUSY;
+
+   if (pipe(g_winch_pipe))
+      return errno;
+
+   for (int i=0; i<2; ++i)
+   {
+      fcntl(g_winch_pipe[i], F_SETFL, fcntl(g_winch_pipe[i], F_GETFL) | O_NONBLOCK);
+      fcntl(g_winch_pipe[i], F_SETFD, FD_CLOEXEC);
+   }
+
+   struct sigaction action;
+   action.sa_handler = winch_handler;
+   action.sa_flags = SA_RESTART;
+   sigemptyset(&action.sa_mask);
+   if (sigaction(SIGWINCH, &action, &g_old_action))
+   {
+      int rval = errno;
+      ti_winch_release();
+      return rval;
+   }
+
+   g_debounce_ms = debounce_ms;
+   g_size_count = -1;
+   g_dispatch_count = g_winch_count;
+   ti_get_screen_size(&g_notified_rows, &g_notified_cols);
+   return 0;
+}
+
+/**
+ * @brief Restore the previous SIGWINCH handler and stop caching the size.
+ */
+void ti_winch_release(void)
+{
+   if (g_winch_pipe[0] >= 0)
+   {
+      sigaction(SIGWINCH, &g_old_action, NULL);
+      close(g_winch_pipe[0]);
+      close(g_winch_pipe[1]);
+      g_winch_pipe[0] = g_winch_pipe[1] = -1;
+   }
+}
+
+/**
+ * @brief File descriptor that is readable after a SIGWINCH.
+ * @return descriptor to poll, or -1 before @ref ti_winch_init.
+ */
+int ti_winch_fd(void)
+{
+   return g_winch_pipe[0];
+}
+
+/**
+ * @brief Ask for a function to be called when the terminal is resized.
+ * @return 0 for success, otherwise ENOSPC.
+ */
+int ti_winch_subscribe(TI_RESIZE_HANDLER handler, void *data)
+{
+   if (g_subscriber_count == TI_WINCH_MAX_SUBSCRIBERS)
+      return ENOSPC;
+
+   g_subscribers[g_subscriber_count].handler = handler;
+   g_subscribers[g_subscriber_count].data = data;
+   ++g_subscriber_count;
+   return 0;
+}
+
+/**
+ * @brief Remove a function added with @ref ti_winch_subscribe.
+ */
+void ti_winch_unsubscribe(TI_RESIZE_HANDLER handler, void *data)
+{
+   for (int i=0; i<g_subscriber_count; ++i)
+   {
+      if (g_subscribers[i].handler == handler && g_subscribers[i].data == data)
+      {
+         g_subscribers[i] = g_subscribers[--g_subscriber_count];
+         return;
+      }
+   }
+}
+
+/**
+ * @brief Handle SIGWINCH signals that have arrived.
+ *
+ * Call when @ref ti_winch_fd is readable, and again after the time
+ * returned.  Once no signal has arrived for the debounce delay, the
+ * subscribers are called if the size changed.
+ *
+ * @return 0 if the size changed and the subscribers were called,
+ *         milliseconds to wait before calling again if signals are
+ *         still arriving, or -1 if there is nothing to do.
+ */
+int ti_winch_dispatch(void)
+{
+   char buff[64];
+
+   if (g_winch_pipe[0] < 0)
+      return -1;
+
+   int count = g_winch_count;
+   long long now = ti_clock_ns();
+   if (count != g_dispatch_count)
+   {
+      // Empty the pipe, the count tells what happened
+      while (read(g_winch_pipe[0], buff, sizeof(buff)) > 0)
+         ;
+      g_dispatch_count = count;
+      g_last_signal = now;
+   }
+   else if (g_last_signal == 0)
+      return -1;
+
+   long long remaining = g_last_signal + (long long)g_debounce_ms * 1000000 - now;
+   if (remaining > 0)
+      return (int)((remaining + 999999) / 1000000);
+
+   g_last_signal = 0;
+
+   int rows, cols;
+   ti_get_screen_size(&rows, &cols);
+   if (rows == g_notified_rows && cols == g_notified_cols)
+      return -1;
+
+   g_notified_rows = rows;
+   g_notified_cols = cols;
+   for (int i=0; i<g_subscriber_count; ++i)
+      g_subscribers[i].handler(rows, cols, g_subscribers[i].data);
+
+   return 0;
+}
+
+// Hide debugging code from Doxygen
+/** @cond */
+
+#ifdef SL_IOCTL_MAIN
+
+#include <stdio.h>
+#include <poll.h>
+
+#include "sl_frame.c"
+#include "sl_record.c"
+#include "sl_caps.c"
+#include "sl_libcaps.c"
+#include "sl_output.c"
+#include "sl_screen.c"
+#include "sl_utf8.c"
+#include "sl_gcache.c"
+
+static void show_size(int rows, int cols, void *data)
+{
+   ++*(int*)data;
+   printf("resized to %d rows, %d columns\n", rows, cols);
+}
+
+int main(int argc, const char **argv)
+{
+   int rows, cols;
+   int resizes = 0;
+
+   ti_get_screen_size(&rows, &cols);
+   printf("%d rows, %d columns.  Resize the terminal, Ctrl-C to quit.\n", rows, cols);
+
+   if (ti_winch_init(100) == 0)
+   {
+      ti_winch_subscribe(show_size, &resizes);
+
+      int wait = -1;
+      for (;;)
+      {
+         struct pollfd pfd = { ti_winch_fd(), POLLIN, 0 };
+         if (poll(&pfd, 1, wait) < 0 && errno != EINTR)
+            break;
+         wait = ti_winch_dispatch();
+         if (wait == 0)
+            wait = -1;
+      }
+
+      ti_winch_release();
+   }
+
+   return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/* Local Variables:          */
+/* compile-command:   "gcc  \*/
+/* -Wall -Werror -pedantic  \*/
+/* -ggdb -std=c99           \*/
+/* -DSL_IOCTL_MAIN          \*/
+/* -fsanitize=address       \*/
+/* -ltinfo                  \*/
+/* -o sl_ioctl              \*/
+/* sl_ioctl.c"               */
+/* End:                      */
@@ -0,0 +1,561 @@
+/**
+ * @file sl_keymap.c
+ * @brief Bind keys and chords of keys to functions.
+ *
+ * Instead of comparing each event with every key the application
+ * knows, bind the keys to handlers in a @ref TI_KEYMAP and pass each
+ * event from @ref ti_input_next to @ref ti_keymap_dispatch.
+ *
+ * A binding can be a chord of several keys, like `g g` or
+ * `C-x C-s`.  The bindings form a trie, with the edges of every node
+ * in one hash table keyed by node and key.  Dispatching an event is
+ * one hash lookup, however many bindings there are.
+ *
+ * After the first keys of a chord, the map waits for the rest, up to
+ * the chord timeout.  Give @ref ti_keymap_timeout to
+ * @ref ti_input_next as its timeout, and call @ref ti_keymap_expire
+ * when it returns ETIMEDOUT.  If the keys typed so far are a binding
+ * of their own, like `g` when `g g` is also bound, it runs then.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "termintel.h"
+
+#define TI_KEYMAP_CHORD_TIMEOUT 1000   ///< milliseconds
+#define TI_KEYMAP_MAX_CHORD 16
+
+/** @brief Node of the trie, a key or chord of keys */
+struct ti_keymap_node {
+   TI_KEY_HANDLER handler;   ///< NULL if the keys are only a prefix
+   void *data;
+   int children;             ///< number of longer chords that start here
+};
+
+/** @brief Edge of the trie, an entry of the hash table */
+struct ti_keymap_edge {
+   unsigned int node;        ///< parent node
+   unsigned int key;         ///< key from @ref ti_keymap_key
+   unsigned int child;       ///< child node, 0 if the entry is empty
+};
+
+struct ti_keymap {
+   struct ti_keymap_node *nodes;   ///< node 0 is the root
+   unsigned int node_count;
+   unsigned int node_capacity;
+
+   struct ti_keymap_edge *edges;
+   unsigned int edge_mask;         ///< entries less one, a power of two less one
+   unsigned int edge_count;
+
+   unsigned int current;           ///< node of the chord typed so far
+   long long deadline;             ///< time, from @ref ti_clock_ns, the chord expires
+   int chord_timeout;              ///< milliseconds
+};
+
+/** @brief Names of keys for @ref ti_keymap_bind */
+static const struct key_name {
+   const char *name;
+   unsigned int code;
+} key_names[] = {
+   { "tab", TI_KEY_TAB },             { "enter", TI_KEY_ENTER },
+   { "esc", TI_KEY_ESCAPE },          { "backspace", TI_KEY_BACKSPACE },
+   { "space", ' ' },                  { "insert", TI_KEY_INSERT },
+   { "delete", TI_KEY_DELETE },       { "left", TI_KEY_LEFT },
+   { "right", TI_KEY_RIGHT },         { "up", TI_KEY_UP },
+   { "down", TI_KEY_DOWN },           { "pgup", TI_KEY_PAGE_UP },
+   { "pgdn", TI_KEY_PAGE_DOWN },      { "home", TI_KEY_HOME },
+   { "end", TI_KEY_END },             { "f1", TI_KEY_F1 },
+   { "f2", TI_KEY_F2 },               { "f3", TI_KEY_F3 },
+   { "f4", TI_KEY_F4 },               { "f5", TI_KEY_F5 },
+   { "f6", TI_KEY_F6 },               { "f7", TI_KEY_F7 },
+   { "f8", TI_KEY_F8 },               { "f9", TI_KEY_F9 },
+   { "f10", TI_KEY_F10 },             { "f11", TI_KEY_F11 },
+   { "f12", TI_KEY_F12 }
+};
+
+static unsigned int edge_hash(unsigned int node, unsigned int key)
+{
+   unsigned int hash = node * 0x9E3779B1u ^ key * 0x85EBCA77u;
+   hash ^= hash >> 15;
+   hash *= 0x2C1B3C6Du;
+   return hash ^ hash >> 13;
+}
+
+/**
+ * @brief Find the entry for an edge, or the empty entry where it belongs.
+ */
+static struct ti_keymap_edge *find_edge(const TI_KEYMAP *map, unsigned int node, unsigned int key)
+{
+   unsigned int slot = edge_hash(node, key) & map->edge_mask;
+   for (;;)
+   {
+      struct ti_keymap_edge *edge = &map->edges[slot];
+      if (edge->child == 0 || (edge->node == node && edge->key == key))
+         return edge;
+      slot = (slot + 1) & map->edge_mask;
+   }
+}
+
+/**
+ * @brief Double the hash table, which is kept at most half full.
+ */
+static int grow_edges(TI_KEYMAP *map)
+{
+   struct ti_keymap_edge *old = map->edges;
+   unsigned int old_size = map->edge_mask + 1;
+   unsigned int size = old_size * 2;
+
+   map->edges = (struct ti_keymap_edge*)calloc(size, sizeof(struct ti_keymap_edge));
+   if (!map->edges)
+   {
+      map->edges = old;
+      return ENOMEM;
+   }
+
+   map->edge_mask = size - 1;
+   for (unsigned int i=0; i<old_size; ++i)
+      if (old[i].child)
+         *find_edge(map, old[i].node, old[i].key) = old[i];
+
+   free(old);
+   return 0;
+}
+
+static int add_node(TI_KEYMAP *map, unsigned int *node)
+{
+   if (map->node_count == map->node_capacity)
+   {
+      unsigned int capacity = map->node_capacity * 2;
+      struct ti_keymap_node *nodes = (struct ti_keymap_node*)
+         realloc(map->nodes, capacity * sizeof(struct ti_keymap_node));
+      if (!nodes)
+         return ENOMEM;
+      map->nodes = nodes;
+      map->node_capacity = capacity;
+   }
+
+   memset(&map->nodes[map->node_count], 0, sizeof(struct ti_keymap_node));
+   *node = map->node_count++;
+   return 0;
+}
+
+/**
+ * @brief Create a keymap with no bindings.
+ * @return keymap, or NULL if out of memory.
+ */
+TI_KEYMAP *ti_keymap_create(void)
+{
+   TI_KEYMAP *map = (TI_KEYMAP*)calloc(1, sizeof(TI_KEYMAP));
+   if (map)
+   {
+      map->node_capacity = 64;
+      map->nodes = (struct ti_keymap_node*)calloc(map->node_capacity, sizeof(struct ti_keymap_node));
+      map->edge_mask = 127;
+      map->edges = (struct ti_keymap_edge*)calloc(map->edge_mask + 1, sizeof(struct ti_keymap_edge));
+      map->node_count = 1;
+      map->chord_timeout = TI_KEYMAP_CHORD_TIMEOUT;
+
+      if (!map->nodes || !map->edges)
+      {
+         ti_keymap_destroy(map);
+         map = NULL;
+      }
+   }
+
+   return map;
+}
+
+/**
+ * @brief Free a keymap.
+ */
+void ti_keymap_destroy(TI_KEYMAP *map)
+{
+   if (map)
+   {
+      free(map->nodes);
+      free(map->edges);
+      free(map);
+   }
+}
+
+/**
+ * @brief Set how long to wait for the next key of a chord.
+ */
+void ti_keymap_set_chord_timeout(TI_KEYMAP *map, int timeout_ms)
+{
+   map->chord_timeout = timeout_ms;
+}
+
+/**
+ * @brief Get the key of an event for looking up bindings.
+ *
+ * Control characters become the letter with TI_MOD_CTRL, so Ctrl+X is
+ * the same key whether the terminal sends 0x18 or a CSI u sequence.
+ * Shift is dropped from characters, since it is already in the
+ * character: bind `A`, not `S-a`.
+ *
+ * @return key, or 0 if the event isn't a key.
+ */
+unsigned int ti_keymap_key(const TI_EVENT *event)
+{
+   if (event->type == TI_EVENT_KEY && event->key_index >= 0)
+      return TI_KEYMAP_CAPSET(event->key_index);
+
+   if (event->type != TI_EVENT_KEY && event->type != TI_EVENT_CHAR)
+      return 0;
+
+   // Releases of the keyboard protocol are not keypresses
+   if (event->action == TI_KEY_RELEASE)
+      return 0;
+
+   unsigned int code = event->code;
+   int mods = event->mods;
+
+   if (event->type == TI_EVENT_CHAR)
+   {
+      if (code == 0)
+      {
+         code = ' ';
+         mods |= TI_MOD_CTRL;
+      }
+      else if (code < 0x20 && code != TI_KEY_TAB && code != TI_KEY_ENTER && code != TI_KEY_ESCAPE)
+      {
+         code += code <= 26 ? 0x60 : 0x40;
+         mods |= TI_MOD_CTRL;
+      }
+      else if (code > 0x20 && code != 0x7F)
+         mods &= ~TI_MOD_SHIFT;
+   }
+
+   return TI_KEYMAP_KEY(code, mods);
+}
+
+/**
+ * @brief Bind a key or a chord of keys to a handler.
+ *
+ * Binding the same keys again replaces the handler.  A chord can also
+ * be the start of longer chords.
+ *
+ * @param "map"       keymap
+ * @param "keys"      keys from @ref TI_KEYMAP_KEY or @ref TI_KEYMAP_CAPSET
+ * @param "count"     number of @p keys
+ * @param "handler"   function to call, or NULL to unbind
+ * @param "data"      pointer to pass to @p handler
+ * @return 0 for success, otherwise errno.
+ */
+int ti_keymap_bind_keys(TI_KEYMAP *map, const unsigned int *keys, int count,
+                        TI_KEY_HANDLER handler, void *data)
+{
+   unsigned int node = 0;
+   int rval;
+
+   if (count <= 0 || count > TI_KEYMAP_MAX_CHORD)
+      return EINVAL;
+
+   for (int i=0; i<count; ++i)
+   {
+      struct ti_keymap_edge *edge = find_edge(map, node, keys[i]);
+      if (edge->child == 0)
+      {
+         if ((map->edge_count + 1) * 2 > map->edge_mask + 1)
+         {
+            if ((rval = grow_edges(map)))
+               return rval;
+            edge = find_edge(map, node, keys[i]);
+         }
+
+         unsigned int child;
+         if ((rval = add_node(map, &child)))
+            return rval;
+
+         edge->node = node;
+         edge->key = keys[i];
+         edge->child = child;
+         ++map->edge_count;
+         ++map->nodes[node].children;
+      }
+
+      node = edge->child;
+   }
+
+   map->nodes[node].handler = handler;
+   map->nodes[node].data = data;
+   return 0;
+}
+
+/**
+ * @brief Read one key of a binding spec, like `C-x`, `M-<`, or `up`.
+ * @return 0 for success, otherwise EINVAL.
+ */
+static int parse_key_name(const char *name, size_t len, unsigned int *key)
+{
+   int mods = 0;
+
+   // Modifier prefixes, unless the prefix is the whole key, as in `C-`
+   while (len > 2 && name[1] == '-')
+   {
+      switch(name[0])
+      {
+         case 'C': mods |= TI_MOD_CTRL; break;
+         case 'M': mods |= TI_MOD_ALT; break;
+         case 'S': mods |= TI_MOD_SHIFT; break;
+         case 's': mods |= TI_MOD_SUPER; break;
+         default: return EINVAL;
+      }
+      name += 2;
+      len -= 2;
+   }
+
+   for (size_t i=0; i<sizeof(key_names) / sizeof(key_names[0]); ++i)
+   {
+      if (strlen(key_names[i].name) == len && strncmp(key_names[i].name, name, len) == 0)
+      {
+         *key = TI_KEYMAP_KEY(key_names[i].code, mods);
+         return 0;
+      }
+   }
+
+   unsigned int code;
+   if (ti_utf8_decode_n(name, len, &code) != (int)len)
+      return EINVAL;
+
+   // Same as the events: shift is already in the character
+   if (code > 0x20 && code != 0x7F)
+      mods &= ~TI_MOD_SHIFT;
+
+   *key = TI_KEYMAP_KEY(code, mods);
+   return 0;
+}
+
+/**
+ * @brief Bind keys written as text to a handler.
+ *
+ * Keys are separated by spaces.  A key is a character or one of the
+ * names `tab`, `enter`, `esc`, `backspace`, `space`, `insert`,
+ * `delete`, `left`, `right`, `up`, `down`, `pgup`, `pgdn`, `home`,
+ * `end` or `f1` to `f12`, after any of the modifiers `C-` (Ctrl),
+ * `M-` (Alt), `S-` (Shift) or `s-` (Super).  For example, `g g`,
+ * `C-x C-s` or `M-S-up`.
+ *
+ * @param "map"       keymap
+ * @param "spec"      keys to bind
+ * @param "handler"   function to call, or NULL to unbind
+ * @param "data"      pointer to pass to @p handler
+ * @return 0 for success, EINVAL if @p spec can't be read, otherwise errno.
+ */
+int ti_keymap_bind(TI_KEYMAP *map, const char *spec, TI_KEY_HANDLER handler, void *data)
+{
+   unsigned int keys[TI_KEYMAP_MAX_CHORD];
+   int count = 0;
+   int rval;
+
+   while (*spec)
+   {
+      if (*spec == ' ')
+      {
+         ++spec;
+         continue;
+      }
+
+      size_t len = strcspn(spec, " ");
+      if (count == TI_KEYMAP_MAX_CHORD)
+         return EINVAL;
+      if ((rval = parse_key_name(spec, len, &keys[count++])))
+         return rval;
+      spec += len;
+   }
+
+   return ti_keymap_bind_keys(map, keys, count, handler, data);
+}
+
+/**
+ * @brief Give up on the chord typed so far.
+ * @return TI_KEYMAP_HANDLED if the keys typed so far were bound and
+ *         their handler was called, otherwise TI_KEYMAP_UNBOUND.
+ */
+static int finish_chord(TI_KEYMAP *map, const TI_EVENT *event)
+{
+   struct ti_keymap_node *node = &map->nodes[map->current];
+   map->current = 0;
+
+   if (node->handler)
+   {
+      node->handler(event, node->data);
+      return TI_KEYMAP_HANDLED;
+   }
+
+   return TI_KEYMAP_UNBOUND;
+}
+
+/**
+ * @brief Call the handler bound to an event.
+ *
+ * If the event doesn't continue the chord typed so far, the chord is
+ * finished as by @ref ti_keymap_expire, and the event is looked up on
+ * its own.
+ *
+ * @return one of enum ti_keymap_result.
+ */
+int ti_keymap_dispatch(TI_KEYMAP *map, const TI_EVENT *event)
+{
+   unsigned int key = ti_keymap_key(event);
+   if (key == 0)
+      return TI_KEYMAP_UNBOUND;
+
+   int result = TI_KEYMAP_UNBOUND;
+   if (map->current && ti_clock_ns() >= map->deadline)
+      result = finish_chord(map, NULL);
+
+   struct ti_keymap_edge *edge = find_edge(map, map->current, key);
+   if (edge->child == 0 && map->current)
+   {
+      if (finish_chord(map, NULL) == TI_KEYMAP_HANDLED)
+         result = TI_KEYMAP_HANDLED;
+      edge = find_edge(map, 0, key);
+   }
+
+   if (edge->child == 0)
+      return result;
+
+   struct ti_keymap_node *node = &map->nodes[edge->child];
+   if (node->children)
+   {
+      map->current = edge->child;
+      map->deadline = ti_clock_ns() + (long long)map->chord_timeout * 1000000;
+      return TI_KEYMAP_PENDING;
+   }
+
+   map->current = 0;
+   if (!node->handler)
+      return result;
+
+   node->handler(event, node->data);
+   return TI_KEYMAP_HANDLED;
+}
+
+/**
+ * @brief Milliseconds until the chord typed so far times out.
+ * @return milliseconds, 0 if it has timed out, or -1 if no chord has
+ *         been started, suitable as the timeout of @ref ti_input_next.
+ */
+int ti_keymap_timeout(const TI_KEYMAP *map)
+{
+   if (map->current == 0)
+      return -1;
+
+   long long remaining = map->deadline - ti_clock_ns();
+   return remaining > 0 ? (int)((remaining + 999999) / 1000000) : 0;
+}
+
+/**
+ * @brief End the chord typed so far, once it has timed out.
+ *
+ * Call when @ref ti_input_next times out after a timeout from
+ * @ref ti_keymap_timeout.  If the keys typed so far are bound, their
+ * handler is called with a NULL event.
+ *
+ * @return TI_KEYMAP_HANDLED if a handler was called, otherwise
+ *         TI_KEYMAP_UNBOUND.
+ */
+int ti_keymap_expire(TI_KEYMAP *map)
+{
+   if (map->current == 0 || ti_clock_ns() < map->deadline)
+      return TI_KEYMAP_UNBOUND;
+
+   return finish_chord(map, NULL);
+}
+
+// Hide debugging code from Doxygen
+/** @cond */
+
+#ifdef SL_KEYMAP_MAIN
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "sl_caps.c"
+#include "sl_ioctl.c"
+#include "sl_libcaps.c"
+#include "sl_output.c"
+#include "sl_screen.c"
+#include "sl_utf8.c"
+#include "sl_gcache.c"
+#include "sl_frame.c"
+#include "sl_record.c"
+#include "sl_tios.c"
+#include "sl_input.c"
+
+static void say(const TI_EVENT *event, void *data)
+{
+   printf("%s%s\r\n", (const char*)data, event ? "" : " (chord ended)");
+}
+
+static void quit(const TI_EVENT *event, void *data)
+{
+   *(int*)data = 1;
+}
+
+int main(int argc, const char **argv)
+{
+   TI_INPUT input;
+   TI_EVENT event;
+   TI_KEYMAP *map;
+   int done = 0;
+
+   if (!TIV_setup(0, NULL))
+      return 1;
+
+   if ((map = ti_keymap_create()) && ti_input_init(&input, STDIN_FILENO, 0, NULL) == 0)
+   {
+      ti_keymap_bind(map, "g", say, "go");
+      ti_keymap_bind(map, "g g", say, "go to top");
+      ti_keymap_bind(map, "C-x C-s", say, "save");
+      ti_keymap_bind(map, "C-x C-c", quit, &done);
+      ti_keymap_bind(map, "M-S-up", say, "Alt+Shift+Up");
+      ti_keymap_bind(map, "q", quit, &done);
+
+      tios_save_incoming();
+      tios_set_raw_mode();
+
+      printf("Try g, g g, C-x C-s or M-S-up.  C-x C-c or q to quit.\r\n");
+
+      while (!done)
+      {
+         int rval = ti_input_next(&input, &event, ti_keymap_timeout(map));
+         if (rval == ETIMEDOUT)
+            ti_keymap_expire(map);
+         else if (rval)
+            break;
+         else if (ti_keymap_dispatch(map, &event) == TI_KEYMAP_UNBOUND)
+            printf("unbound key %08X\r\n", ti_keymap_key(&event));
+         fflush(stdout);
+      }
+
+      tios_restore_incoming();
+      ti_input_destroy(&input);
+   }
+
+   ti_keymap_destroy(map);
+   TIV_destroy_arrays(0, NULL);
+   return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/* Local Variables:          */
+/* compile-command:   "gcc  \*/
+/* -Wall -Werror -pedantic  \*/
+/* -ggdb -std=c99           \*/
+/* -DSL_KEYMAP_MAIN         \*/
+/* -fsanitize=address       \*/
+/* -ltinfo                  \*/
+/* -o sl_keymap             \*/
+/* sl_keymap.c"              */
+/* End:                      */
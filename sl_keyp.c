@@ -1,73 +1,120 @@
+#include <string.h>
 #include <unistd.h>
 #include "termintel.h"
 
 /**
- * @brief Get and categorize a "silent" keypress.
- *
- * Designed to recognize keypresses identified by escape sequences.
- * Values returned through pointer arguments to disambiguate integer
- * values that may be characters or indexes into an array of
- * recognized keycodes.
+ * @brief Get and categorize a "silent" keypress, decoding typed UTF-8 characters.
  *
- * Can use all NULL parameters if simple unrecognized keypress is all
- * that is needed.
+ * Like @ref ti_get_keypress, but a typed character is returned as a
+ * Unicode codepoint, so keys like `é` or `漢` come back whole rather
+ * than as their first byte.
  *
- * @param[out] "key_index"       pointer to integer representing the index into
- *                               the array @p recognized_keys. The integer will be
- *                               set to '-1' if not found in the array.
- * @param[out] "typed_char"      The character value of the typed key.  This value
- *                               will be set if the user typed a character key, and
- *                               it will be set to -1 if the keycode is not a
- *                               typeable character.
+ * @param[out] "key_index"       set as for @ref ti_get_keypress
+ * @param[out] "code"            codepoint of the typed character, or -1
+ *                               if the keycode is not a typeable character.
+ *                               Malformed input is returned as U+FFFD.
  * @param[in] "recognized_keys"  Array of TIV elements to search for a matching
  *                               escape string.
- * @param[out] "sequence"        Optional parameter.  If a pointer to a pointer to a
- *                               string is provided, it will be set to the uninterpreted
- *                               buffer in which the keyboard output is saved.
+ * @param[out] "sequence"        Optional, set to the uninterpreted keyboard
+ *                               output, which is valid until the next call.
  *
  * @return -1 if unknown escape sequence (refer to optional @p sequence,  
  *         0 for timeout,  
  *         1 if result in @p key_index of escape sequence,  
- *         2 if result in @p typed_char when not an escape sequence.
+ *         2 if result in @p code when not an escape sequence.
  */
-int ti_get_keypress(int *key_index, char *typed_char, TIV *recognized_keys, const char **sequence)
+int ti_get_keypress_code(int *key_index, unsigned int *code, TIV *recognized_keys, const char **sequence)
 {
-   char buff[80] = { 0 };
+   static char buff[80];
    ssize_t bytes_read;
 
+   memset(buff, 0, sizeof(buff));
    if (sequence)
       *sequence = buff;
 
    // Set unused values to output parameters in case of early exit
    if (key_index)
       *key_index = -1;
-   if (typed_char)
-      *typed_char = -1;
+   if (code)
+      *code = (unsigned int)-1;
 
    tios_set_read_params(1, 10);
 
-   bytes_read = read(STDIN_FILENO, buff, sizeof(buff));
+   // Leave room for the terminator
+   bytes_read = read(STDIN_FILENO, buff, sizeof(buff) - 1);
+   TI_STAT_ADD(TI_STAT_READS, 1);
+   TI_STAT_ADD(TI_STAT_READ_BYTES, bytes_read > 0 ? bytes_read : 0);
 
    tios_restore_read_params();
 
-   if (bytes_read == -1)
+   if (bytes_read <= 0)
       return 0;
-   else if (buff[0] == '\033' && key_index && recognized_keys)
+
+   TI_TRACE_INPUT();
+   ti_record_input(buff, bytes_read);
+
+   if (buff[0] == '\033' && key_index && recognized_keys)
    {
-      buff[bytes_read] = '\0';
       *key_index = TIV_find_index_by_sequence(recognized_keys, buff);
       if (*key_index >= 0)
          return 1;
    }
-   else if (typed_char)
+   else if (code)
    {
-      *typed_char = buff[0];
+      ti_utf8_decode_n(buff, bytes_read, code);
       return 2;
    }
 
    return -1;
 }
 
+/**
+ * @brief Get and categorize a "silent" keypress.
+ *
+ * Designed to recognize keypresses identified by escape sequences.
+ * Values returned through pointer arguments to disambiguate integer
+ * values that may be characters or indexes into an array of
+ * recognized keycodes.
+ *
+ * Can use all NULL parameters if simple unrecognized keypress is all
+ * that is needed.
+ *
+ * Use @ref ti_get_keypress_code to get characters beyond ASCII.
+ *
+ * @param[out] "key_index"       pointer to integer representing the index into
+ *                               the array @p recognized_keys. The integer will be
+ *                               set to '-1' if not found in the array.
+ * @param[out] "typed_char"      The character value of the typed key.  This value
+ *                               will be set if the user typed a character key, and
+ *                               it will be set to -1 if the keycode is not a
+ *                               typeable character.  For a multi-byte
+ *                               character, this is the first byte.
+ * @param[in] "recognized_keys"  Array of TIV elements to search for a matching
+ *                               escape string.
+ * @param[out] "sequence"        Optional parameter.  If a pointer to a pointer to a
+ *                               string is provided, it will be set to the uninterpreted
+ *                               buffer in which the keyboard output is saved.
+ *
+ * @return -1 if unknown escape sequence (refer to optional @p sequence,  
+ *         0 for timeout,  
+ *         1 if result in @p key_index of escape sequence,  
+ *         2 if result in @p typed_char when not an escape sequence.
+ */
+int ti_get_keypress(int *key_index, char *typed_char, TIV *recognized_keys, const char **sequence)
+{
+   unsigned int code;
+   const char *seq;
+
+   int result = ti_get_keypress_code(key_index, typed_char ? &code : NULL, recognized_keys, &seq);
+
+   if (sequence)
+      *sequence = seq;
+   if (typed_char)
+      *typed_char = result == 2 ? seq[0] : -1;
+
+   return result;
+}
+
 
 // Hide debugging code from Doxygen
 /** @cond */
@@ -76,6 +123,8 @@ int ti_get_keypress(int *key_index, char *typed_char, TIV *recognized_keys, cons
 
 #include "sl_caps.c"
 #include "sl_tios.c"
+#include "sl_utf8.c"
+#include "sl_record.c"
 
 #include "ti_modes.c"
 #include "ti_capset_keys.c"
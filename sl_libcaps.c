@@ -0,0 +1,350 @@
+/**
+ * @file sl_libcaps.c
+ * @brief Capabilities used internally by the library.
+ *
+ * The layout matches what `ti_create_capset_code.sh` generates for an
+ * application capset, but the library cannot depend on the capsets of
+ * the application that links it.  The enum is in termintel.h.
+ *
+ * Terminals lack some of the entries: a serial console may have no
+ * @c parm_index or @c column_address.  @ref ti_lib_move and
+ * @ref ti_lib_scroll make a cursor move or a scroll from whatever
+ * entries the terminal has, choosing the way that sends the fewest
+ * bytes.  The cost of each entry is measured once per terminal by
+ * @ref ti_lib_measure, which @ref TIV_setup calls.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <curses.h>
+#include <term.h>
+#include "termintel.h"
+
+TIV caps_LIB[] = {
+   { "cm" },   // cursor_address
+   { "ce" },   // clr_eol
+   { "cl" },   // clear_screen
+   { "me" },   // exit_attribute_mode
+   { "md" },   // enter_bold_mode
+   { "mh" },   // enter_dim_mode
+   { "us" },   // enter_underline_mode
+   { "mr" },   // enter_reverse_mode
+   { "so" },   // enter_standout_mode
+   { "vi" },   // cursor_invisible
+   { "ve" },   // cursor_normal
+   { "cs" },   // change_scroll_region
+   { "sc" },   // save_cursor
+   { "rc" },   // restore_cursor
+   { "up" },   // cursor_up
+   { "sf" },   // scroll_forward
+   { "sr" },   // scroll_reverse
+   { "SF" },   // parm_index
+   { "SR" },   // parm_rindex
+   { "ML" },   // set_lr_margin
+   { "MC" },   // clear_margins
+   { "BE" },   // bracketed paste on (extension)
+   { "BD" },   // bracketed paste off (extension)
+   { "PS" },   // paste start marker (extension)
+   { "PE" },   // paste end marker (extension)
+   { "rp" },   // repeat_char
+   { "as" },   // enter_alt_charset_mode
+   { "ae" },   // exit_alt_charset_mode
+   { "ac" },   // acs_chars
+   { "ho" },   // cursor_home
+   { "cr" },   // carriage_return
+   { "do" },   // cursor_down
+   { "le" },   // cursor_left
+   { "nd" },   // cursor_right
+   { "ch" },   // column_address
+   { "cv" },   // row_address
+   { "UP" },   // parm_up_cursor
+   { "DO" },   // parm_down_cursor
+   { "LE" },   // parm_left_cursor
+   { "RI" },   // parm_right_cursor
+   { "" }
+};
+
+/** @brief Cost of an entry the terminal doesn't have. */
+#define NO_CAP 100000
+
+/**
+ * @brief Bytes sent for each entry of @ref caps_LIB, or NO_CAP.
+ *
+ * For an entry with parameters, the cost is for parameters of one
+ * digit each; @ref parm_cost adds the extra digits.
+ */
+static int g_costs[LIB_END];
+
+/** @brief Set for entries that send their parameters 1-based, with `%i`. */
+static unsigned char g_one_based[LIB_END];
+
+/**
+ * @brief Count the bytes a sequence sends, leaving out padding, which
+ *        tputs turns into a delay.
+ */
+static int sequence_cost(const char *str)
+{
+   int cost = 0;
+   while (*str)
+   {
+      if (str[0] == '$' && str[1] == '<' && strchr(str, '>'))
+         str = strchr(str, '>') + 1;
+      else
+      {
+         ++cost;
+         ++str;
+      }
+   }
+   return cost;
+}
+
+/**
+ * @brief Measure the cost of each entry of @ref caps_LIB, and map the
+ *        terminal's line-drawing characters.
+ *
+ * Call again after the terminal changes.  @ref TIV_setup calls this
+ * after initializing @ref caps_LIB.
+ */
+void ti_lib_measure(void)
+{
+   for (int i=0; i<LIB_END; ++i)
+   {
+      const char *seq = caps_LIB[i].sequence;
+      g_one_based[i] = seq && strstr(seq, "%i") != NULL;
+      if (!seq)
+         g_costs[i] = NO_CAP;
+      else if (strchr(seq, '%'))
+         g_costs[i] = sequence_cost(tiparm(seq, 0, 0));
+      else
+         g_costs[i] = sequence_cost(seq);
+   }
+
+   // With output processing, a line feed also returns the carriage
+   const char *down = caps_LIB[LIB_CURSOR_DOWN].sequence;
+   if (down && strcmp(down, "\n") == 0)
+      g_costs[LIB_CURSOR_DOWN] = NO_CAP;
+
+   ti_out_map_acs();
+}
+
+/** @brief Count the digits of @p value after the first. */
+static int extra_digits(int value)
+{
+   int extra = 0;
+   for (; value >= 10; value /= 10)
+      ++extra;
+   return extra;
+}
+
+static int parm_cost(int index, int parm)
+{
+   return g_costs[index] + extra_digits(parm + g_one_based[index]);
+}
+
+/** @brief Ways of making part of a cursor move. */
+enum motion {
+   MOVE_NONE,
+   MOVE_ADDRESS,    ///< column_address or row_address
+   MOVE_PARM,       ///< parm_left_cursor and the like
+   MOVE_REPEAT      ///< cursor_left and the like, repeated
+};
+
+/**
+ * @brief Find the cheapest way to move along one axis.
+ * @param "address"   entry that moves to an absolute position
+ * @param "parm"      entry that moves by a count
+ * @param "single"    entry that moves by one
+ * @param "to"        position to move to
+ * @param "count"     distance to move
+ * @param "motion"    set to the way chosen
+ * @return the cost of the move, NO_CAP if it can't be made.
+ */
+static int axis_cost(int address, int parm, int single, int to, int count,
+                     enum motion *motion)
+{
+   *motion = MOVE_NONE;
+   if (count == 0)
+      return 0;
+
+   int best = NO_CAP;
+   if (g_costs[single] < NO_CAP && g_costs[single] * count < best)
+   {
+      best = g_costs[single] * count;
+      *motion = MOVE_REPEAT;
+   }
+   if (parm_cost(parm, count) < best)
+   {
+      best = parm_cost(parm, count);
+      *motion = MOVE_PARM;
+   }
+   if (parm_cost(address, to) < best)
+   {
+      best = parm_cost(address, to);
+      *motion = MOVE_ADDRESS;
+   }
+   return best;
+}
+
+static void axis_move(int address, int parm, int single, int to, int count,
+                      enum motion motion)
+{
+   switch(motion)
+   {
+      case MOVE_NONE: break;
+      case MOVE_ADDRESS: TIV_execute_params(caps_LIB, address, to); break;
+      case MOVE_PARM: TIV_execute_params(caps_LIB, parm, count); break;
+      case MOVE_REPEAT:
+         for (int i=0; i<count; ++i)
+            TIV_execute(caps_LIB, single);
+         break;
+   }
+}
+
+/** @brief A cursor move, made from a starting point. */
+typedef struct lib_move {
+   int start;             ///< LIB_CURSOR_ADDRESS, LIB_CURSOR_HOME,
+                          ///< LIB_CARRIAGE_RETURN, or -1 to start in place
+   int from_row;
+   int from_col;
+   enum motion vertical;
+   enum motion horizontal;
+   int cost;
+} LIB_MOVE;
+
+static void plan_move(LIB_MOVE *move, int row, int col)
+{
+   int up = move->from_row > row;
+   int left = move->from_col > col;
+   int rows = up ? move->from_row - row : row - move->from_row;
+   int cols = left ? move->from_col - col : col - move->from_col;
+
+   move->cost = move->start >= 0 ? g_costs[move->start] : 0;
+   move->cost += axis_cost(LIB_ROW_ADDRESS,
+                           up ? LIB_PARM_UP_CURSOR : LIB_PARM_DOWN_CURSOR,
+                           up ? LIB_CURSOR_UP : LIB_CURSOR_DOWN,
+                           row, rows, &move->vertical);
+   move->cost += axis_cost(LIB_COLUMN_ADDRESS,
+                           left ? LIB_PARM_LEFT_CURSOR : LIB_PARM_RIGHT_CURSOR,
+                           left ? LIB_CURSOR_LEFT : LIB_CURSOR_RIGHT,
+                           col, cols, &move->horizontal);
+}
+
+static void make_move(const LIB_MOVE *move, int row, int col)
+{
+   if (move->start == LIB_CURSOR_ADDRESS)
+   {
+      TIV_execute_params(caps_LIB, LIB_CURSOR_ADDRESS, row, col);
+      return;
+   }
+
+   int up = move->from_row > row;
+   int left = move->from_col > col;
+   int rows = up ? move->from_row - row : row - move->from_row;
+   int cols = left ? move->from_col - col : col - move->from_col;
+
+   if (move->start >= 0)
+      TIV_execute(caps_LIB, move->start);
+   axis_move(LIB_ROW_ADDRESS,
+             up ? LIB_PARM_UP_CURSOR : LIB_PARM_DOWN_CURSOR,
+             up ? LIB_CURSOR_UP : LIB_CURSOR_DOWN,
+             row, rows, move->vertical);
+   axis_move(LIB_COLUMN_ADDRESS,
+             left ? LIB_PARM_LEFT_CURSOR : LIB_PARM_RIGHT_CURSOR,
+             left ? LIB_CURSOR_LEFT : LIB_CURSOR_RIGHT,
+             col, cols, move->horizontal);
+}
+
+/**
+ * @brief Move the cursor by the cheapest means the terminal has.
+ *
+ * Besides @c cursor_address, the move can be made by absolute row
+ * and column moves, by moves relative to where the cursor is, or from
+ * @c cursor_home or @c carriage_return.  The relative moves need to
+ * know where the cursor is, and that the cursor isn't waiting to wrap
+ * after the last column.
+ *
+ * @param "from_row"  row of the cursor, or -1 if unknown
+ * @param "from_col"  column of the cursor, or -1 if unknown
+ * @param "row"       row to move to, counting from 0
+ * @param "col"       column to move to, counting from 0
+ * @return 0 for success, ENOTSUP if the terminal can't address
+ *         the cursor.
+ */
+int ti_lib_move(int from_row, int from_col, int row, int col)
+{
+   LIB_MOVE best = { LIB_CURSOR_ADDRESS, 0, 0, MOVE_NONE, MOVE_NONE, NO_CAP };
+   LIB_MOVE moves[3] = {
+      { LIB_CURSOR_HOME, 0, 0, MOVE_NONE, MOVE_NONE, 0 },
+      { LIB_CARRIAGE_RETURN, from_row, 0, MOVE_NONE, MOVE_NONE, 0 },
+      { -1, from_row, from_col, MOVE_NONE, MOVE_NONE, 0 }
+   };
+
+   if (from_row == row && from_col == col)
+      return 0;
+
+   if (g_costs[LIB_CURSOR_ADDRESS] < NO_CAP)
+      best.cost = parm_cost(LIB_CURSOR_ADDRESS, row)
+                  + extra_digits(col + g_one_based[LIB_CURSOR_ADDRESS]);
+
+   // Moves from the cursor need to know where it is
+   int count = from_row < 0 ? 1 : (from_col < 0 ? 2 : 3);
+   for (int i=0; i<count; ++i)
+   {
+      plan_move(&moves[i], row, col);
+      if (moves[i].cost < best.cost)
+         best = moves[i];
+   }
+
+   if (best.cost >= NO_CAP)
+      return ENOTSUP;
+
+   make_move(&best, row, col);
+   return 0;
+}
+
+/**
+ * @brief Cost of scrolling the scroll region, in bytes.
+ * @param "count"  lines to scroll up, or down if negative
+ * @return the cost, or -1 if the terminal can't scroll that way.
+ */
+int ti_lib_scroll_cost(int count)
+{
+   int parm = count > 0 ? LIB_PARM_INDEX : LIB_PARM_RINDEX;
+   int single = count > 0 ? LIB_SCROLL_FORWARD : LIB_SCROLL_REVERSE;
+   if (count < 0)
+      count = -count;
+
+   int repeated = g_costs[single] < NO_CAP ? g_costs[single] * count : NO_CAP;
+   int cost = parm_cost(parm, count) < repeated ? parm_cost(parm, count) : repeated;
+   return cost < NO_CAP ? cost : -1;
+}
+
+/**
+ * @brief Scroll the scroll region by @c parm_index, or by repeating
+ *        @c scroll_forward if that sends fewer bytes.
+ *
+ * The cursor must be on the bottom line of the region to scroll up,
+ * or on the top line to scroll down.
+ *
+ * @param "count"  lines to scroll up, or down if negative
+ * @return 0 for success, ENOTSUP if the terminal can't scroll that way.
+ */
+int ti_lib_scroll(int count)
+{
+   int parm = count > 0 ? LIB_PARM_INDEX : LIB_PARM_RINDEX;
+   int single = count > 0 ? LIB_SCROLL_FORWARD : LIB_SCROLL_REVERSE;
+   int cost = ti_lib_scroll_cost(count);
+   if (cost < 0)
+      return ENOTSUP;
+
+   if (count < 0)
+      count = -count;
+
+   if (cost == parm_cost(parm, count))
+      TIV_execute_params(caps_LIB, parm, count);
+   else
+      for (int i=0; i<count; ++i)
+         TIV_execute(caps_LIB, single);
+
+   return 0;
+}
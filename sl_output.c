@@ -0,0 +1,590 @@
+/**
+ * @file sl_output.c
+ * @brief Output buffer through which the library sends escape sequences.
+ *
+ * Every TIV_execute function sends its sequence through @ref ti_out_putc.
+ * Output is collected in a buffer and released when the outermost
+ * @ref ti_out_begin / @ref ti_out_end pair closes, so a frame composed
+ * of many capabilities leaves the process as a single write.
+ *
+ * By default, the buffer is written to the descriptor of `stdout`.
+ * The `stdout` stream is flushed first, which keeps escape sequences
+ * in order with text the application prints with `printf`.  Call
+ * @ref ti_out_set_fd to write to another file descriptor instead.
+ *
+ * A file descriptor may be non-blocking (see @ref ti_out_open_nonblocking).
+ * Output the terminal can't accept is kept in a bounded pending queue
+ * of frames, where each frame is the output of one flush.  Writes never
+ * split a frame in favor of a later one.  When the queue is full,
+ * frames that have not started are discarded and
+ * @ref ti_out_take_dropped reports it so the caller can repaint the
+ * newest state rather than replay stale ones.
+ *
+ * @ref ti_out_set_sink hands flushed output to a function instead of
+ * the terminal, for example @ref ti_vterm_sink to see what the output
+ * does without a terminal.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "termintel.h"
+
+#define TI_OUT_INITIAL_SIZE 4096
+#define TI_OUT_PENDING_LIMIT (64 * 1024)
+#define TI_OUT_MAX_FRAMES 32
+#define TI_OUT_CLOSE_TIMEOUT 250   // milliseconds
+
+/**
+ * @brief Fewest bytes of repeated characters worth replacing with
+ *        `repeat_char`, whose sequence is usually six to eight bytes.
+ */
+#define TI_OUT_MIN_REPEAT 8
+
+/**
+ * @brief State of the output buffer.
+ */
+static struct ti_out_state {
+   char   *buff;    ///< collected output
+   size_t len;      ///< bytes used in @p buff
+   size_t size;     ///< bytes allocated to @p buff
+   int    depth;    ///< nesting level of @ref ti_out_begin calls
+   int    fd;       ///< output file descriptor, -1 for that of `stdout`
+   int    owned;    ///< set if @p fd was opened by @ref ti_out_open_nonblocking
+
+   char   *pending;         ///< flushed output the terminal has not accepted
+   size_t pstart;           ///< offset of first unwritten byte in @p pending
+   size_t plen;             ///< bytes used in @p pending
+   size_t psize;            ///< bytes allocated to @p pending
+   size_t plimit;           ///< most bytes to hold in @p pending
+   size_t frame_end[TI_OUT_MAX_FRAMES];   ///< end offset of each queued frame
+   int    frames;           ///< number of frames in @p frame_end
+   int    dropped;          ///< set when frames have been discarded
+
+   TI_OUT_SINK sink;        ///< if set, receives flushed output in place of the terminal
+   void   *sink_data;       ///< pointer passed to @p sink
+} g_out = { NULL, 0, 0, 0, -1, 0, NULL, 0, 0, 0, TI_OUT_PENDING_LIMIT };
+
+/**
+ * @brief Make room for @p needed more bytes, flushing if memory runs out.
+ * @return 1 if room is available, 0 if not.
+ */
+static int ti_out_reserve(size_t needed)
+{
+   if (g_out.len + needed <= g_out.size)
+      return 1;
+
+   size_t newsize = g_out.size ? g_out.size : TI_OUT_INITIAL_SIZE;
+   while (newsize < g_out.len + needed)
+      newsize *= 2;
+
+   char *newbuff = (char*)realloc(g_out.buff, newsize);
+   if (newbuff)
+   {
+      g_out.buff = newbuff;
+      g_out.size = newsize;
+      return 1;
+   }
+
+   // Out of memory: send what we have to make room
+   ti_out_flush();
+   return g_out.len + needed <= g_out.size;
+}
+
+/**
+ * @brief Add a character to the output buffer.
+ *
+ * The signature matches the `putc` argument of `tputs`.
+ *
+ * @param "chr"   character to add
+ * @return the character added, or EOF if it could not be saved.
+ */
+int ti_out_putc(int chr)
+{
+   if (!ti_out_reserve(1))
+      return EOF;
+
+   g_out.buff[g_out.len++] = (char)chr;
+   return chr;
+}
+
+/**
+ * @brief Add a block of bytes to the output buffer.
+ * @param "data"   bytes to add
+ * @param "len"    number of bytes in @p data
+ */
+void ti_out_write(const char *data, size_t len)
+{
+   if (ti_out_reserve(len))
+   {
+      memcpy(g_out.buff + g_out.len, data, len);
+      g_out.len += len;
+   }
+}
+
+/**
+ * @brief Add a NULL-terminated string to the output buffer.
+ * @param "str"   string to add
+ */
+void ti_out_puts(const char *str)
+{
+   ti_out_write(str, strlen(str));
+}
+
+/**
+ * @brief Add the UTF-8 encoding of a codepoint to the output buffer.
+ * @param "code"   Unicode codepoint
+ */
+void ti_out_code(unsigned int code)
+{
+   char buff[4];
+   ti_out_write(buff, ti_utf8_encode(code, buff));
+}
+
+/**
+ * @brief Add @p count copies of a character to the output buffer.
+ *
+ * If the terminal has `repeat_char`, long runs of an ASCII character
+ * are sent as one sequence.  Other characters can't be passed to
+ * `repeat_char` and are written out.
+ *
+ * @param "code"    Unicode codepoint
+ * @param "count"   number of copies
+ */
+void ti_out_repeat(unsigned int code, int count)
+{
+   if (count >= TI_OUT_MIN_REPEAT && code >= 0x20 && code < 0x7F
+       && TIV_get_sequence(&caps_LIB[LIB_REPEAT_CHAR]))
+   {
+      TIV_execute_params(caps_LIB, LIB_REPEAT_CHAR, (int)code, count);
+      return;
+   }
+
+   for (int i=0; i<count; ++i)
+      ti_out_code(code);
+}
+
+/**
+ * @brief Characters of the alternate character set for the VT100
+ *        line-drawing characters, from the terminal's `acs_chars`.
+ */
+static char g_acs_map[128];
+
+/**
+ * @brief Build the line-drawing map of @ref ti_out_acs_char from the
+ *        terminal's `acs_chars`.
+ *
+ * @ref ti_lib_measure calls this each time @ref caps_LIB is set up,
+ * so the map follows a change of terminal.
+ */
+void ti_out_map_acs(void)
+{
+   memset(g_acs_map, 0, sizeof(g_acs_map));
+
+   const char *pairs = TIV_get_sequence(&caps_LIB[LIB_ACS_CHARS]);
+   if (!pairs || !TIV_get_sequence(&caps_LIB[LIB_ENTER_ALT_CHARSET_MODE]))
+      return;
+
+   for (; pairs[0] && pairs[1]; pairs += 2)
+      if (!(pairs[0] & 0x80))
+         g_acs_map[(int)pairs[0]] = pairs[1];
+}
+
+/**
+ * @brief Find the character that shows a line-drawing or other symbol
+ *        in the terminal's alternate character set.
+ *
+ * The mapping comes from the terminal's `acs_chars`.  Send the
+ * character between `enter_alt_charset_mode` and
+ * `exit_alt_charset_mode`.  It is one byte, where the UTF-8 encoding of
+ * a box-drawing character is three, and can be repeated with
+ * @ref ti_out_repeat.
+ *
+ * @param "code"   Unicode codepoint
+ * @return character to send, or 0 if the terminal has none for @p code.
+ */
+int ti_out_acs_char(unsigned int code)
+{
+   // Unicode characters of the VT100 line-drawing set, which acs_chars maps
+   static const struct { unsigned short code; char vt100; } acs_symbols[] = {
+      { 0x00A3, '}' }, { 0x00B0, 'f' }, { 0x00B1, 'g' }, { 0x00B7, '~' },
+      { 0x03C0, '{' }, { 0x2260, '|' }, { 0x2264, 'y' }, { 0x2265, 'z' },
+      { 0x2500, 'q' }, { 0x2502, 'x' }, { 0x250C, 'l' }, { 0x2510, 'k' },
+      { 0x2514, 'm' }, { 0x2518, 'j' }, { 0x251C, 't' }, { 0x2524, 'u' },
+      { 0x252C, 'w' }, { 0x2534, 'v' }, { 0x253C, 'n' }, { 0x2592, 'a' },
+      { 0x25C6, '`' }
+   };
+
+   if (code < 0xA3 || code > 0x25C6)
+      return 0;
+
+   for (int i=0; i<(int)(sizeof(acs_symbols)/sizeof(acs_symbols[0])); ++i)
+      if (acs_symbols[i].code == code)
+         return (unsigned char)g_acs_map[(int)acs_symbols[i].vt100];
+
+   return 0;
+}
+
+/**
+ * @brief Start collecting output.
+ *
+ * Calls can be nested.  Output is held until the matching
+ * @ref ti_out_end of the outermost call.
+ */
+void ti_out_begin(void)
+{
+   if (g_out.depth == 0)
+      TI_TRACE_FRAME_BEGIN();
+   ++g_out.depth;
+}
+
+/**
+ * @brief Close a @ref ti_out_begin, flushing if it was the outermost.
+ */
+void ti_out_end(void)
+{
+   if (g_out.depth > 0)
+      --g_out.depth;
+
+   if (g_out.depth == 0)
+      ti_out_flush();
+}
+
+/**
+ * @brief Write queued frames until the queue is empty or the terminal
+ *        stops accepting output.
+ *
+ * Each write ends at a frame boundary so that only the first frame in
+ * the queue can be partly written.
+ *
+ * @return 0 for success, including when output remains queued,
+ *         otherwise errno, after which the queue is discarded.
+ */
+static int drain_pending(void)
+{
+   while (g_out.frames > 0)
+   {
+      size_t end = g_out.frame_end[0];
+      ssize_t written = write(ti_out_get_fd(), g_out.pending + g_out.pstart, end - g_out.pstart);
+      TI_STAT_ADD(TI_STAT_WRITES, 1);
+      if (written < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+
+         int rval = errno;
+         g_out.pstart = g_out.plen = 0;
+         g_out.frames = 0;
+         return rval;
+      }
+
+      TI_STAT_ADD(TI_STAT_WRITE_BYTES, written);
+      g_out.pstart += written;
+      if (g_out.pstart == end)
+      {
+         --g_out.frames;
+         memmove(g_out.frame_end, g_out.frame_end + 1, g_out.frames * sizeof(size_t));
+      }
+   }
+
+   g_out.pstart = g_out.plen = 0;
+   return 0;
+}
+
+/**
+ * @brief Add a frame to the end of the pending queue.
+ * @return 1 if queued, 0 if out of memory.
+ */
+static int queue_frame(const char *data, size_t len)
+{
+   // Reclaim the space of frames already written
+   if (g_out.pstart > 0)
+   {
+      memmove(g_out.pending, g_out.pending + g_out.pstart, g_out.plen - g_out.pstart);
+      for (int i=0; i<g_out.frames; ++i)
+         g_out.frame_end[i] -= g_out.pstart;
+      g_out.plen -= g_out.pstart;
+      g_out.pstart = 0;
+   }
+
+   if (g_out.plen + len > g_out.psize)
+   {
+      size_t newsize = g_out.plen + len;
+      char *newbuff = (char*)realloc(g_out.pending, newsize);
+      if (!newbuff)
+         return 0;
+      g_out.pending = newbuff;
+      g_out.psize = newsize;
+   }
+
+   memcpy(g_out.pending + g_out.plen, data, len);
+   g_out.plen += len;
+   g_out.frame_end[g_out.frames++] = g_out.plen;
+   return 1;
+}
+
+/**
+ * @brief Write a frame to the file descriptor, queueing what the
+ *        terminal does not accept.
+ * @return 0 for success, otherwise errno.
+ */
+static int write_frame(const char *data, size_t len)
+{
+   int rval = drain_pending();
+   if (rval)
+      return rval;
+
+   if (g_out.frames == 0)
+   {
+      // Nothing ahead of this frame: write directly
+      while (len > 0)
+      {
+         ssize_t written = write(ti_out_get_fd(), data, len);
+         TI_STAT_ADD(TI_STAT_WRITES, 1);
+         if (written < 0)
+         {
+            if (errno == EINTR)
+               continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+               break;
+            return errno;
+         }
+         TI_STAT_ADD(TI_STAT_WRITE_BYTES, written);
+         data += written;
+         len -= written;
+      }
+
+      // A frame already started must be finished, whatever its size
+      if (len > 0 && !queue_frame(data, len))
+         return ENOMEM;
+   }
+   else if (g_out.frames < TI_OUT_MAX_FRAMES
+            && g_out.plen - g_out.pstart + len <= g_out.plimit)
+   {
+      if (!queue_frame(data, len))
+         return ENOMEM;
+   }
+   else
+   {
+      // Queue is full: keep the frame in progress, drop the stale ones and this one
+      g_out.plen = g_out.frame_end[0];
+      g_out.frames = 1;
+      g_out.dropped = 1;
+   }
+
+   return 0;
+}
+
+/**
+ * @brief Send the buffered output to the terminal.
+ *
+ * The `stdout` stream is flushed first to keep the output in order,
+ * then the buffer is written directly to the descriptor of `stdout`,
+ * or to the one set by @ref ti_out_set_fd.  If the descriptor is
+ * non-blocking, output the terminal cannot accept is queued (see
+ * @ref ti_out_pending).
+ *
+ * Calling with an empty buffer retries the queued output.
+ * With a sink set by @ref ti_out_set_sink, the buffer goes to the
+ * sink instead.
+ *
+ * @return 0 for success, otherwise errno.
+ */
+int ti_out_flush(void)
+{
+   int rval = 0;
+
+   if (g_out.len)
+   {
+      TI_STAT_FRAME(g_out.len);
+      ti_record_output(g_out.buff, g_out.len);
+   }
+   TI_TRACE_FLUSH_BEGIN(g_out.len + ti_out_pending());
+
+   if (g_out.sink)
+   {
+      // No write happens: the flush counts only as a frame
+      if (g_out.len)
+         g_out.sink(g_out.sink_data, g_out.buff, g_out.len);
+   }
+   else
+   {
+      fflush(stdout);
+      if (g_out.len)
+         rval = write_frame(g_out.buff, g_out.len);
+      else if (g_out.frames)
+         rval = drain_pending();
+   }
+
+   g_out.len = 0;
+   TI_TRACE_FLUSH_END(ti_out_pending());
+   return rval;
+}
+
+/**
+ * @brief Number of flushed bytes the terminal has not yet accepted.
+ */
+size_t ti_out_pending(void)
+{
+   return g_out.plen - g_out.pstart;
+}
+
+/**
+ * @brief Report and reset whether queued frames have been discarded.
+ *
+ * After a drop, the terminal no longer shows what the program last
+ * drew.  Repaint, for example with @ref ti_screen_invalidate.
+ *
+ * @return 1 if frames were dropped since the last call, otherwise 0.
+ */
+int ti_out_take_dropped(void)
+{
+   int dropped = g_out.dropped;
+   g_out.dropped = 0;
+   return dropped;
+}
+
+/**
+ * @brief Set the most bytes to hold for a terminal that isn't keeping up.
+ *
+ * A single frame larger than the limit is still accepted when it
+ * is the only frame queued.
+ *
+ * @param "limit"   bytes, 0 to restore the default of 64 KiB.
+ */
+void ti_out_set_pending_limit(size_t limit)
+{
+   g_out.plimit = limit ? limit : TI_OUT_PENDING_LIMIT;
+}
+
+/**
+ * @brief Wait up to @p timeout_ms for the pending queue to empty.
+ * @return 0 if the queue is empty, otherwise EAGAIN or errno.
+ */
+int ti_out_drain(int timeout_ms)
+{
+   long long deadline = ti_clock_ns() + (long long)timeout_ms * 1000000;
+
+   ti_out_flush();
+   while (g_out.frames > 0)
+   {
+      long long remaining = deadline - ti_clock_ns();
+      if (remaining <= 0)
+         return EAGAIN;
+
+      struct pollfd pfd = { ti_out_get_fd(), POLLOUT, 0 };
+      if (poll(&pfd, 1, (int)(remaining / 1000000) + 1) < 0 && errno != EINTR)
+         return errno;
+
+      int rval = drain_pending();
+      if (rval)
+         return rval;
+   }
+
+   return 0;
+}
+
+/**
+ * @brief Open a separate non-blocking descriptor to the terminal for output.
+ *
+ * The terminal is opened again by name rather than setting O_NONBLOCK
+ * on `STDOUT_FILENO`, because `stdin` and `stdout` usually share one
+ * open file description, and a non-blocking `stdin` would break
+ * keyboard reads.  The new descriptor replaces the output destination
+ * and is closed by @ref ti_out_release.
+ *
+ * @return 0 for success, otherwise errno.
+ */
+int ti_out_open_nonblocking(void)
+{
+   const char *name = ttyname(STDOUT_FILENO);
+   if (!name)
+      return errno;
+
+   int fd = open(name, O_WRONLY | O_NOCTTY | O_NONBLOCK);
+   if (fd < 0)
+      return errno;
+
+   ti_out_set_fd(fd);
+   g_out.owned = 1;
+   return 0;
+}
+
+/**
+ * @brief Direct output to a file descriptor rather than that of `stdout`.
+ *
+ * Pending output is flushed to the previous destination first.
+ * Queued output for a descriptor opened by @ref ti_out_open_nonblocking
+ * is given a short time to drain before the descriptor is closed.
+ *
+ * @param "fd"   file descriptor of the terminal, or -1 to restore
+ *               output to the descriptor of `stdout`.
+ */
+void ti_out_set_fd(int fd)
+{
+   ti_out_drain(TI_OUT_CLOSE_TIMEOUT);
+   if (g_out.fd >= 0 && g_out.owned)
+      close(g_out.fd);
+
+   g_out.pstart = g_out.plen = 0;
+   g_out.frames = 0;
+   g_out.owned = 0;
+   g_out.fd = fd;
+}
+
+/**
+ * @brief Hand flushed output to a function rather than the terminal.
+ *
+ * Pending output is flushed to the previous destination first.
+ *
+ * @param "sink"   function to receive each flush, or NULL to send
+ *                 output to the terminal again
+ * @param "data"   pointer passed to @p sink
+ */
+void ti_out_set_sink(TI_OUT_SINK sink, void *data)
+{
+   ti_out_flush();
+   g_out.sink = sink;
+   g_out.sink_data = data;
+}
+
+/**
+ * @brief Get the file descriptor to which output is written.
+ * @return descriptor set with @ref ti_out_set_fd, or that of `stdout`.
+ */
+int ti_out_get_fd(void)
+{
+   return g_out.fd < 0 ? fileno(stdout) : g_out.fd;
+}
+
+/**
+ * @brief Number of bytes collected and not yet flushed.
+ */
+size_t ti_out_buffered(void)
+{
+   return g_out.len;
+}
+
+/**
+ * @brief Flush and free the output buffers, restoring output to `stdout`
+ *        and forgetting the line-drawing map.
+ */
+void ti_out_release(void)
+{
+   ti_out_set_fd(-1);
+   free(g_out.buff);
+   free(g_out.pending);
+   g_out.buff = g_out.pending = NULL;
+   g_out.size = g_out.psize = 0;
+   g_out.depth = 0;
+   memset(g_acs_map, 0, sizeof(g_acs_map));
+}
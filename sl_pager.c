@@ -0,0 +1,558 @@
+/**
+ * @file sl_pager.c
+ * @brief View files of any size through a @ref TI_PANE.
+ *
+ * The file is memory-mapped, so only the pages under the visible
+ * lines are read into memory.  A background thread reads the file
+ * once to find where its lines begin, and the pager can show and jump
+ * among the lines found so far while the thread continues.  Viewing a
+ * file of several gigabytes starts as soon as the first lines are
+ * found.
+ *
+ * The index keeps the offset of every @ref TI_PAGER_STRIDE th line in
+ * fixed-size blocks, so its memory is a small fraction of the number
+ * of lines and it grows without moving what the viewer is reading.
+ * Finding any line is one lookup plus a scan of fewer than
+ * @ref TI_PAGER_STRIDE lines.
+ *
+ * Only the lines in the view are decoded and written into the screen
+ * buffer.  Scrolling by less than a screen uses @ref ti_pane_scroll,
+ * so the terminal moves the lines that stay visible.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "termintel.h"
+
+#define TI_PAGER_STRIDE 128            ///< lines between recorded offsets
+#define TI_PAGER_BLOCK 4096            ///< offsets per index block
+#define TI_PAGER_READ_SIZE (64 * 1024) ///< bytes read at a time by the index thread
+#define TI_PAGER_TAB 8                 ///< columns between tab stops
+
+/**
+ * @brief Line offsets of a file, shared by the viewer and the index thread.
+ *
+ * The thread fills the blocks, then publishes @p lines, so any line
+ * below @p lines can be read without a lock.
+ */
+struct ti_pager_index {
+   pthread_t thread;
+   int running;         ///< set if @p thread must be joined
+   int fd;
+   size_t size;
+   size_t **blocks;     ///< directory of blocks, sized for the largest possible file
+   size_t block_count;  ///< entries in @p blocks
+   long long lines;     ///< lines indexed so far
+   int complete;        ///< set when every line has been indexed
+   int stop;            ///< set to make the thread quit early
+};
+
+/**
+ * @brief Record the offset of @p line, which must be a multiple of TI_PAGER_STRIDE.
+ * @return 0 for success, otherwise errno.
+ */
+static int record_offset(struct ti_pager_index *idx, long long line, size_t offset)
+{
+   long long stop = line / TI_PAGER_STRIDE;
+   size_t block = (size_t)(stop / TI_PAGER_BLOCK);
+
+   if (block >= idx->block_count)
+      return ERANGE;
+
+   if (!idx->blocks[block])
+   {
+      idx->blocks[block] = (size_t*)malloc(TI_PAGER_BLOCK * sizeof(size_t));
+      if (!idx->blocks[block])
+         return ENOMEM;
+   }
+
+   idx->blocks[block][stop % TI_PAGER_BLOCK] = offset;
+   return 0;
+}
+
+/**
+ * @brief Find the lines of the file, publishing progress after each read.
+ *
+ * The thread reads with `pread` rather than through the mapping, so
+ * the pages it scans don't stay in the viewer's memory.
+ */
+static void *index_thread(void *arg)
+{
+   struct ti_pager_index *idx = (struct ti_pager_index*)arg;
+   char *buff = (char*)malloc(TI_PAGER_READ_SIZE);
+   long long lines = 0;
+   size_t pos = 0;
+   char last = '\n';
+
+   if (!buff || record_offset(idx, 0, 0))
+      goto finish;
+
+   while (pos < idx->size && !__atomic_load_n(&idx->stop, __ATOMIC_RELAXED))
+   {
+      // Bytes appended after the file was mapped are not in the view
+      size_t want = idx->size - pos < TI_PAGER_READ_SIZE ? idx->size - pos : TI_PAGER_READ_SIZE;
+      ssize_t got = pread(idx->fd, buff, want, (off_t)pos);
+      if (got < 0 && errno == EINTR)
+         continue;
+      if (got <= 0)
+         break;
+
+      const char *ptr = buff;
+      const char *end = buff + got;
+      const char *newline;
+      while ((newline = (const char*)memchr(ptr, '\n', end - ptr)))
+      {
+         ++lines;
+         if (lines % TI_PAGER_STRIDE == 0
+             && record_offset(idx, lines, pos + (newline - buff) + 1))
+            goto finish;
+         ptr = newline + 1;
+      }
+
+      last = buff[got - 1];
+      pos += got;
+      __atomic_store_n(&idx->lines, lines, __ATOMIC_RELEASE);
+   }
+
+   // A last line without a newline still counts
+   if (pos >= idx->size && last != '\n')
+      __atomic_store_n(&idx->lines, lines + 1, __ATOMIC_RELEASE);
+
+  finish:
+   free(buff);
+   __atomic_store_n(&idx->complete, 1, __ATOMIC_RELEASE);
+   return NULL;
+}
+
+/**
+ * @brief Open a file for viewing and start indexing its lines.
+ *
+ * Nothing is drawn until @ref ti_pager_draw or a movement function
+ * is called.
+ *
+ * @param "pager"   pager to initialize
+ * @param "path"    regular file to view
+ * @param "view"    part of the screen where the file is shown, copied
+ * @return 0 for success, otherwise errno.
+ */
+int ti_pager_open(TI_PAGER *pager, const char *path, const TI_PANE *view)
+{
+   struct ti_pager_index *idx;
+   struct stat st;
+   int rval = 0;
+
+   memset(pager, 0, sizeof(TI_PAGER));
+   pager->view = *view;
+
+   idx = pager->index = (struct ti_pager_index*)calloc(1, sizeof(struct ti_pager_index));
+   if (!idx)
+      return ENOMEM;
+
+   idx->fd = open(path, O_RDONLY);
+   if (idx->fd == -1 || fstat(idx->fd, &st))
+   {
+      rval = errno;
+      goto abandon;
+   }
+
+   if (!S_ISREG(st.st_mode))
+   {
+      rval = EINVAL;
+      goto abandon;
+   }
+
+   pager->size = idx->size = (size_t)st.st_size;
+
+   // Enough blocks for a file consisting only of newlines
+   idx->block_count = (idx->size / TI_PAGER_STRIDE + 1) / TI_PAGER_BLOCK + 1;
+   idx->blocks = (size_t**)calloc(idx->block_count, sizeof(size_t*));
+   if (!idx->blocks)
+   {
+      rval = ENOMEM;
+      goto abandon;
+   }
+
+   if (idx->size == 0)
+   {
+      idx->complete = 1;
+      return 0;
+   }
+
+   void *map = mmap(NULL, idx->size, PROT_READ, MAP_PRIVATE, idx->fd, 0);
+   if (map == MAP_FAILED)
+   {
+      rval = errno;
+      goto abandon;
+   }
+   pager->map = (const char*)map;
+
+   posix_fadvise(idx->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+   rval = pthread_create(&idx->thread, NULL, index_thread, idx);
+   if (rval == 0)
+   {
+      idx->running = 1;
+      return 0;
+   }
+
+  abandon:
+   ti_pager_close(pager);
+   return rval;
+}
+
+/**
+ * @brief Stop indexing and release the file and memory of a pager.
+ */
+void ti_pager_close(TI_PAGER *pager)
+{
+   struct ti_pager_index *idx = pager->index;
+
+   if (idx)
+   {
+      if (idx->running)
+      {
+         __atomic_store_n(&idx->stop, 1, __ATOMIC_RELAXED);
+         pthread_join(idx->thread, NULL);
+      }
+
+      if (idx->blocks)
+      {
+         for (size_t i=0; i<idx->block_count; ++i)
+            free(idx->blocks[i]);
+         free(idx->blocks);
+      }
+
+      if (pager->map)
+         munmap((void*)pager->map, idx->size);
+
+      if (idx->fd >= 0)
+         close(idx->fd);
+
+      free(idx);
+   }
+
+   memset(pager, 0, sizeof(TI_PAGER));
+}
+
+/**
+ * @brief Number of lines indexed so far.
+ * @param "pager"      pager
+ * @param "complete"   if not NULL, set to 1 when the whole file has been indexed
+ * @return number of lines that can be shown.
+ */
+long long ti_pager_line_count(TI_PAGER *pager, int *complete)
+{
+   struct ti_pager_index *idx = pager->index;
+
+   // Read @p complete first: the count is final once it is set
+   int done = __atomic_load_n(&idx->complete, __ATOMIC_ACQUIRE);
+   if (complete)
+      *complete = done;
+
+   return __atomic_load_n(&idx->lines, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Find a line of the file.
+ * @param "pager"   pager
+ * @param "line"    line number, from 0
+ * @param "text"    set to the start of the line in the mapped file,
+ *                  not NULL-terminated
+ * @param "len"     set to the length of the line, without the newline
+ *                  and any carriage return preceding it
+ * @return 0 for success, ERANGE if the line is past the end of the
+ *         file or has not been indexed yet.
+ */
+int ti_pager_get_line(TI_PAGER *pager, long long line, const char **text, size_t *len)
+{
+   struct ti_pager_index *idx = pager->index;
+
+   if (line < 0 || line >= __atomic_load_n(&idx->lines, __ATOMIC_ACQUIRE))
+      return ERANGE;
+
+   long long stop = line / TI_PAGER_STRIDE;
+   size_t offset = idx->blocks[stop / TI_PAGER_BLOCK][stop % TI_PAGER_BLOCK];
+
+   const char *ptr = pager->map + offset;
+   const char *end = pager->map + pager->size;
+   for (int i = line % TI_PAGER_STRIDE; i > 0; --i)
+   {
+      const char *newline = (const char*)memchr(ptr, '\n', end - ptr);
+      if (!newline)
+         return ERANGE;
+      ptr = newline + 1;
+   }
+
+   const char *newline = (const char*)memchr(ptr, '\n', end - ptr);
+   if (!newline)
+      newline = end;
+   if (newline > ptr && newline[-1] == '\r')
+      --newline;
+
+   *text = ptr;
+   *len = newline - ptr;
+   return 0;
+}
+
+/**
+ * @brief Write one line of the view into the screen buffer.
+ * @param "pager"   pager
+ * @param "row"     row of the view, from 0
+ */
+static void draw_row(TI_PAGER *pager, int row)
+{
+   TI_PANE *view = &pager->view;
+   int scr_row = view->top + row;
+   int shift = pager->shift;
+   int column = 0;   // column of the next character from the start of the line
+   const char *ptr;
+   size_t len;
+
+   if (ti_pager_get_line(pager, pager->first + row, &ptr, &len) == 0)
+   {
+      const char *end = ptr + len;
+
+      while (ptr < end && column < shift + view->cols)
+      {
+         unsigned int code;
+         int width;
+         int bytes = ti_grapheme_next(ptr, end - ptr, &width);
+
+         if (*ptr == '\t')
+         {
+            code = ' ';
+            width = (column / TI_PAGER_TAB + 1) * TI_PAGER_TAB - column;
+         }
+         else if (width < 0)
+         {
+            code = '?';
+            width = 1;
+         }
+         else
+            code = ti_gcache_intern(view->screen->gcache, ptr, bytes, width);
+
+         ptr += bytes;
+         int next = column + width;
+
+         if (width == 2 && code != ' ')
+         {
+            if (column >= shift && next <= shift + view->cols)
+            {
+               ti_screen_set_cell(view->screen, scr_row, view->left + column - shift, code, 0);
+               column = next;
+               continue;
+            }
+
+            // Half of the character is outside the view
+            code = ' ';
+         }
+
+         for (; column < next; ++column)
+            if (column >= shift && column < shift + view->cols)
+               ti_screen_set_cell(view->screen, scr_row, view->left + column - shift, code, 0);
+      }
+   }
+
+   int used = column - shift;
+   if (used < 0)
+      used = 0;
+   if (used < view->cols)
+      ti_screen_fill(view->screen, scr_row, view->left + used, view->cols - used, ' ', 0);
+}
+
+/**
+ * @brief Write every line of the view into the screen buffer.
+ *
+ * Call this when @ref ti_pager_line_count grows while the last lines
+ * of the view are still empty.
+ */
+void ti_pager_draw(TI_PAGER *pager)
+{
+   for (int row=0; row<pager->view.rows; ++row)
+      draw_row(pager, row);
+}
+
+/**
+ * @brief Limit @p first to the lines indexed so far, keeping the view
+ *        full when the file is long enough.
+ */
+static long long clamp_first(TI_PAGER *pager, long long first)
+{
+   long long last = ti_pager_line_count(pager, NULL) - pager->view.rows;
+   if (first > last)
+      first = last;
+   if (first < 0)
+      first = 0;
+   return first;
+}
+
+/**
+ * @brief Show the view starting at @p line.
+ *
+ * Lines that have not been indexed yet can't be reached, so the view
+ * stops at the last indexed line.
+ */
+void ti_pager_goto(TI_PAGER *pager, long long line)
+{
+   pager->first = clamp_first(pager, line);
+   ti_pager_draw(pager);
+}
+
+/**
+ * @brief Move the view by @p count lines.
+ * @param "pager"   pager
+ * @param "count"   lines to move toward the end of the file, negative
+ *                  to move toward the beginning
+ */
+void ti_pager_scroll(TI_PAGER *pager, long long count)
+{
+   long long first = clamp_first(pager, pager->first + count);
+   long long delta = first - pager->first;
+   int rows = pager->view.rows;
+
+   if (delta == 0)
+      return;
+
+   pager->first = first;
+
+   if (delta >= rows || -delta >= rows)
+   {
+      ti_pager_draw(pager);
+      return;
+   }
+
+   // Let the terminal move the lines that stay, then draw the new ones
+   ti_pane_scroll(&pager->view, (int)delta);
+   if (delta > 0)
+      for (int row = rows - (int)delta; row < rows; ++row)
+         draw_row(pager, row);
+   else
+      for (int row = 0; row < (int)-delta; ++row)
+         draw_row(pager, row);
+}
+
+/**
+ * @brief Scroll the view horizontally.
+ * @param "pager"   pager
+ * @param "cols"    columns to hide at the left, negative to reveal them
+ */
+void ti_pager_shift(TI_PAGER *pager, int cols)
+{
+   int shift = pager->shift + cols;
+   if (shift < 0)
+      shift = 0;
+
+   if (shift != pager->shift)
+   {
+      pager->shift = shift;
+      ti_pager_draw(pager);
+   }
+}
+
+// Hide debugging code from Doxygen
+/** @cond */
+
+#ifdef SL_PAGER_MAIN
+
+#include <stdio.h>
+#include <time.h>
+
+#include "sl_caps.c"
+#include "sl_ioctl.c"
+#include "sl_libcaps.c"
+#include "sl_output.c"
+#include "sl_screen.c"
+#include "sl_utf8.c"
+#include "sl_gcache.c"
+#include "sl_frame.c"
+#include "sl_record.c"
+#include "sl_pane.c"
+
+void show_status(TI_PAGER *pager, TI_SCREEN *scr)
+{
+   char buff[80];
+   int complete;
+   long long count = ti_pager_line_count(pager, &complete);
+
+   snprintf(buff, sizeof(buff), "line %lld of %lld%s",
+            pager->first + 1, count, complete ? "" : " (indexing)");
+   int used = ti_screen_put(scr, scr->rows - 1, 0, buff, TI_ATTR_REVERSE);
+   ti_screen_fill(scr, scr->rows - 1, used, scr->cols - used, ' ', TI_ATTR_REVERSE);
+}
+
+int main(int argc, const char **argv)
+{
+   const char *path = argc > 1 ? argv[1] : "sl_pager.c";
+   struct timespec pause = { 0, 20000000 };
+   TI_SCREEN screen;
+   TI_PANE view;
+   TI_PAGER pager;
+   int rows, cols, complete;
+
+   if (!TIV_setup(0, NULL))
+      return 1;
+
+   ti_get_screen_size(&rows, &cols);
+   if (ti_screen_init(&screen, rows, cols) == 0)
+   {
+      ti_pane_init(&view, &screen, 0, 0, rows - 1, cols);
+      int rval = ti_pager_open(&pager, path, &view);
+      if (rval)
+         fprintf(stderr, "Failed to open %s: %s.\n", path, strerror(rval));
+      else
+      {
+         // Show the first lines while the rest are indexed
+         ti_pager_draw(&pager);
+         show_status(&pager, &screen);
+         ti_frame_present(&screen);
+
+         for (int i=0; i<100; ++i)
+         {
+            ti_pager_scroll(&pager, 1);
+            show_status(&pager, &screen);
+            ti_frame_present(&screen);
+            nanosleep(&pause, NULL);
+         }
+
+         do
+            ti_pager_line_count(&pager, &complete);
+         while (!complete && nanosleep(&pause, NULL) == 0);
+
+         ti_pager_goto(&pager, ti_pager_line_count(&pager, NULL) / 2);
+         show_status(&pager, &screen);
+         ti_frame_present(&screen);
+
+         ti_pager_close(&pager);
+      }
+
+      ti_screen_destroy(&screen);
+      printf("\n");
+   }
+
+   TIV_destroy_arrays(0, NULL);
+   return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/* Local Variables:          */
+/* compile-command:   "gcc  \*/
+/* -Wall -Werror -pedantic  \*/
+/* -ggdb -std=c99           \*/
+/* -DSL_PAGER_MAIN          \*/
+/* -fsanitize=address       \*/
+/* -pthread -ltinfo         \*/
+/* -o sl_pager              \*/
+/* sl_pager.c"               */
+/* End:                      */
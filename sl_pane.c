@@ -0,0 +1,214 @@
+/**
+ * @file sl_pane.c
+ * @brief Rectangles of a @ref TI_SCREEN that scroll independently.
+ *
+ * Appending a line to a pane scrolls only the pane's rectangle.  The
+ * scroll is done with @ref ti_screen_scroll, so the render uses the
+ * terminal's scroll region, plus left and right margins for panes
+ * narrower than the screen, and only the new line is sent.  On
+ * terminals without margins, the render falls back to sending the
+ * changed cells of the pane.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "termintel.h"
+
+/**
+ * @brief Set the rectangle of a pane, clipped to the screen.
+ * @param "pane"   pane to initialize
+ * @param "scr"    screen on which the pane is drawn
+ * @param "top"    first screen row of the pane
+ * @param "left"   first screen column of the pane
+ * @param "rows"   height of the pane
+ * @param "cols"   width of the pane
+ */
+void ti_pane_init(TI_PANE *pane, TI_SCREEN *scr, int top, int left, int rows, int cols)
+{
+   if (top < 0)
+      top = 0;
+   if (left < 0)
+      left = 0;
+   if (top + rows > scr->rows)
+      rows = scr->rows - top;
+   if (left + cols > scr->cols)
+      cols = scr->cols - left;
+
+   pane->screen = scr;
+   pane->top = top;
+   pane->left = left;
+   pane->rows = rows > 0 ? rows : 0;
+   pane->cols = cols > 0 ? cols : 0;
+}
+
+/**
+ * @brief Divide the screen evenly among an array of panes.
+ *
+ * Side-by-side panes are separated by a column of vertical bars.
+ * Stacked panes use the full width with no separator.
+ *
+ * @param "panes"          array of @p count panes to initialize
+ * @param "count"          number of panes
+ * @param "scr"            screen to divide
+ * @param "side_by_side"   1 to arrange the panes in columns, 0 for rows
+ * @return number of panes initialized, 0 if the screen is too small.
+ */
+int ti_pane_tile(TI_PANE *panes, int count, TI_SCREEN *scr, int side_by_side)
+{
+   if (count <= 0)
+      return 0;
+
+   if (side_by_side)
+   {
+      int width = (scr->cols - (count - 1)) / count;
+      if (width < 1)
+         return 0;
+
+      int left = 0;
+      for (int i=0; i<count; ++i)
+      {
+         // Give the remainder to the last pane
+         int cols = i == count - 1 ? scr->cols - left : width;
+         ti_pane_init(&panes[i], scr, 0, left, scr->rows, cols);
+         left += cols;
+
+         if (i < count - 1)
+         {
+            for (int row=0; row<scr->rows; ++row)
+               ti_screen_set_cell(scr, row, left, '|', 0);
+            ++left;
+         }
+      }
+   }
+   else
+   {
+      int height = scr->rows / count;
+      if (height < 1)
+         return 0;
+
+      for (int i=0; i<count; ++i)
+      {
+         int rows = i == count - 1 ? scr->rows - i * height : height;
+         ti_pane_init(&panes[i], scr, i * height, 0, rows, scr->cols);
+      }
+   }
+
+   return count;
+}
+
+/**
+ * @brief Blank the pane.
+ */
+void ti_pane_clear(TI_PANE *pane)
+{
+   for (int row=0; row<pane->rows; ++row)
+      ti_screen_fill(pane->screen, pane->top + row, pane->left, pane->cols, ' ', 0);
+}
+
+/**
+ * @brief Write text at a position relative to the pane, clipped to the pane.
+ * @return number of columns written.
+ */
+int ti_pane_put(TI_PANE *pane, int row, int col, const char *text, unsigned short attr)
+{
+   if (row < 0 || row >= pane->rows || col < 0 || col >= pane->cols)
+      return 0;
+
+   return ti_screen_put_span(pane->screen, pane->top + row, pane->left + col,
+                             pane->cols - col, text, attr);
+}
+
+/**
+ * @brief Scroll the contents of the pane.
+ * @param "pane"    pane to scroll
+ * @param "count"   lines to scroll up, negative to scroll down
+ */
+void ti_pane_scroll(TI_PANE *pane, int count)
+{
+   if (pane->rows > 0 && pane->cols > 0)
+      ti_screen_scroll(pane->screen,
+                       pane->top, pane->top + pane->rows - 1,
+                       pane->left, pane->left + pane->cols - 1,
+                       count);
+}
+
+/**
+ * @brief Scroll the pane up one line and write @p text on its bottom line.
+ */
+void ti_pane_append(TI_PANE *pane, const char *text, unsigned short attr)
+{
+   if (pane->rows <= 0)
+      return;
+
+   ti_pane_scroll(pane, 1);
+
+   int row = pane->top + pane->rows - 1;
+   int used = ti_screen_put_span(pane->screen, row, pane->left, pane->cols, text, attr);
+   ti_screen_fill(pane->screen, row, pane->left + used, pane->cols - used, ' ', 0);
+}
+
+// Hide debugging code from Doxygen
+/** @cond */
+
+#ifdef SL_PANE_MAIN
+
+#include <stdio.h>
+
+#include "sl_caps.c"
+#include "sl_ioctl.c"
+#include "sl_libcaps.c"
+#include "sl_output.c"
+#include "sl_screen.c"
+#include "sl_utf8.c"
+#include "sl_gcache.c"
+#include "sl_frame.c"
+#include "sl_record.c"
+
+int main(int argc, const char **argv)
+{
+   TI_SCREEN screen;
+   TI_PANE panes[2];
+   int rows, cols;
+   char buff[64];
+
+   if (!TIV_setup(0, NULL))
+      return 1;
+
+   ti_get_screen_size(&rows, &cols);
+   if (ti_screen_init(&screen, rows, cols) == 0)
+   {
+      ti_pane_tile(panes, 2, &screen, 1);
+
+      for (int i=0; i<2000; ++i)
+      {
+         snprintf(buff, sizeof(buff), "left pane line %d", i);
+         ti_pane_append(&panes[0], buff, 0);
+         if (i % 3 == 0)
+         {
+            snprintf(buff, sizeof(buff), "right pane line %d", i / 3);
+            ti_pane_append(&panes[1], buff, TI_ATTR_BOLD);
+         }
+         ti_frame_present(&screen);
+      }
+
+      ti_screen_destroy(&screen);
+   }
+
+   TIV_destroy_arrays(0, NULL);
+   return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/* Local Variables:          */
+/* compile-command:   "gcc  \*/
+/* -Wall -Werror -pedantic  \*/
+/* -ggdb -std=c99           \*/
+/* -DSL_PANE_MAIN           \*/
+/* -fsanitize=address       \*/
+/* -ltinfo                  \*/
+/* -o sl_pane               \*/
+/* sl_pane.c"                */
+/* End:                      */
@@ -0,0 +1,556 @@
+/**
+ * @file sl_record.c
+ * @brief Recording of terminal sessions, and reading them back.
+ *
+ * While a recording is open (@ref ti_record_open, or `TERMINTEL_RECORD`
+ * in the environment naming the file), every flush of the output
+ * layer and every read of terminal input is written to it with the
+ * time since the recording started.
+ *
+ * The file is an asciicast v2 recording, which asciinema can play:
+ * a header line of JSON, then one line per event,
+ * `[seconds, "o", "bytes"]` for output and `[seconds, "i", "bytes"]`
+ * for input.  JSON strings hold text, so bytes that are not valid
+ * UTF-8 are written as `\u0080` to `ÿ`.  Valid characters in that
+ * range are written as UTF-8, so @ref ti_replay_next gets back the
+ * exact bytes.
+ *
+ * @ref ti_replay_open reads a recording, for example to feed the
+ * output to @ref ti_vterm_write and the input to @ref ti_input_next,
+ * as tools/ti_replay.c does.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "termintel.h"
+
+#define TI_RECORD_BUFFER_SIZE 8192
+
+static struct ti_record_file {
+   pthread_mutex_t lock;
+   int fd;
+   long long start;      ///< ti_clock_ns() when the recording started
+   size_t len;
+   char buff[TI_RECORD_BUFFER_SIZE];
+} g_record = { PTHREAD_MUTEX_INITIALIZER, -1, 0, 0, { 0 } };
+
+static void write_buffer(void)
+{
+   size_t done = 0;
+   while (done < g_record.len)
+   {
+      ssize_t written = write(g_record.fd, g_record.buff + done, g_record.len - done);
+      if (written < 0 && errno == EINTR)
+         continue;
+      if (written <= 0)
+         break;
+      done += written;
+   }
+   g_record.len = 0;
+}
+
+static void append(const char *data, size_t len)
+{
+   if (g_record.len + len > TI_RECORD_BUFFER_SIZE)
+      write_buffer();
+   memcpy(g_record.buff + g_record.len, data, len);
+   g_record.len += len;
+}
+
+/**
+ * @brief Append bytes as the contents of a JSON string.
+ */
+static void append_escaped(const char *data, size_t len)
+{
+   static const char hex[] = "0123456789abcdef";
+   char escape[6] = { '\\', 'u', '0', '0', 0, 0 };
+   size_t pos = 0;
+
+   while (pos < len)
+   {
+      unsigned char chr = (unsigned char)data[pos];
+      int count = chr >= 0x80 ? ti_utf8_sequence_length(data + pos, len - pos) : 1;
+
+      if (count > 1)
+         append(data + pos, count);
+      else if (chr == '"' || chr == '\\')
+      {
+         char pair[2] = { '\\', (char)chr };
+         append(pair, 2);
+      }
+      else if (chr == '\n')
+         append("\\n", 2);
+      else if (chr < 0x20 || chr >= 0x7f)
+      {
+         escape[4] = hex[chr >> 4];
+         escape[5] = hex[chr & 0xf];
+         append(escape, 6);
+      }
+      else
+         append(data + pos, 1);
+
+      pos += count > 1 ? count : 1;
+   }
+}
+
+static void record_event(char type, const char *data, size_t len)
+{
+   char head[48];
+
+   if (len == 0 || __atomic_load_n(&g_record.fd, __ATOMIC_RELAXED) < 0)
+      return;
+
+   pthread_mutex_lock(&g_record.lock);
+   if (g_record.fd >= 0)
+   {
+      long long elapsed = ti_clock_ns() - g_record.start;
+      int head_len = snprintf(head, sizeof(head), "[%lld.%06lld, \"%c\", \"",
+                              elapsed / 1000000000, elapsed / 1000 % 1000000, type);
+      append(head, head_len);
+      append_escaped(data, len);
+      append("\"]\n", 3);
+   }
+   pthread_mutex_unlock(&g_record.lock);
+}
+
+/**
+ * @brief Add output to the recording, if one is open.
+ *
+ * Called by @ref ti_out_flush.
+ */
+void ti_record_output(const char *data, size_t len)
+{
+   record_event('o', data, len);
+}
+
+/**
+ * @brief Add input to the recording, if one is open.
+ *
+ * Called by @ref ti_input_next and @ref ti_get_keypress after reading.
+ */
+void ti_record_input(const char *data, size_t len)
+{
+   record_event('i', data, len);
+}
+
+/**
+ * @brief Start recording to a file.
+ *
+ * The header gives the current screen size and `TERM`.  A recording
+ * already open is closed first.
+ *
+ * @param "path"   file to create or replace
+ * @return 0 for success, otherwise errno.
+ */
+int ti_record_open(const char *path)
+{
+   char header[128];
+   int rows, cols;
+
+   int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd < 0)
+      return errno;
+
+   ti_record_close();
+
+   ti_get_screen_size(&rows, &cols);
+   if (rows <= 0 || cols <= 0)
+   {
+      rows = 24;
+      cols = 80;
+   }
+
+   const char *term = getenv("TERM");
+
+   pthread_mutex_lock(&g_record.lock);
+   __atomic_store_n(&g_record.fd, fd, __ATOMIC_RELAXED);
+   g_record.start = ti_clock_ns();
+   int len = snprintf(header, sizeof(header),
+                      "{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %lld, "
+                      "\"env\": {\"TERM\": \"",
+                      cols, rows, (long long)time(NULL));
+   append(header, len);
+   if (term)
+      append_escaped(term, strlen(term));
+   append("\"}}\n", 4);
+   write_buffer();
+   pthread_mutex_unlock(&g_record.lock);
+   return 0;
+}
+
+/**
+ * @brief Write what is buffered and close the recording.
+ */
+void ti_record_close(void)
+{
+   pthread_mutex_lock(&g_record.lock);
+   if (g_record.fd >= 0)
+   {
+      write_buffer();
+      close(g_record.fd);
+      __atomic_store_n(&g_record.fd, -1, __ATOMIC_RELAXED);
+   }
+   pthread_mutex_unlock(&g_record.lock);
+}
+
+/**
+ * @brief Start recording to the file named by `TERMINTEL_RECORD`, if set.
+ *
+ * Called by @ref TIV_setup.  Later calls do nothing.
+ */
+void ti_record_init(void)
+{
+   static int started = 0;
+   const char *path = getenv("TERMINTEL_RECORD");
+
+   if (!started && path && *path && ti_record_open(path) == 0)
+   {
+      started = 1;
+      atexit(ti_record_close);
+   }
+}
+
+/**
+ * @brief Recording being read by @ref ti_replay_next.
+ */
+struct ti_replay {
+   FILE *file;
+   char *line;           ///< line read by getline
+   size_t line_size;
+   char *data;           ///< bytes of the last event
+   size_t data_size;
+   int rows;
+   int cols;
+   char term[64];
+};
+
+/**
+ * @brief Find the number that follows a key in the header.
+ */
+static int header_int(const char *header, const char *key, int fallback)
+{
+   const char *found = strstr(header, key);
+   if (!found)
+      return fallback;
+   found = strchr(found + strlen(key), ':');
+   return found ? atoi(found + 1) : fallback;
+}
+
+static const char *skip_space(const char *ptr)
+{
+   while (*ptr == ' ' || *ptr == '\t')
+      ++ptr;
+   return ptr;
+}
+
+static int hex_value(const char *ptr, unsigned int *value)
+{
+   *value = 0;
+   for (int i=0; i<4; ++i)
+   {
+      char chr = ptr[i];
+      int digit;
+      if (chr >= '0' && chr <= '9')
+         digit = chr - '0';
+      else if (chr >= 'a' && chr <= 'f')
+         digit = chr - 'a' + 10;
+      else if (chr >= 'A' && chr <= 'F')
+         digit = chr - 'A' + 10;
+      else
+         return 0;
+      *value = *value << 4 | digit;
+   }
+   return 1;
+}
+
+/**
+ * @brief Decode the JSON string at @p ptr into @p out.
+ *
+ * Escapes below U+0100 become single bytes, as written by
+ * @ref ti_record_output.  The output is never longer than the input.
+ *
+ * @return the position after the closing quote, or NULL if malformed.
+ */
+static const char *decode_string(const char *ptr, char *out, size_t *len)
+{
+   *len = 0;
+   if (*ptr++ != '"')
+      return NULL;
+
+   while (*ptr != '"')
+   {
+      if (*ptr == '\0')
+         return NULL;
+      if (*ptr != '\\')
+      {
+         out[(*len)++] = *ptr++;
+         continue;
+      }
+
+      ++ptr;
+      switch (*ptr)
+      {
+         case 'n': out[(*len)++] = '\n'; break;
+         case 'r': out[(*len)++] = '\r'; break;
+         case 't': out[(*len)++] = '\t'; break;
+         case 'b': out[(*len)++] = '\b'; break;
+         case 'f': out[(*len)++] = '\f'; break;
+         case '"':
+         case '\\':
+         case '/': out[(*len)++] = *ptr; break;
+         case 'u':
+         {
+            unsigned int code, low;
+            if (!hex_value(ptr + 1, &code))
+               return NULL;
+            ptr += 4;
+            if (code >= 0xD800 && code < 0xDC00 && ptr[1] == '\\' && ptr[2] == 'u'
+                && hex_value(ptr + 3, &low) && low >= 0xDC00 && low < 0xE000)
+            {
+               code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+               ptr += 6;
+            }
+
+            if (code < 0x100)
+               out[(*len)++] = (char)code;
+            else
+               *len += ti_utf8_encode(code, out + *len);
+            break;
+         }
+         default:
+            return NULL;
+      }
+      ++ptr;
+   }
+
+   return ptr + 1;
+}
+
+/**
+ * @brief Open a recording to read its events.
+ * @param "path"   asciicast v2 file, as written by @ref ti_record_open
+ * @return the recording, or NULL with errno set.
+ */
+TI_REPLAY *ti_replay_open(const char *path)
+{
+   TI_REPLAY *replay = (TI_REPLAY*)calloc(1, sizeof(TI_REPLAY));
+   if (!replay)
+      return NULL;
+
+   replay->file = fopen(path, "r");
+   if (!replay->file)
+   {
+      int rval = errno;
+      free(replay);
+      errno = rval;
+      return NULL;
+   }
+
+   if (getline(&replay->line, &replay->line_size, replay->file) < 0
+       || !strstr(replay->line, "\"version\""))
+   {
+      ti_replay_close(replay);
+      errno = EINVAL;
+      return NULL;
+   }
+
+   replay->rows = header_int(replay->line, "\"height\"", 24);
+   replay->cols = header_int(replay->line, "\"width\"", 80);
+
+   const char *term = strstr(replay->line, "\"TERM\"");
+   if (term)
+   {
+      term = skip_space(strchr(term + 6, ':') ? strchr(term + 6, ':') + 1 : term + 6);
+      size_t len;
+      char *buff = (char*)malloc(strlen(term) + 1);
+      if (buff && decode_string(term, buff, &len) && len < sizeof(replay->term))
+      {
+         memcpy(replay->term, buff, len);
+         replay->term[len] = '\0';
+      }
+      free(buff);
+   }
+
+   return replay;
+}
+
+/**
+ * @brief Close a recording opened by @ref ti_replay_open.
+ */
+void ti_replay_close(TI_REPLAY *replay)
+{
+   if (replay)
+   {
+      if (replay->file)
+         fclose(replay->file);
+      free(replay->line);
+      free(replay->data);
+      free(replay);
+   }
+}
+
+/**
+ * @brief Screen size and terminal type of a recording.
+ * @param "replay"   recording
+ * @param "rows"     set to the screen rows
+ * @param "cols"     set to the screen columns
+ * @return the `TERM` value recorded, empty if none.
+ */
+const char *ti_replay_info(const TI_REPLAY *replay, int *rows, int *cols)
+{
+   *rows = replay->rows;
+   *cols = replay->cols;
+   return replay->term;
+}
+
+/**
+ * @brief Read the next event of a recording.
+ *
+ * Lines that are not events, such as asciinema's markers, are skipped.
+ *
+ * @param "replay"   recording
+ * @param "event"    set to the event, whose data is valid until the
+ *                   next call
+ * @return 0 for success, ENODATA at the end of the recording, EINVAL
+ *         for a malformed line, otherwise errno.
+ */
+int ti_replay_next(TI_REPLAY *replay, TI_RECORD_EVENT *event)
+{
+   for (;;)
+   {
+      errno = 0;
+      ssize_t len = getline(&replay->line, &replay->line_size, replay->file);
+      if (len < 0)
+         return errno ? errno : ENODATA;
+
+      const char *ptr = skip_space(replay->line);
+      if (*ptr != '[')
+         continue;
+
+      char *end;
+      event->time = strtod(ptr + 1, &end);
+      ptr = skip_space(end);
+      if (*ptr++ != ',')
+         return EINVAL;
+
+      ptr = skip_space(ptr);
+      if (ptr[0] != '"' || ptr[1] == '\0' || ptr[2] != '"')
+         return EINVAL;
+      event->type = ptr[1];
+
+      ptr = skip_space(ptr + 3);
+      if (*ptr++ != ',')
+         return EINVAL;
+
+      if ((size_t)len > replay->data_size)
+      {
+         char *data = (char*)realloc(replay->data, len);
+         if (!data)
+            return ENOMEM;
+         replay->data = data;
+         replay->data_size = len;
+      }
+
+      if (!decode_string(skip_space(ptr), replay->data, &event->len))
+         return EINVAL;
+
+      event->data = replay->data;
+      return 0;
+   }
+}
+
+// Hide debugging code from Doxygen
+/** @cond */
+
+#ifdef SL_RECORD_MAIN
+
+#include "sl_caps.c"
+#include "sl_ioctl.c"
+#include "sl_libcaps.c"
+#include "sl_output.c"
+#include "sl_screen.c"
+#include "sl_utf8.c"
+#include "sl_gcache.c"
+#include "sl_frame.c"
+#include "sl_stats.c"
+#include "sl_trace.c"
+
+int main(int argc, const char **argv)
+{
+   const char *path = argc > 1 ? argv[1] : "sl_record.cast";
+   TI_SCREEN screen;
+   TI_RECORD_EVENT event;
+   int rows, cols;
+   char buff[32];
+
+   if (!TIV_setup(0, NULL))
+      return 1;
+
+   ti_get_screen_size(&rows, &cols);
+   if (rows <= 0 || cols <= 0)
+   {
+      rows = 24;
+      cols = 80;
+   }
+
+   if (ti_record_open(path) == 0 && ti_screen_init(&screen, rows, cols) == 0)
+   {
+      static const char input[] = "\xff raw \033[A";
+      ti_record_input(input, sizeof(input) - 1);
+      for (int i=0; i<20; ++i)
+      {
+         snprintf(buff, sizeof(buff), "count: %d \xc3\xa9", i);
+         ti_screen_put(&screen, i % rows, 4, buff, i % 2 ? TI_ATTR_BOLD : 0);
+         ti_screen_render(&screen);
+      }
+      ti_screen_destroy(&screen);
+      ti_record_close();
+      printf("\n");
+
+      TI_REPLAY *replay = ti_replay_open(path);
+      if (replay)
+      {
+         const char *term = ti_replay_info(replay, &rows, &cols);
+         printf("%s: %dx%d, TERM %s\n", path, rows, cols, term);
+
+         int count = 0;
+         size_t bytes = 0;
+         while (ti_replay_next(replay, &event) == 0)
+         {
+            if (event.type == 'i')
+               printf("input of %zu bytes, first %02x\n", event.len, (unsigned char)event.data[0]);
+            ++count;
+            bytes += event.len;
+         }
+         printf("%d events, %zu bytes\n", count, bytes);
+         ti_replay_close(replay);
+      }
+   }
+
+   TIV_destroy_arrays(0, NULL);
+   return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/* Local Variables:          */
+/* compile-command:   "gcc  \*/
+/* -Wall -Werror -pedantic  \*/
+/* -ggdb -std=c99           \*/
+/* -DSL_RECORD_MAIN         \*/
+/* -fsanitize=address       \*/
+/* -ltinfo                  \*/
+/* -o sl_record             \*/
+/* sl_record.c"              */
+/* End:                      */
@@ -0,0 +1,367 @@
+/**
+ * @file sl_render.c
+ * @brief Optional render thread that owns the terminal.
+ *
+ * After @ref ti_render_start, any thread may submit drawing operations
+ * with @ref ti_render_text, @ref ti_render_attr and @ref ti_render_status.
+ * The operations are pushed onto a lock-free multiple-producer,
+ * single-consumer queue, so submitting threads never wait on a lock
+ * or on terminal output.  The render thread applies the operations
+ * to the back buffer of its @ref TI_SCREEN and presents frames at the
+ * rate set with @ref ti_frame_set_rate.
+ *
+ * While the render thread runs, it is the only thread that may write
+ * to the terminal.  Other threads must not call the TIV_execute or
+ * ti_out functions.
+ *
+ * The queue is the intrusive MPSC queue described by Dmitry Vyukov:
+ * producers swap themselves into the head with one atomic exchange
+ * and link the previous node afterward.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "termintel.h"
+
+enum ti_render_cmd_type {
+   TI_RENDER_TEXT,
+   TI_RENDER_ATTR,
+   TI_RENDER_STATUS
+};
+
+/**
+ * @brief A queued drawing operation.  The text follows the struct.
+ */
+struct ti_render_cmd {
+   struct ti_render_cmd *next;
+   int type;             ///< one of enum ti_render_cmd_type
+   int row;
+   int col;
+   int count;            ///< cells affected by TI_RENDER_ATTR
+   unsigned short attr;
+   char text[];
+};
+
+static struct ti_render_state {
+   TI_SCREEN *screen;
+   pthread_t thread;
+   sem_t wakeup;
+   int signaled;     ///< set when @p wakeup has been posted and not yet consumed
+   int running;
+   struct ti_render_cmd *head;   ///< producers push here
+   struct ti_render_cmd *tail;   ///< consumer pops here
+} g_render;
+
+/** @brief Placeholder node that keeps the queue from ever being empty */
+static struct ti_render_cmd g_render_stub;
+
+static void queue_push(struct ti_render_cmd *cmd)
+{
+   __atomic_store_n(&cmd->next, NULL, __ATOMIC_RELAXED);
+   struct ti_render_cmd *prev = __atomic_exchange_n(&g_render.head, cmd, __ATOMIC_ACQ_REL);
+   __atomic_store_n(&prev->next, cmd, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Take the oldest command from the queue.
+ * @return command, or NULL if the queue is empty or a push is
+ *         half-finished, in which case the command will be
+ *         available on a later call.
+ */
+static struct ti_render_cmd *queue_pop(void)
+{
+   struct ti_render_cmd *tail = g_render.tail;
+   struct ti_render_cmd *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+   if (tail == &g_render_stub)
+   {
+      if (!next)
+         return NULL;
+      g_render.tail = tail = next;
+      next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+   }
+
+   if (next)
+   {
+      g_render.tail = next;
+      return tail;
+   }
+
+   if (tail != __atomic_load_n(&g_render.head, __ATOMIC_ACQUIRE))
+      return NULL;
+
+   // Last real node: put the stub behind it so it can be removed
+   queue_push(&g_render_stub);
+   next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+   if (next)
+   {
+      g_render.tail = next;
+      return tail;
+   }
+
+   return NULL;
+}
+
+static void wake_render_thread(void)
+{
+   if (!__atomic_exchange_n(&g_render.signaled, 1, __ATOMIC_ACQ_REL))
+      sem_post(&g_render.wakeup);
+}
+
+static void apply_cmd(TI_SCREEN *scr, const struct ti_render_cmd *cmd)
+{
+   switch(cmd->type)
+   {
+      case TI_RENDER_TEXT:
+         ti_screen_put(scr, cmd->row, cmd->col, cmd->text, cmd->attr);
+         break;
+
+      case TI_RENDER_ATTR:
+         ti_screen_set_attr(scr, cmd->row, cmd->col, cmd->count, cmd->attr);
+         break;
+
+      case TI_RENDER_STATUS:
+      {
+         int row = scr->rows - 1;
+         int used = ti_screen_put(scr, row, 0, cmd->text, cmd->attr);
+         ti_screen_fill(scr, row, used, scr->cols - used, ' ', cmd->attr);
+         break;
+      }
+   }
+}
+
+static int drain_queue(void)
+{
+   struct ti_render_cmd *cmd;
+   int count = 0;
+
+   while ((cmd = queue_pop()))
+   {
+      apply_cmd(g_render.screen, cmd);
+      free(cmd);
+      ++count;
+   }
+
+   return count;
+}
+
+static void *render_thread(void *arg)
+{
+   while (__atomic_load_n(&g_render.running, __ATOMIC_ACQUIRE))
+   {
+      __atomic_store_n(&g_render.signaled, 0, __ATOMIC_RELEASE);
+      drain_queue();
+
+      int wait = ti_frame_poll(g_render.screen);
+      if (wait < 0)
+         sem_wait(&g_render.wakeup);
+      else
+      {
+         struct timespec ts;
+         clock_gettime(CLOCK_REALTIME, &ts);
+         ts.tv_sec += wait / 1000;
+         ts.tv_nsec += (long)(wait % 1000) * 1000000;
+         if (ts.tv_nsec >= 1000000000)
+         {
+            ++ts.tv_sec;
+            ts.tv_nsec -= 1000000000;
+         }
+         sem_timedwait(&g_render.wakeup, &ts);
+      }
+   }
+
+   // Show everything submitted before the stop
+   drain_queue();
+   ti_frame_present(g_render.screen);
+
+   return NULL;
+}
+
+/**
+ * @brief Start a thread to render @p scr.
+ *
+ * The screen must stay valid until @ref ti_render_stop returns.
+ *
+ * @param "scr"   screen initialized with @ref ti_screen_init
+ * @return 0 for success, otherwise errno.
+ */
+int ti_render_start(TI_SCREEN *scr)
+{
+   if (g_render.running)
+      return EBUSY;
+
+   if (sem_init(&g_render.wakeup, 0, 0))
+      return errno;
+
+   g_render.screen = scr;
+   g_render.signaled = 0;
+   g_render_stub.next = NULL;
+   g_render.head = g_render.tail = &g_render_stub;
+   g_render.running = 1;
+
+   int rval = pthread_create(&g_render.thread, NULL, render_thread, NULL);
+   if (rval)
+   {
+      g_render.running = 0;
+      sem_destroy(&g_render.wakeup);
+   }
+
+   return rval;
+}
+
+/**
+ * @brief Stop the render thread after it presents the submitted operations.
+ *
+ * Operations submitted after this call begins may be lost.
+ */
+void ti_render_stop(void)
+{
+   if (!g_render.running)
+      return;
+
+   __atomic_store_n(&g_render.running, 0, __ATOMIC_RELEASE);
+   sem_post(&g_render.wakeup);
+   pthread_join(g_render.thread, NULL);
+   sem_destroy(&g_render.wakeup);
+
+   // Discard anything pushed during the stop
+   struct ti_render_cmd *cmd;
+   while ((cmd = queue_pop()))
+      free(cmd);
+
+   g_render.screen = NULL;
+}
+
+static int submit(int type, int row, int col, int count, const char *text, unsigned short attr)
+{
+   size_t len = text ? strlen(text) : 0;
+   struct ti_render_cmd *cmd = (struct ti_render_cmd*)malloc(sizeof(struct ti_render_cmd) + len + 1);
+   if (!cmd)
+      return ENOMEM;
+
+   cmd->type = type;
+   cmd->row = row;
+   cmd->col = col;
+   cmd->count = count;
+   cmd->attr = attr;
+   memcpy(cmd->text, text ? text : "", len + 1);
+
+   queue_push(cmd);
+   wake_render_thread();
+   return 0;
+}
+
+/**
+ * @brief Submit text to be drawn at a position.  Safe from any thread.
+ * @param "row"    screen row
+ * @param "col"    screen column
+ * @param "text"   UTF-8 string, copied before returning
+ * @param "attr"   TI_ATTR_ flags
+ * @return 0 for success, otherwise errno.
+ */
+int ti_render_text(int row, int col, const char *text, unsigned short attr)
+{
+   return submit(TI_RENDER_TEXT, row, col, 0, text, attr);
+}
+
+/**
+ * @brief Submit a change of attributes for a span of cells, keeping
+ *        their characters.  Safe from any thread.
+ * @return 0 for success, otherwise errno.
+ */
+int ti_render_attr(int row, int col, int count, unsigned short attr)
+{
+   return submit(TI_RENDER_ATTR, row, col, count, NULL, attr);
+}
+
+/**
+ * @brief Submit a replacement for the bottom line of the screen.
+ *        Safe from any thread.
+ * @return 0 for success, otherwise errno.
+ */
+int ti_render_status(const char *text, unsigned short attr)
+{
+   return submit(TI_RENDER_STATUS, 0, 0, 0, text, attr);
+}
+
+// Hide debugging code from Doxygen
+/** @cond */
+
+#ifdef SL_RENDER_MAIN
+
+#include "sl_caps.c"
+#include "sl_ioctl.c"
+#include "sl_libcaps.c"
+#include "sl_output.c"
+#include "sl_screen.c"
+#include "sl_utf8.c"
+#include "sl_gcache.c"
+#include "sl_frame.c"
+#include "sl_record.c"
+
+#include <stdio.h>
+
+#define WORKERS 4
+
+void *worker(void *arg)
+{
+   int id = (int)(long)arg;
+   char buff[40];
+   for (int i=0; i<=200000; ++i)
+   {
+      snprintf(buff, sizeof(buff), "worker %d: %6d", id, i);
+      ti_render_text(2 + id, 4, buff, id % 2 ? TI_ATTR_BOLD : 0);
+   }
+   return NULL;
+}
+
+int main(int argc, const char **argv)
+{
+   TI_SCREEN screen;
+   pthread_t threads[WORKERS];
+   int rows, cols;
+
+   if (!TIV_setup(0, NULL))
+      return 1;
+
+   ti_get_screen_size(&rows, &cols);
+   if (ti_screen_init(&screen, rows, cols) == 0)
+   {
+      ti_render_start(&screen);
+      ti_render_status("Four workers drawing through the render thread", TI_ATTR_REVERSE);
+
+      for (long i=0; i<WORKERS; ++i)
+         pthread_create(&threads[i], NULL, worker, (void*)i);
+      for (int i=0; i<WORKERS; ++i)
+         pthread_join(threads[i], NULL);
+
+      ti_render_stop();
+      ti_screen_destroy(&screen);
+      printf("\n");
+   }
+
+   TIV_destroy_arrays(0, NULL);
+   return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/* Local Variables:          */
+/* compile-command:   "gcc  \*/
+/* -Wall -Werror -pedantic  \*/
+/* -ggdb -std=c99           \*/
+/* -DSL_RENDER_MAIN         \*/
+/* -fsanitize=address       \*/
+/* -pthread -ltinfo         \*/
+/* -o sl_render             \*/
+/* sl_render.c"              */
+/* End:                      */
@@ -0,0 +1,901 @@
+/**
+ * @file sl_screen.c
+ * @brief Double-buffered screen model with differential rendering.
+ *
+ * Applications draw into the back buffer of a @ref TI_SCREEN as often
+ * as they like.  Nothing is sent to the terminal until
+ * @ref ti_screen_render, which sends only the cells that differ from
+ * what the terminal already shows.  Many changes to the same cell
+ * between renders cost nothing more than the last one.
+ *
+ * @ref ti_screen_scroll moves part of the back buffer immediately and
+ * also records the scroll.  The render first tries to repeat it on the
+ * terminal with a scroll region (and left/right margins for partial
+ * widths) and shifts the front buffer to match, so only the exposed
+ * lines are sent.  Scrolls the terminal can't do are left to the
+ * differential render.
+ *
+ * Runs of the same character are sent with `repeat_char` when the
+ * terminal has it, and line-drawing characters are sent from the
+ * alternate character set when the terminal maps them in `acs_chars`,
+ * one byte each instead of three bytes of UTF-8.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "termintel.h"
+
+/**
+ * @brief Largest run of unchanged cells that is rewritten rather than
+ *        skipped with a cursor movement.  A `cup` sequence is typically
+ *        six to eight bytes.
+ */
+#define TI_SCREEN_MAX_GAP 4
+
+/**
+ * @brief Shortest run of identical cells sent with @ref ti_out_repeat.
+ */
+#define TI_SCREEN_MIN_RUN 8
+
+static const TI_CELL blank_cell = { ' ', 0 };
+
+// Front buffer cell whose content on the terminal is not known
+static const TI_CELL unknown_cell = { ' ', (unsigned short)~0 };
+
+static int cell_equal(const TI_CELL *left, const TI_CELL *right)
+{
+   return left->code == right->code && left->attr == right->attr;
+}
+
+static int same_attr(const TI_CELL *cells, int count, unsigned short attr)
+{
+   for (int i=0; i<count; ++i)
+      if (cells[i].attr != attr)
+         return 0;
+   return 1;
+}
+
+static void mark_row_dirty(TI_SCREEN *scr, int row)
+{
+   if (!scr->dirty[row])
+   {
+      scr->dirty[row] = 1;
+      ++scr->dirty_rows;
+   }
+}
+
+/**
+ * @brief Initialize a @ref TI_SCREEN, allocating its buffers.
+ *
+ * Both buffers start blank, and the screen is marked invalid so the
+ * first render will clear the terminal.
+ *
+ * @param "scr"    screen to initialize
+ * @param "rows"   number of rows, usually from @ref ti_get_screen_size
+ * @param "cols"   number of columns
+ * @return 0 for success, otherwise errno (EINVAL or ENOMEM).
+ */
+int ti_screen_init(TI_SCREEN *scr, int rows, int cols)
+{
+   memset(scr, 0, sizeof(TI_SCREEN));
+
+   if (rows <= 0 || cols <= 0)
+      return EINVAL;
+
+   size_t count = (size_t)rows * cols;
+   scr->front = (TI_CELL*)malloc(count * sizeof(TI_CELL));
+   scr->back = (TI_CELL*)malloc(count * sizeof(TI_CELL));
+   scr->dirty = (unsigned char*)calloc(rows, 1);
+   scr->gcache = ti_gcache_create();
+   if (!scr->front || !scr->back || !scr->dirty || !scr->gcache)
+   {
+      ti_screen_destroy(scr);
+      return ENOMEM;
+   }
+
+   scr->rows = rows;
+   scr->cols = cols;
+   scr->capacity = count;
+   scr->row_capacity = rows;
+   for (size_t i=0; i<count; ++i)
+      scr->front[i] = scr->back[i] = blank_cell;
+
+   scr->park_row = -1;
+   scr->use_acs = ti_out_acs_char(0x2500) != 0
+      && TIV_get_sequence(&caps_LIB[LIB_EXIT_ALT_CHARSET_MODE]) != NULL;
+   ti_screen_invalidate(scr);
+   return 0;
+}
+
+/**
+ * @brief Free the buffers of a @ref TI_SCREEN.
+ * @param "scr"   screen initialized with @ref ti_screen_init
+ */
+void ti_screen_destroy(TI_SCREEN *scr)
+{
+   free(scr->front);
+   free(scr->back);
+   free(scr->dirty);
+   ti_gcache_destroy(scr->gcache);
+   scr->front = scr->back = NULL;
+   scr->dirty = NULL;
+   scr->gcache = NULL;
+   scr->rows = scr->cols = 0;
+   scr->capacity = 0;
+   scr->row_capacity = 0;
+}
+
+/**
+ * @brief Columns a cell takes for @p code: 2 for wide characters and
+ *        clusters, otherwise 1.
+ */
+static int cell_width(const TI_SCREEN *scr, unsigned int code)
+{
+   if (code < 0x1100)
+      return 1;
+
+   int len, width;
+   if (code >= TI_CELL_CLUSTER)
+      return ti_gcache_cluster(scr->gcache, code, &len, &width) && width == 2 ? 2 : 1;
+
+   return ti_char_width(code) == 2 ? 2 : 1;
+}
+
+/**
+ * @brief Change the number of columns of the rows of a buffer, in place.
+ *
+ * Rows are moved so that none is overwritten before it is moved: from
+ * the last row when they get wider, from the first when narrower.
+ */
+static void restride(TI_CELL *cells, int rows, int old_cols, int new_cols,
+                     const TI_CELL *fill)
+{
+   int keep = old_cols < new_cols ? old_cols : new_cols;
+
+   if (new_cols > old_cols)
+   {
+      for (int row=rows-1; row>=0; --row)
+      {
+         memmove(&cells[row * new_cols], &cells[row * old_cols], keep * sizeof(TI_CELL));
+         for (int col=keep; col<new_cols; ++col)
+            cells[row * new_cols + col] = *fill;
+      }
+   }
+   else if (new_cols < old_cols)
+   {
+      for (int row=0; row<rows; ++row)
+         memmove(&cells[row * new_cols], &cells[row * old_cols], keep * sizeof(TI_CELL));
+   }
+}
+
+/**
+ * @brief Resize a @ref TI_SCREEN, keeping what fits of its content.
+ *
+ * Cells keep their rows and columns.  Rows and columns beyond the new
+ * size are dropped, and new ones are blank.  The buffers are only
+ * reallocated when they grow beyond their largest size so far.
+ *
+ * The terminal is assumed to keep its content in place too, which
+ * terminals do with the alternate screen, so the next render sends
+ * only the exposed rows and columns.  If the terminal may have moved
+ * its content, follow with @ref ti_screen_invalidate.
+ *
+ * @param "scr"    screen to resize
+ * @param "rows"   new number of rows
+ * @param "cols"   new number of columns
+ * @return 0 for success, otherwise errno (EINVAL or ENOMEM), and the
+ *         screen is unchanged.
+ */
+int ti_screen_resize(TI_SCREEN *scr, int rows, int cols)
+{
+   if (rows <= 0 || cols <= 0)
+      return EINVAL;
+   if (rows == scr->rows && cols == scr->cols)
+      return 0;
+
+   size_t count = (size_t)rows * cols;
+   if (count > scr->capacity)
+   {
+      TI_CELL *front = (TI_CELL*)realloc(scr->front, count * sizeof(TI_CELL));
+      if (!front)
+         return ENOMEM;
+      scr->front = front;
+
+      TI_CELL *back = (TI_CELL*)realloc(scr->back, count * sizeof(TI_CELL));
+      if (!back)
+         return ENOMEM;
+      scr->back = back;
+      scr->capacity = count;
+   }
+
+   if (rows > scr->row_capacity)
+   {
+      unsigned char *dirty = (unsigned char*)realloc(scr->dirty, rows);
+      if (!dirty)
+         return ENOMEM;
+      scr->dirty = dirty;
+      scr->row_capacity = rows;
+   }
+
+   // Rows past the old bottom are new, and the front buffer doesn't know them
+   int kept_rows = rows < scr->rows ? rows : scr->rows;
+   restride(scr->front, kept_rows, scr->cols, cols, &unknown_cell);
+   restride(scr->back, kept_rows, scr->cols, cols, &blank_cell);
+   for (size_t i=(size_t)kept_rows * cols; i<count; ++i)
+   {
+      scr->front[i] = unknown_cell;
+      scr->back[i] = blank_cell;
+   }
+
+   int old_cols = scr->cols;
+   scr->rows = rows;
+   scr->cols = cols;
+
+   // Keep the changes waiting in rows that remain
+   scr->dirty_rows = 0;
+   for (int row=0; row<rows; ++row)
+   {
+      if (row >= kept_rows)
+         scr->dirty[row] = 0;
+      else if (scr->dirty[row])
+         ++scr->dirty_rows;
+
+      // A wide character cut in half by the new right edge
+      TI_CELL *last = &scr->back[row * cols + cols - 1];
+      if (cols < old_cols && cell_width(scr, last->code) == 2)
+      {
+         *last = blank_cell;
+         scr->front[row * cols + cols - 1] = unknown_cell;
+         mark_row_dirty(scr, row);
+      }
+
+      if (row >= kept_rows || cols > old_cols)
+         mark_row_dirty(scr, row);
+   }
+
+   // Pending scrolls were planned for the old size, leave them to the render
+   scr->scroll_count = 0;
+   scr->cur_row = scr->cur_col = -1;
+   if (scr->park_row >= rows)
+      scr->park_row = rows - 1;
+   if (scr->park_col >= cols)
+      scr->park_col = cols - 1;
+
+   return 0;
+}
+
+/**
+ * @brief Blank the back buffer.
+ */
+void ti_screen_clear(TI_SCREEN *scr)
+{
+   for (int row=0; row<scr->rows; ++row)
+      ti_screen_fill(scr, row, 0, scr->cols, ' ', 0);
+}
+
+/**
+ * @brief Forget what the terminal shows so the next render repaints everything.
+ *
+ * Use after something other than the screen has written to the
+ * terminal, or when output may have been lost.
+ */
+void ti_screen_invalidate(TI_SCREEN *scr)
+{
+   scr->invalid = 1;
+   scr->cur_row = scr->cur_col = -1;
+   scr->cur_attr = (unsigned short)~0;
+   scr->cur_acs = -1;
+}
+
+static void store_cell(TI_SCREEN *scr, int row, int col, unsigned int code, unsigned short attr)
+{
+   TI_CELL *cell = &scr->back[row * scr->cols + col];
+   if (cell->code != code || cell->attr != attr)
+   {
+      cell->code = code;
+      cell->attr = attr;
+      mark_row_dirty(scr, row);
+   }
+}
+
+/**
+ * @brief Set one cell of the back buffer.
+ *
+ * A wide character also takes the next cell, which is set to
+ * @ref TI_CELL_WIDE_TAIL.  A wide character that doesn't fit at the
+ * right edge is replaced by a space.  Overwriting either half of a
+ * wide character blanks the other half.
+ *
+ * Positions outside the screen are ignored.
+ */
+void ti_screen_set_cell(TI_SCREEN *scr, int row, int col, unsigned int code, unsigned short attr)
+{
+   if (row < 0 || row >= scr->rows || col < 0 || col >= scr->cols)
+      return;
+
+   TI_CELL *cells = &scr->back[row * scr->cols];
+   int width = cell_width(scr, code);
+   if (col + width > scr->cols)
+   {
+      code = ' ';
+      width = 1;
+   }
+
+   // Don't leave half of a wide character
+   if (col > 0 && cells[col].code == TI_CELL_WIDE_TAIL)
+      store_cell(scr, row, col - 1, ' ', cells[col - 1].attr);
+   int after = col + width;
+   if (after < scr->cols && cells[after].code == TI_CELL_WIDE_TAIL)
+      store_cell(scr, row, after, ' ', cells[after].attr);
+
+   store_cell(scr, row, col, code, attr);
+   if (width == 2)
+      store_cell(scr, row, col + 1, TI_CELL_WIDE_TAIL, attr);
+}
+
+/**
+ * @brief Set @p count cells of a row to the same character and attributes.
+ *
+ * The run is clipped to the row.
+ */
+void ti_screen_fill(TI_SCREEN *scr, int row, int col, int count, unsigned int code, unsigned short attr)
+{
+   if (row < 0 || row >= scr->rows)
+      return;
+
+   if (col < 0)
+   {
+      count += col;
+      col = 0;
+   }
+   if (col + count > scr->cols)
+      count = scr->cols - col;
+
+   int width = cell_width(scr, code);
+   for (int i=0; i<count; i += width)
+      ti_screen_set_cell(scr, row, col + i, code, attr);
+}
+
+/**
+ * @brief Change the attributes of @p count cells of a row, leaving
+ *        the characters as they are.
+ *
+ * A wide character cut by either end of the run changes as a whole,
+ * so that its tail keeps the attributes of its head.  The run is
+ * clipped to the row.
+ */
+void ti_screen_set_attr(TI_SCREEN *scr, int row, int col, int count, unsigned short attr)
+{
+   if (row < 0 || row >= scr->rows)
+      return;
+
+   int end = col + count;
+   if (col < 0)
+      col = 0;
+   if (end > scr->cols)
+      end = scr->cols;
+
+   TI_CELL *cells = &scr->back[row * scr->cols];
+   if (col > 0 && col < end && cells[col].code == TI_CELL_WIDE_TAIL)
+      --col;
+   if (end > col && end < scr->cols && cells[end].code == TI_CELL_WIDE_TAIL)
+      ++end;
+
+   for (; col < end; ++col)
+      store_cell(scr, row, col, cells[col].code, attr);
+}
+
+/**
+ * @brief Write a UTF-8 string into the back buffer.
+ *
+ * Text is clipped at the right edge.  Control characters are shown
+ * as `?`.  Each grapheme cluster takes one cell, or two for wide
+ * clusters, and the measurements are kept in the screen's
+ * @ref TI_GCACHE so drawing the same string again is cheap.
+ *
+ * @param "scr"    screen to draw on
+ * @param "row"    row of first character
+ * @param "col"    column of first character
+ * @param "str"    NULL-terminated UTF-8 string
+ * @param "attr"   TI_ATTR_ flags for the text
+ * @return number of columns written.
+ */
+int ti_screen_put(TI_SCREEN *scr, int row, int col, const char *str, unsigned short attr)
+{
+   return ti_screen_put_span(scr, row, col, scr->cols - col, str, attr);
+}
+
+/**
+ * @brief Write a UTF-8 string into at most @p width columns of the back buffer.
+ *
+ * Like @ref ti_screen_put, but clipped to @p width columns as well as
+ * to the right edge.
+ *
+ * @return number of columns written.
+ */
+int ti_screen_put_span(TI_SCREEN *scr, int row, int col, int width, const char *str, unsigned short attr)
+{
+   int start = col;
+   int end = col + width < scr->cols ? col + width : scr->cols;
+   size_t len = strlen(str);
+   TI_LAYOUT layout;
+
+   if (ti_gcache_layout(scr->gcache, str, len, &layout) == 0)
+   {
+      for (int i=0; i<layout.count && col < end; ++i)
+      {
+         const TI_CLUSTER *cluster = &layout.clusters[i];
+         if (col + cluster->width > end)
+            break;
+
+         ti_screen_set_cell(scr, row, col, cluster->code, attr);
+         col += cluster->width;
+      }
+   }
+   else
+   {
+      // Too long to cache: segment as we go
+      size_t pos = 0;
+      while (pos < len && col < end)
+      {
+         int cols;
+         int bytes = ti_grapheme_next(str + pos, len - pos, &cols);
+         unsigned int code = '?';
+         if (cols < 0)
+            cols = 1;
+         else
+            code = ti_gcache_intern(scr->gcache, str + pos, bytes, cols);
+
+         if (col + cols > end)
+            break;
+
+         ti_screen_set_cell(scr, row, col, code, attr);
+         col += cols;
+         pos += bytes;
+      }
+   }
+
+   return col - start;
+}
+
+/**
+ * @brief Set where the cursor is left after each render.
+ * @param "row"   row of cursor, or -1 to leave it where the render ends
+ * @param "col"   column of cursor
+ */
+void ti_screen_park_cursor(TI_SCREEN *scr, int row, int col)
+{
+   scr->park_row = row;
+   scr->park_col = col;
+}
+
+/**
+ * @brief Shift the cells of a rectangle of @p cells up by @p count rows,
+ *        or down if @p count is negative, filling exposed rows with blanks.
+ */
+static void shift_rect(TI_SCREEN *scr, TI_CELL *cells, const TI_SCROLL_OP *op)
+{
+   int width = op->right - op->left + 1;
+   int count = op->count;
+   size_t rowbytes = width * sizeof(TI_CELL);
+
+   if (count > 0)
+   {
+      for (int row=op->top; row<=op->bottom; ++row)
+      {
+         TI_CELL *target = &cells[row * scr->cols + op->left];
+         if (row + count <= op->bottom)
+            memcpy(target, &cells[(row + count) * scr->cols + op->left], rowbytes);
+         else
+            for (int col=0; col<width; ++col)
+               target[col] = blank_cell;
+      }
+   }
+   else if (count < 0)
+   {
+      count = -count;
+      for (int row=op->bottom; row>=op->top; --row)
+      {
+         TI_CELL *target = &cells[row * scr->cols + op->left];
+         if (row - count >= op->top)
+            memcpy(target, &cells[(row - count) * scr->cols + op->left], rowbytes);
+         else
+            for (int col=0; col<width; ++col)
+               target[col] = blank_cell;
+      }
+   }
+}
+
+/**
+ * @brief Scroll a rectangle of the back buffer.
+ *
+ * Exposed rows are blank.  The scroll is remembered so that
+ * @ref ti_screen_render can repeat it on the terminal rather than
+ * resend the rectangle.  Consecutive scrolls of the same rectangle
+ * are combined.
+ *
+ * @param "scr"      screen to change
+ * @param "top"      first row of the rectangle
+ * @param "bottom"   last row of the rectangle
+ * @param "left"     first column of the rectangle
+ * @param "right"    last column of the rectangle
+ * @param "count"    lines to scroll up, negative to scroll down
+ */
+void ti_screen_scroll(TI_SCREEN *scr, int top, int bottom, int left, int right, int count)
+{
+   if (top < 0)
+      top = 0;
+   if (left < 0)
+      left = 0;
+   if (bottom >= scr->rows)
+      bottom = scr->rows - 1;
+   if (right >= scr->cols)
+      right = scr->cols - 1;
+   if (count == 0 || top > bottom || left > right)
+      return;
+
+   TI_SCROLL_OP op = { top, bottom, left, right, count };
+   shift_rect(scr, scr->back, &op);
+   for (int row=top; row<=bottom; ++row)
+      mark_row_dirty(scr, row);
+
+   TI_SCROLL_OP *last = scr->scroll_count ? &scr->scrolls[scr->scroll_count-1] : NULL;
+   if (last && last->top == top && last->bottom == bottom
+       && last->left == left && last->right == right
+       && (last->count > 0) == (count > 0))
+      last->count += count;
+   else if (scr->scroll_count < TI_SCREEN_MAX_SCROLLS)
+      scr->scrolls[scr->scroll_count++] = op;
+   // Otherwise, the differential render will repaint the rectangle
+}
+
+static void move_to(TI_SCREEN *scr, int row, int col)
+{
+   if (scr->cur_row != row || scr->cur_col != col)
+   {
+      ti_lib_move(scr->cur_row, scr->cur_col, row, col);
+      scr->cur_row = row;
+      scr->cur_col = col;
+   }
+}
+
+/**
+ * @brief Send the sequences to change terminal attributes.
+ * @param "current"   attributes in effect, or ~0 if unknown
+ * @param "attr"      TI_ATTR_ flags wanted
+ * @return @p attr, the attributes now in effect.
+ */
+unsigned short ti_out_attr(unsigned short current, unsigned short attr)
+{
+   static const struct { unsigned short flag; int index; } attr_caps[] = {
+      { TI_ATTR_BOLD,      LIB_ENTER_BOLD_MODE },
+      { TI_ATTR_DIM,       LIB_ENTER_DIM_MODE },
+      { TI_ATTR_UNDERLINE, LIB_ENTER_UNDERLINE_MODE },
+      { TI_ATTR_REVERSE,   LIB_ENTER_REVERSE_MODE },
+      { TI_ATTR_STANDOUT,  LIB_ENTER_STANDOUT_MODE }
+   };
+
+   if (attr == current)
+      return attr;
+
+   // Attributes can only be turned off all together
+   if (current & ~attr)
+   {
+      TIV_execute(caps_LIB, LIB_EXIT_ATTRIBUTE_MODE);
+      current = 0;
+   }
+
+   for (int i=0; i<(int)(sizeof(attr_caps)/sizeof(attr_caps[0])); ++i)
+      if ((attr & attr_caps[i].flag) && !(current & attr_caps[i].flag))
+         TIV_execute(caps_LIB, attr_caps[i].index);
+
+   return attr;
+}
+
+static void set_attr(TI_SCREEN *scr, unsigned short attr)
+{
+   // Many terminals leave the alternate character set with exit_attribute_mode
+   if (scr->use_acs && scr->cur_acs != 0 && (scr->cur_attr & ~attr))
+   {
+      const char *sgr0 = TIV_get_sequence(&caps_LIB[LIB_EXIT_ATTRIBUTE_MODE]);
+      const char *rmacs = TIV_get_sequence(&caps_LIB[LIB_EXIT_ALT_CHARSET_MODE]);
+      scr->cur_acs = sgr0 && strstr(sgr0, rmacs) ? 0 : -1;
+   }
+
+   scr->cur_attr = ti_out_attr(scr->cur_attr, attr);
+}
+
+/**
+ * @brief Switch the alternate character set on or off if it isn't already.
+ */
+static void set_acs(TI_SCREEN *scr, int on)
+{
+   if (scr->cur_acs != on)
+   {
+      TIV_execute(caps_LIB, on ? LIB_ENTER_ALT_CHARSET_MODE : LIB_EXIT_ALT_CHARSET_MODE);
+      scr->cur_acs = on;
+   }
+}
+
+/**
+ * @brief Find the byte to send for a character from the alternate
+ *        character set.
+ * @return the byte, or 0 if @p code is sent as itself.
+ */
+static int acs_byte(const TI_SCREEN *scr, unsigned int code)
+{
+   return scr->use_acs && code >= 0x80 ? ti_out_acs_char(code) : 0;
+}
+
+/**
+ * @brief Repeat a recorded scroll on the terminal.
+ * @return 1 if the terminal scrolled, 0 if it can't.
+ */
+static int hardware_scroll(TI_SCREEN *scr, const TI_SCROLL_OP *op)
+{
+   int full_width = op->left == 0 && op->right == scr->cols - 1;
+   int count = op->count > 0 ? op->count : -op->count;
+
+   if (count >= op->bottom - op->top + 1)
+      return 0;
+   if (!TIV_get_sequence(&caps_LIB[LIB_CHANGE_SCROLL_REGION]))
+      return 0;
+   if (!full_width && (!TIV_get_sequence(&caps_LIB[LIB_SET_LR_MARGIN])
+                       || !TIV_get_sequence(&caps_LIB[LIB_CLEAR_MARGINS])))
+      return 0;
+
+   if (ti_lib_scroll_cost(op->count) < 0)
+      return 0;
+
+   // Exposed lines take the current background
+   set_attr(scr, 0);
+
+   TIV_execute_params(caps_LIB, LIB_CHANGE_SCROLL_REGION, op->top, op->bottom);
+   if (!full_width)
+      TIV_execute_params(caps_LIB, LIB_SET_LR_MARGIN, op->left, op->right);
+
+   // Setting the scroll region moves the cursor
+   scr->cur_row = scr->cur_col = -1;
+   move_to(scr, op->count > 0 ? op->bottom : op->top, op->left);
+
+   ti_lib_scroll(op->count);
+
+   if (!full_width)
+      TIV_execute(caps_LIB, LIB_CLEAR_MARGINS);
+   TIV_execute_params(caps_LIB, LIB_CHANGE_SCROLL_REGION, 0, scr->rows - 1);
+   scr->cur_row = scr->cur_col = -1;
+
+   return 1;
+}
+
+/**
+ * @brief Send recorded scrolls the terminal can do, shifting the front
+ *        buffer to match what the terminal now shows.
+ */
+static void apply_scrolls(TI_SCREEN *scr)
+{
+   for (int i=0; i<scr->scroll_count; ++i)
+   {
+      const TI_SCROLL_OP *op = &scr->scrolls[i];
+      if (hardware_scroll(scr, op))
+         shift_rect(scr, scr->front, op);
+   }
+
+   scr->scroll_count = 0;
+}
+
+/**
+ * @brief Emit cell @p col of a row, updating the terminal state.
+ * @return number of columns written, 2 for a wide character.
+ */
+static int emit_cell(TI_SCREEN *scr, int row, int col)
+{
+   TI_CELL *back = &scr->back[row * scr->cols + col];
+   TI_CELL *front = &scr->front[row * scr->cols + col];
+   int width = 1;
+
+   set_attr(scr, back->attr);
+
+   int len;
+   int acs = acs_byte(scr, back->code);
+   const char *cluster = ti_gcache_cluster(scr->gcache, back->code, &len, NULL);
+   if (acs)
+   {
+      set_acs(scr, 1);
+      ti_out_putc(acs);
+   }
+   else
+   {
+      if (scr->use_acs)
+         set_acs(scr, 0);
+      if (cluster)
+         ti_out_write(cluster, len);
+      else
+         ti_out_code(back->code);
+   }
+
+   front[0] = back[0];
+
+   if (col + 1 < scr->cols && back[1].code == TI_CELL_WIDE_TAIL)
+   {
+      front[1] = back[1];
+      width = 2;
+   }
+
+   // Cursor position is uncertain after writing to the last column
+   scr->cur_col += width;
+   if (scr->cur_col >= scr->cols)
+      scr->cur_row = scr->cur_col = -1;
+
+   return width;
+}
+
+/**
+ * @brief Count the cells from @p col that match it, if they can be
+ *        sent as one repeated character.
+ * @return length of the run, or 0 if the cell can't be repeated.
+ */
+static int run_length(const TI_SCREEN *scr, const TI_CELL *back, int col, int limit)
+{
+   unsigned int code = back[col].code;
+   if (!(code >= 0x20 && code < 0x7F) && !acs_byte(scr, code))
+      return 0;
+
+   int end = col + 1;
+   while (end < limit && cell_equal(&back[end], &back[col]))
+      ++end;
+
+   return end - col;
+}
+
+/**
+ * @brief Send a run of identical cells with @ref ti_out_repeat.
+ */
+static void emit_run(TI_SCREEN *scr, int row, int col, int count)
+{
+   TI_CELL *back = &scr->back[row * scr->cols + col];
+   TI_CELL *front = &scr->front[row * scr->cols + col];
+
+   set_attr(scr, back->attr);
+
+   int acs = acs_byte(scr, back->code);
+   if (scr->use_acs)
+      set_acs(scr, acs != 0);
+   ti_out_repeat(acs ? (unsigned int)acs : back->code, count);
+
+   for (int i=0; i<count; ++i)
+      front[i] = back[i];
+
+   scr->cur_col += count;
+   if (scr->cur_col >= scr->cols)
+      scr->cur_row = scr->cur_col = -1;
+}
+
+/**
+ * @brief Send the changes in one row.
+ */
+static int render_row(TI_SCREEN *scr, int row)
+{
+   TI_CELL *front = &scr->front[row * scr->cols];
+   TI_CELL *back = &scr->back[row * scr->cols];
+   int changed = 0;
+
+   // Writing the bottom-right cell would scroll terminals with automatic margins
+   int limit = row == scr->rows - 1 ? scr->cols - 1 : scr->cols;
+
+   // Find where the blank tail of the back row starts, to use clr_eol
+   int tail = limit;
+   while (tail > 0 && cell_equal(&back[tail-1], &blank_cell))
+      --tail;
+
+   int tail_changes = 0;
+   for (int col=tail; col<limit; ++col)
+      if (!cell_equal(&front[col], &back[col]))
+         ++tail_changes;
+
+   int use_eol = tail_changes > TI_SCREEN_MAX_GAP && TIV_get_sequence(&caps_LIB[LIB_CLR_EOL]);
+   if (use_eol)
+      limit = tail;
+
+   for (int col=0; col<limit; ++col)
+   {
+      // The right half of a wide character is sent with its left half
+      if (cell_equal(&front[col], &back[col]) || back[col].code == TI_CELL_WIDE_TAIL)
+         continue;
+
+      int gap = col - scr->cur_col;
+      if (scr->cur_row == row && gap > 0 && gap <= TI_SCREEN_MAX_GAP
+          && same_attr(&back[scr->cur_col], gap, back[col].attr))
+      {
+         // Rewriting a few unchanged cells is cheaper than moving
+         for (int i=scr->cur_col; i<col; )
+            i += emit_cell(scr, row, i);
+      }
+      else
+         move_to(scr, row, col);
+
+      int run = run_length(scr, back, col, limit);
+      if (run >= TI_SCREEN_MIN_RUN)
+      {
+         emit_run(scr, row, col, run);
+         changed += run;
+         col += run - 1;
+         continue;
+      }
+
+      emit_cell(scr, row, col);
+      ++changed;
+   }
+
+   if (use_eol)
+   {
+      move_to(scr, row, tail);
+      set_attr(scr, 0);
+      TIV_execute(caps_LIB, LIB_CLR_EOL);
+      for (int col=tail; col<scr->cols; ++col)
+         front[col] = blank_cell;
+      changed += tail_changes;
+   }
+
+   return changed;
+}
+
+/**
+ * @brief Send the differences between the back and front buffers to the terminal.
+ *
+ * All output for the render is collected between @ref ti_out_begin
+ * and @ref ti_out_end so it leaves the process in one write.
+ * Attributes are reset at the end so text printed by other means is
+ * not affected.
+ *
+ * @param "scr"   screen to render
+ * @return number of cells sent.
+ */
+int ti_screen_render(TI_SCREEN *scr)
+{
+   int changed = 0;
+
+   ti_out_begin();
+
+   if (scr->invalid)
+   {
+      TIV_execute(caps_LIB, LIB_EXIT_ATTRIBUTE_MODE);
+      TIV_execute(caps_LIB, LIB_CLEAR_SCREEN);
+      scr->cur_attr = 0;
+      scr->cur_row = scr->cur_col = 0;
+
+      int count = scr->rows * scr->cols;
+      for (int i=0; i<count; ++i)
+         scr->front[i] = blank_cell;
+      for (int row=0; row<scr->rows; ++row)
+         mark_row_dirty(scr, row);
+
+      scr->invalid = 0;
+      scr->scroll_count = 0;
+   }
+   else if (scr->scroll_count)
+      apply_scrolls(scr);
+
+   for (int row=0; row<scr->rows && scr->dirty_rows; ++row)
+   {
+      if (scr->dirty[row])
+      {
+         changed += render_row(scr, row);
+         scr->dirty[row] = 0;
+         --scr->dirty_rows;
+      }
+   }
+
+   set_attr(scr, 0);
+   if (scr->use_acs)
+      set_acs(scr, 0);
+
+   if (scr->park_row >= 0)
+      move_to(scr, scr->park_row, scr->park_col);
+
+   ti_out_end();
+
+   return changed;
+}
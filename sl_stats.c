@@ -0,0 +1,361 @@
+/**
+ * @file sl_stats.c
+ * @brief Counters of terminal I/O and capability use.
+ *
+ * When the library is built with `make STATS=1` (-DTI_WITH_STATS), it
+ * counts its system calls, the bytes it writes and reads, the output
+ * flushed per frame, and how often each capability is executed with
+ * the bytes each produced.  Without the flag, the counting macros in
+ * termintel.h compile to nothing.
+ *
+ * Read the counters with @ref ti_stats_get and
+ * @ref ti_stats_get_caps, or set `TERMINTEL_STATS` in the environment
+ * to have them written when the program exits: to stderr if the value
+ * is `1`, otherwise appended to the file it names.
+ *
+ * Counters are updated atomically, so output from a render thread is
+ * counted too.  The dump includes the latency histograms of
+ * sl_trace.c.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "termintel.h"
+
+/** @brief Most capabilities counted, a power of two */
+#define TI_STATS_MAX_CAPS 256
+
+#ifdef TI_WITH_STATS
+
+static long long g_counts[TI_STAT_END];
+
+static struct cap_entry {
+   const TIV *cap;
+   int index;
+   char code[3];
+   long long executes;
+   long long bytes;
+} g_caps[TI_STATS_MAX_CAPS];
+
+static const char *g_dump_path = NULL;
+
+/**
+ * @brief Add to a counter.
+ * @param "counter"   enum ti_stat index
+ * @param "amount"    amount to add
+ */
+void ti_stats_add(int counter, long long amount)
+{
+   __atomic_fetch_add(&g_counts[counter], amount, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Count a flush of the output buffer.
+ */
+void ti_stats_frame(size_t bytes)
+{
+   long long size = (long long)bytes;
+
+   __atomic_fetch_add(&g_counts[TI_STAT_FRAMES], 1, __ATOMIC_RELAXED);
+   __atomic_fetch_add(&g_counts[TI_STAT_FRAME_BYTES], size, __ATOMIC_RELAXED);
+
+   long long max = __atomic_load_n(&g_counts[TI_STAT_MAX_FRAME_BYTES], __ATOMIC_RELAXED);
+   while (size > max
+          && !__atomic_compare_exchange_n(&g_counts[TI_STAT_MAX_FRAME_BYTES], &max, size,
+                                          1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      ;
+}
+
+/**
+ * @brief Find or claim the entry of a capability.
+ * @return the entry, or NULL if the table is full.
+ */
+static struct cap_entry *find_cap(const TIV *cap, int claim)
+{
+   size_t slot = ((size_t)cap / sizeof(TIV)) & (TI_STATS_MAX_CAPS - 1);
+
+   for (int i=0; i<TI_STATS_MAX_CAPS; ++i)
+   {
+      struct cap_entry *entry = &g_caps[slot];
+      const TIV *current = __atomic_load_n(&entry->cap, __ATOMIC_ACQUIRE);
+      if (current == cap)
+         return entry;
+
+      if (!current)
+      {
+         if (!claim)
+            return NULL;
+
+         if (__atomic_compare_exchange_n(&entry->cap, &current, cap,
+                                         0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+         {
+            // Kept in case the TIV array is gone when the counts are read
+            entry->index = cap->index;
+            memcpy(entry->code, cap->code, 2);
+            return entry;
+         }
+         if (current == cap)
+            return entry;
+      }
+
+      slot = (slot + 1) & (TI_STATS_MAX_CAPS - 1);
+   }
+
+   return NULL;
+}
+
+/**
+ * @brief Count an execution of a capability.
+ * @param "cap"     element executed
+ * @param "bytes"   length of the sequence sent
+ */
+void ti_stats_cap(const TIV *cap, size_t bytes)
+{
+   struct cap_entry *entry = find_cap(cap, 1);
+   if (entry)
+   {
+      __atomic_fetch_add(&entry->executes, 1, __ATOMIC_RELAXED);
+      __atomic_fetch_add(&entry->bytes, (long long)bytes, __ATOMIC_RELAXED);
+   }
+}
+
+static void copy_entry(TI_CAP_STATS *stats, struct cap_entry *entry)
+{
+   stats->cap = entry->cap;
+   stats->index = entry->index;
+   memcpy(stats->code, entry->code, 3);
+   stats->executes = __atomic_load_n(&entry->executes, __ATOMIC_RELAXED);
+   stats->bytes = __atomic_load_n(&entry->bytes, __ATOMIC_RELAXED);
+}
+
+static void dump_at_exit(void)
+{
+   int fd = STDERR_FILENO;
+
+   if (strcmp(g_dump_path, "1") != 0)
+   {
+      fd = open(g_dump_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+      if (fd < 0)
+         return;
+   }
+
+   ti_stats_dump(fd);
+
+   if (fd != STDERR_FILENO)
+      close(fd);
+}
+
+#endif  // TI_WITH_STATS
+
+/**
+ * @brief Arrange for the counters to be written at exit if
+ *        `TERMINTEL_STATS` is set.
+ *
+ * Called by @ref TIV_setup.  Later calls do nothing.
+ */
+void ti_stats_init(void)
+{
+#ifdef TI_WITH_STATS
+   const char *path = getenv("TERMINTEL_STATS");
+   if (!g_dump_path && path && *path)
+   {
+      g_dump_path = path;
+      atexit(dump_at_exit);
+   }
+#endif
+}
+
+/**
+ * @brief Copy the counters.
+ * @param "stats"   set to the counters, zeros if counting is compiled out
+ * @return 0 for success, otherwise ENOTSUP.
+ */
+int ti_stats_get(TI_STATS *stats)
+{
+   memset(stats, 0, sizeof(TI_STATS));
+
+#ifdef TI_WITH_STATS
+   for (int i=0; i<TI_STAT_END; ++i)
+      stats->counts[i] = __atomic_load_n(&g_counts[i], __ATOMIC_RELAXED);
+   return 0;
+#else
+   return ENOTSUP;
+#endif
+}
+
+/**
+ * @brief Copy the counts of the capabilities executed so far.
+ * @param "caps"   array to fill
+ * @param "max"    number of elements of @p caps
+ * @return number of elements filled.
+ */
+int ti_stats_get_caps(TI_CAP_STATS *caps, int max)
+{
+   int count = 0;
+
+#ifdef TI_WITH_STATS
+   for (int i=0; i<TI_STATS_MAX_CAPS && count<max; ++i)
+      if (__atomic_load_n(&g_caps[i].cap, __ATOMIC_ACQUIRE))
+         copy_entry(&caps[count++], &g_caps[i]);
+#endif
+
+   return count;
+}
+
+/**
+ * @brief Copy the counts of one capability.
+ *
+ * For example, `ti_stats_get_cap(caps_CONTROL, CONTROL_CURSOR_ADDRESS, &stats)`
+ * with a capset generated by `ti_create_capset_code.sh`.
+ *
+ * @param "tiv"     capset array
+ * @param "index"   index of the capability in @p tiv
+ * @param "stats"   set to the counts, zeros if never executed
+ * @return 0 for success, otherwise ENOTSUP.
+ */
+int ti_stats_get_cap(const TIV *tiv, int index, TI_CAP_STATS *stats)
+{
+   memset(stats, 0, sizeof(TI_CAP_STATS));
+   stats->cap = &tiv[index];
+   stats->index = index;
+   memcpy(stats->code, tiv[index].code, 2);
+
+#ifdef TI_WITH_STATS
+   struct cap_entry *entry = find_cap(&tiv[index], 0);
+   if (entry)
+      copy_entry(stats, entry);
+   return 0;
+#else
+   return ENOTSUP;
+#endif
+}
+
+/**
+ * @brief Set all counters back to zero.
+ */
+void ti_stats_reset(void)
+{
+#ifdef TI_WITH_STATS
+   for (int i=0; i<TI_STAT_END; ++i)
+      __atomic_store_n(&g_counts[i], 0, __ATOMIC_RELAXED);
+   for (int i=0; i<TI_STATS_MAX_CAPS; ++i)
+   {
+      __atomic_store_n(&g_caps[i].executes, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&g_caps[i].bytes, 0, __ATOMIC_RELAXED);
+   }
+#endif
+}
+
+static int compare_bytes(const void *left, const void *right)
+{
+   long long lbytes = ((const TI_CAP_STATS*)left)->bytes;
+   long long rbytes = ((const TI_CAP_STATS*)right)->bytes;
+   return (lbytes < rbytes) - (lbytes > rbytes);
+}
+
+/**
+ * @brief Write the counters as text, capabilities with the most
+ *        output first.
+ * @param "fd"   file descriptor to write to
+ */
+void ti_stats_dump(int fd)
+{
+   static const char *names[TI_STAT_END] = {
+      "write calls", "write bytes", "read calls", "read bytes",
+      "tcsetattr calls", "ioctl calls", "tiparm calls",
+      "frames", "frame bytes", "largest frame"
+   };
+   static TI_CAP_STATS caps[TI_STATS_MAX_CAPS];
+   TI_STATS stats;
+
+   if (ti_stats_get(&stats))
+   {
+      dprintf(fd, "termintel: built without TI_WITH_STATS\n");
+      return;
+   }
+
+   dprintf(fd, "termintel stats (pid %d)\n", (int)getpid());
+   for (int i=0; i<TI_STAT_END; ++i)
+      dprintf(fd, "  %-16s %12lld\n", names[i], stats.counts[i]);
+
+   if (stats.counts[TI_STAT_FRAMES])
+      dprintf(fd, "  %-16s %12lld\n", "bytes per frame",
+              stats.counts[TI_STAT_FRAME_BYTES] / stats.counts[TI_STAT_FRAMES]);
+
+   int count = ti_stats_get_caps(caps, TI_STATS_MAX_CAPS);
+   qsort(caps, count, sizeof(TI_CAP_STATS), compare_bytes);
+
+   dprintf(fd, "  %-4s %5s %12s %12s\n", "cap", "index", "executes", "bytes");
+   for (int i=0; i<count; ++i)
+      dprintf(fd, "  %-4s %5d %12lld %12lld\n",
+              caps[i].code, caps[i].index, caps[i].executes, caps[i].bytes);
+
+   ti_trace_dump(fd);
+}
+
+// Hide debugging code from Doxygen
+/** @cond */
+
+#ifdef SL_STATS_MAIN
+
+#include "sl_caps.c"
+#include "sl_ioctl.c"
+#include "sl_libcaps.c"
+#include "sl_output.c"
+#include "sl_screen.c"
+#include "sl_utf8.c"
+#include "sl_gcache.c"
+#include "sl_frame.c"
+#include "sl_record.c"
+#include "sl_trace.c"
+
+int main(int argc, const char **argv)
+{
+   TI_SCREEN screen;
+   int rows, cols;
+   char buff[32];
+
+   if (!TIV_setup(0, NULL))
+      return 1;
+
+   ti_get_screen_size(&rows, &cols);
+   if (ti_screen_init(&screen, rows, cols) == 0)
+   {
+      for (int i=0; i<100; ++i)
+      {
+         snprintf(buff, sizeof(buff), "count: %d", i);
+         ti_screen_put(&screen, i % rows, 4, buff, i % 2 ? TI_ATTR_BOLD : 0);
+         ti_screen_render(&screen);
+      }
+
+      ti_screen_destroy(&screen);
+      printf("\n");
+      ti_stats_dump(STDOUT_FILENO);
+   }
+
+   TIV_destroy_arrays(0, NULL);
+   return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/* Local Variables:          */
+/* compile-command:   "gcc  \*/
+/* -Wall -Werror -pedantic  \*/
+/* -ggdb -std=c99           \*/
+/* -DSL_STATS_MAIN          \*/
+/* -DTI_WITH_STATS          \*/
+/* -fsanitize=address       \*/
+/* -ltinfo                  \*/
+/* -o sl_stats              \*/
+/* sl_stats.c"               */
+/* End:                      */
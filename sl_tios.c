@@ -4,6 +4,8 @@
 #include <stdlib.h>    // for exit()
 #include <stdio.h>     // for printf()
 
+#include "termintel.h"
+
 /**
  * @brief Stores incoming termios settings to be restore up program exit.
  */
@@ -28,6 +30,7 @@ void tios_save_incoming(void)
 void tios_restore_incoming(void)
 {
    tcsetattr(STDIN_FILENO, TCSANOW, &g_termios_incoming);
+   TI_STAT_ADD(TI_STAT_TCSETATTR, 1);
 }
 
 /**
@@ -49,6 +52,7 @@ void tios_disable_echo(void)
    tcgetattr(STDIN_FILENO, &tcur);
    tcur.c_lflag &= ~ tios_local_mode_echo_flags;
    tcsetattr(STDIN_FILENO, TCSANOW, &tcur);
+   TI_STAT_ADD(TI_STAT_TCSETATTR, 1);
 }
 
 /**
@@ -60,6 +64,7 @@ void tios_restore_echo(void)
    tcgetattr(STDIN_FILENO, &tcur);
    tcur.c_lflag |= tios_local_mode_echo_flags;
    tcsetattr(STDIN_FILENO, TCSANOW, &tcur);
+   TI_STAT_ADD(TI_STAT_TCSETATTR, 1);
 }
 
 /**
@@ -78,6 +83,7 @@ void tios_set_read_params(unsigned min_chars, unsigned timeout)
    tcur.c_cc[VMIN] = min_chars;
    tcur.c_cc[VTIME] = timeout;
    tcsetattr(STDIN_FILENO, TCSAFLUSH, &tcur);
+   TI_STAT_ADD(TI_STAT_TCSETATTR, 1);
 }
 
 /**
@@ -90,6 +96,7 @@ void tios_restore_read_params(void)
    tcur.c_cc[VMIN] = g_termios_incoming.c_cc[VMIN];
    tcur.c_cc[VTIME] = g_termios_incoming.c_cc[VTIME];
    tcsetattr(STDIN_FILENO, TCSANOW, &tcur);
+   TI_STAT_ADD(TI_STAT_TCSETATTR, 1);
 }
 
 /**
@@ -118,6 +125,8 @@ void tios_set_raw_mode(void)
    tcur.c_lflag &= ~( ECHO | ICANON | IEXTEN );
 
    tcsetattr(STDIN_FILENO, TCSAFLUSH, &tcur);
+
+   TI_STAT_ADD(TI_STAT_TCSETATTR, 1);
 }
 
 // Hide debugging code from Doxygen
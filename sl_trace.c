@@ -0,0 +1,416 @@
+/**
+ * @file sl_trace.c
+ * @brief Latency histograms from input to paint.
+ *
+ * Built with `make STATS=1` (-DTI_WITH_STATS), the library times
+ *
+ * - input to paint: from reading input (@ref ti_input_next or
+ *   @ref ti_get_keypress) until the write of the output that
+ *   follows returns with nothing left queued,
+ * - frame build: from the first output of a frame
+ *   (@ref ti_out_begin) until it is flushed,
+ * - flush: writing the frame to the terminal.
+ *
+ * Each span goes into a log-linear histogram, read with
+ * @ref ti_trace_get and @ref ti_histogram_percentile.  Spans are also
+ * written as text to a trace file opened with @ref ti_trace_open, or
+ * named by `TERMINTEL_TRACE` in the environment.  Each line is the
+ * span name, the time it ended and its duration, in nanoseconds.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "termintel.h"
+
+/** @brief log2 of TI_HISTOGRAM_SUB_BUCKETS */
+#define TI_HISTOGRAM_SUB_BITS 4
+
+#define TI_TRACE_BUFFER_SIZE 8192
+
+static const char *g_span_names[TI_TRACE_END] = {
+   "input_to_paint", "build", "flush"
+};
+
+#ifdef TI_WITH_STATS
+
+static TI_HISTOGRAM g_hists[TI_TRACE_END];
+
+static long long g_input_ns = 0;     ///< earliest input not yet painted
+static long long g_build_ns = 0;     ///< start of the frame being built
+static long long g_flush_ns = 0;     ///< start of the flush in progress
+static size_t g_flush_bytes = 0;     ///< bytes the flush in progress has to write
+
+static struct ti_trace_file {
+   pthread_mutex_t lock;
+   int fd;
+   size_t len;
+   char buff[TI_TRACE_BUFFER_SIZE];
+} g_file = { PTHREAD_MUTEX_INITIALIZER, -1, 0, { 0 } };
+
+static int bucket_index(long long value)
+{
+   if (value < TI_HISTOGRAM_SUB_BUCKETS)
+      return value < 0 ? 0 : (int)value;
+
+   int shift = 63 - __builtin_clzll((unsigned long long)value) - TI_HISTOGRAM_SUB_BITS;
+   return (shift + 1) * TI_HISTOGRAM_SUB_BUCKETS
+      + (int)((value >> shift) - TI_HISTOGRAM_SUB_BUCKETS);
+}
+
+static void write_file(void)
+{
+   size_t done = 0;
+   while (done < g_file.len)
+   {
+      ssize_t written = write(g_file.fd, g_file.buff + done, g_file.len - done);
+      if (written < 0 && errno == EINTR)
+         continue;
+      if (written <= 0)
+         break;
+      done += written;
+   }
+   g_file.len = 0;
+}
+
+static void record(int span, long long start, long long end)
+{
+   TI_HISTOGRAM *hist = &g_hists[span];
+   long long value = end - start;
+
+   __atomic_fetch_add(&hist->buckets[bucket_index(value)], 1, __ATOMIC_RELAXED);
+   __atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+   __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+
+   long long max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+   while (value > max
+          && !__atomic_compare_exchange_n(&hist->max, &max, value,
+                                          1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      ;
+   long long min = __atomic_load_n(&hist->min, __ATOMIC_RELAXED);
+   while ((min == 0 || value < min)
+          && !__atomic_compare_exchange_n(&hist->min, &min, value,
+                                          1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      ;
+
+   if (__atomic_load_n(&g_file.fd, __ATOMIC_RELAXED) >= 0)
+   {
+      pthread_mutex_lock(&g_file.lock);
+      if (g_file.fd >= 0)
+      {
+         if (g_file.len + 64 > TI_TRACE_BUFFER_SIZE)
+            write_file();
+         g_file.len += snprintf(g_file.buff + g_file.len, TI_TRACE_BUFFER_SIZE - g_file.len,
+                                "%s %lld %lld\n", g_span_names[span], end, value);
+      }
+      pthread_mutex_unlock(&g_file.lock);
+   }
+}
+
+/**
+ * @brief Note that input was read, starting an input-to-paint span
+ *        unless one is already waiting.
+ */
+void ti_trace_input(void)
+{
+   long long expected = 0;
+   __atomic_compare_exchange_n(&g_input_ns, &expected, ti_clock_ns(),
+                               0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Note the start of a frame, at the outermost @ref ti_out_begin.
+ */
+void ti_trace_frame_begin(void)
+{
+   if (!g_build_ns)
+      g_build_ns = ti_clock_ns();
+}
+
+/**
+ * @brief Note the start of a flush.
+ * @param "bytes"   bytes to write, buffered and queued
+ */
+void ti_trace_flush_begin(size_t bytes)
+{
+   long long now = ti_clock_ns();
+
+   if (bytes && g_build_ns)
+      record(TI_TRACE_BUILD, g_build_ns, now);
+   g_build_ns = 0;
+
+   g_flush_ns = now;
+   g_flush_bytes = bytes;
+}
+
+/**
+ * @brief Note the end of a flush.
+ * @param "pending"   bytes the terminal has not accepted yet
+ */
+void ti_trace_flush_end(size_t pending)
+{
+   if (!g_flush_bytes)
+      return;
+
+   long long now = ti_clock_ns();
+   record(TI_TRACE_FLUSH, g_flush_ns, now);
+   g_flush_bytes = 0;
+
+   if (pending == 0)
+   {
+      long long input = __atomic_exchange_n(&g_input_ns, 0, __ATOMIC_RELAXED);
+      if (input)
+         record(TI_TRACE_INPUT_TO_PAINT, input, now);
+   }
+}
+
+#endif  // TI_WITH_STATS
+
+/**
+ * @brief Open the trace file named by `TERMINTEL_TRACE`, if set.
+ *
+ * Called by @ref TIV_setup.
+ */
+void ti_trace_init(void)
+{
+#ifdef TI_WITH_STATS
+   static int registered = 0;
+   const char *path = getenv("TERMINTEL_TRACE");
+   if (path && *path && ti_trace_open(path) == 0 && !registered)
+   {
+      registered = 1;
+      atexit(ti_trace_close);
+   }
+#endif
+}
+
+/**
+ * @brief Write each span to a file as it is recorded.
+ * @param "path"   file to append to
+ * @return 0 for success, otherwise errno (ENOTSUP if tracing is
+ *         compiled out).
+ */
+int ti_trace_open(const char *path)
+{
+#ifdef TI_WITH_STATS
+   int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+   if (fd < 0)
+      return errno;
+
+   ti_trace_close();
+   pthread_mutex_lock(&g_file.lock);
+   __atomic_store_n(&g_file.fd, fd, __ATOMIC_RELAXED);
+   pthread_mutex_unlock(&g_file.lock);
+   return 0;
+#else
+   return ENOTSUP;
+#endif
+}
+
+/**
+ * @brief Write what is buffered and close the trace file.
+ */
+void ti_trace_close(void)
+{
+#ifdef TI_WITH_STATS
+   pthread_mutex_lock(&g_file.lock);
+   if (g_file.fd >= 0)
+   {
+      write_file();
+      close(g_file.fd);
+      __atomic_store_n(&g_file.fd, -1, __ATOMIC_RELAXED);
+   }
+   pthread_mutex_unlock(&g_file.lock);
+#endif
+}
+
+/**
+ * @brief Copy the histogram of a span.
+ * @param "span"   enum ti_trace_span
+ * @param "hist"   set to the histogram, empty if tracing is compiled out
+ * @return 0 for success, otherwise errno (EINVAL or ENOTSUP).
+ */
+int ti_trace_get(int span, TI_HISTOGRAM *hist)
+{
+   memset(hist, 0, sizeof(TI_HISTOGRAM));
+
+   if (span < 0 || span >= TI_TRACE_END)
+      return EINVAL;
+
+#ifdef TI_WITH_STATS
+   const TI_HISTOGRAM *source = &g_hists[span];
+   hist->count = __atomic_load_n(&source->count, __ATOMIC_RELAXED);
+   hist->sum = __atomic_load_n(&source->sum, __ATOMIC_RELAXED);
+   hist->min = __atomic_load_n(&source->min, __ATOMIC_RELAXED);
+   hist->max = __atomic_load_n(&source->max, __ATOMIC_RELAXED);
+   for (int i=0; i<TI_HISTOGRAM_BUCKETS; ++i)
+      hist->buckets[i] = __atomic_load_n(&source->buckets[i], __ATOMIC_RELAXED);
+   return 0;
+#else
+   return ENOTSUP;
+#endif
+}
+
+/**
+ * @brief Value below which a share of the recorded values fall.
+ * @param "hist"         histogram from @ref ti_trace_get
+ * @param "percentile"   share, from 0 to 100
+ * @return the largest value of the bucket reached, within about 6%,
+ *         or 0 if the histogram is empty.
+ */
+long long ti_histogram_percentile(const TI_HISTOGRAM *hist, double percentile)
+{
+   long long total = 0;
+   for (int i=0; i<TI_HISTOGRAM_BUCKETS; ++i)
+      total += hist->buckets[i];
+   if (total == 0)
+      return 0;
+
+   long long wanted = (long long)(total * percentile / 100.0 + 0.5);
+   if (wanted < 1)
+      wanted = 1;
+
+   long long seen = 0;
+   for (int i=0; i<TI_HISTOGRAM_BUCKETS; ++i)
+   {
+      seen += hist->buckets[i];
+      if (seen >= wanted)
+      {
+         if (i < TI_HISTOGRAM_SUB_BUCKETS)
+            return i;
+
+         int shift = i / TI_HISTOGRAM_SUB_BUCKETS - 1;
+         long long sub = i % TI_HISTOGRAM_SUB_BUCKETS;
+         long long top = ((TI_HISTOGRAM_SUB_BUCKETS + sub + 1) << shift) - 1;
+         return hist->max && top > hist->max ? hist->max : top;
+      }
+   }
+
+   return hist->max;
+}
+
+/**
+ * @brief Empty the histograms.
+ */
+void ti_trace_reset(void)
+{
+#ifdef TI_WITH_STATS
+   for (int span=0; span<TI_TRACE_END; ++span)
+   {
+      TI_HISTOGRAM *hist = &g_hists[span];
+      __atomic_store_n(&hist->count, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&hist->sum, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&hist->min, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&hist->max, 0, __ATOMIC_RELAXED);
+      for (int i=0; i<TI_HISTOGRAM_BUCKETS; ++i)
+         __atomic_store_n(&hist->buckets[i], 0, __ATOMIC_RELAXED);
+   }
+#endif
+}
+
+/**
+ * @brief Write a summary of each histogram as text, in microseconds.
+ * @param "fd"   file descriptor to write to
+ */
+void ti_trace_dump(int fd)
+{
+   static TI_HISTOGRAM hist;
+
+   dprintf(fd, "  %-16s %8s %9s %9s %9s %9s %9s %9s\n",
+           "span (us)", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+   for (int span=0; span<TI_TRACE_END; ++span)
+   {
+      if (ti_trace_get(span, &hist) || hist.count == 0)
+         continue;
+
+      dprintf(fd, "  %-16s %8lld %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+              g_span_names[span], hist.count,
+              hist.sum / 1000.0 / hist.count,
+              ti_histogram_percentile(&hist, 50) / 1000.0,
+              ti_histogram_percentile(&hist, 90) / 1000.0,
+              ti_histogram_percentile(&hist, 99) / 1000.0,
+              ti_histogram_percentile(&hist, 99.9) / 1000.0,
+              hist.max / 1000.0);
+   }
+}
+
+// Hide debugging code from Doxygen
+/** @cond */
+
+#ifdef SL_TRACE_MAIN
+
+#include "sl_caps.c"
+#include "sl_ioctl.c"
+#include "sl_libcaps.c"
+#include "sl_output.c"
+#include "sl_screen.c"
+#include "sl_utf8.c"
+#include "sl_gcache.c"
+#include "sl_frame.c"
+#include "sl_record.c"
+#include "sl_stats.c"
+#include "sl_tios.c"
+#include "sl_input.c"
+
+int main(int argc, const char **argv)
+{
+   TI_SCREEN screen;
+   TI_INPUT input;
+   TI_EVENT event;
+   int rows, cols;
+   char buff[64];
+
+   if (!TIV_setup(0, NULL))
+      return 1;
+
+   ti_get_screen_size(&rows, &cols);
+   if (ti_screen_init(&screen, rows, cols) == 0
+       && ti_input_init(&input, STDIN_FILENO, 0, NULL) == 0)
+   {
+      tios_save_incoming();
+      tios_set_raw_mode();
+      ti_screen_put(&screen, 0, 0, "Type to time input to paint, q to quit.", 0);
+
+      int keys = 0;
+      while (ti_input_next(&input, &event, -1) == 0
+             && !(event.type == TI_EVENT_CHAR && event.code == 'q'))
+      {
+         snprintf(buff, sizeof(buff), "%d events", ++keys);
+         ti_screen_put(&screen, 2, 0, buff, TI_ATTR_BOLD);
+         ti_frame_present(&screen);
+      }
+
+      tios_restore_incoming();
+      ti_input_destroy(&input);
+      ti_screen_destroy(&screen);
+      printf("\n");
+      ti_trace_dump(STDOUT_FILENO);
+   }
+
+   TIV_destroy_arrays(0, NULL);
+   return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/* Local Variables:          */
+/* compile-command:   "gcc  \*/
+/* -Wall -Werror -pedantic  \*/
+/* -ggdb -std=c99           \*/
+/* -DSL_TRACE_MAIN          \*/
+/* -DTI_WITH_STATS          \*/
+/* -fsanitize=address       \*/
+/* -ltinfo                  \*/
+/* -o sl_trace              \*/
+/* sl_trace.c"               */
+/* End:                      */
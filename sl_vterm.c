@@ -0,0 +1,1012 @@
+/**
+ * @file sl_vterm.c
+ * @brief Headless terminal that shows what the library's output does.
+ *
+ * A @ref TI_VTERM parses the escape sequences of an xterm-compatible
+ * terminal into a grid of @ref TI_CELL, the same cells a
+ * @ref TI_SCREEN holds.  Connect one to the output buffer with
+ * `ti_out_set_sink(ti_vterm_sink, vt)` and render as usual: the grid
+ * then shows what a terminal would, and @ref ti_vterm_diff tells
+ * whether it matches the screen's back buffer.  @ref ti_vterm_bytes
+ * counts the output, so the cost of a frame can be measured without a
+ * terminal.
+ *
+ * The parser handles what the library sends to xterm-like terminals:
+ * cursor movement, SGR attributes, scroll regions, left and right
+ * margins, insert and delete of characters and lines, erasing,
+ * `repeat_char` and the DEC line-drawing character set, in G0 or G1.
+ * Colors are ignored, standout is SGR 7 and shows as
+ * @ref TI_ATTR_REVERSE, and zero-width characters are dropped.  Other
+ * sequences are skipped and counted by @ref ti_vterm_unknown.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "termintel.h"
+
+#define TI_VTERM_MAX_PARAMS 16
+
+enum vterm_state {
+   VT_GROUND = 0,
+   VT_ESCAPE,        ///< after ESC
+   VT_CHARSET,       ///< after ESC and an intermediate, such as `ESC (`
+   VT_CSI,           ///< in a control sequence
+   VT_STRING,        ///< in OSC, DCS or another string, until ST or BEL
+   VT_STRING_ESC     ///< ESC in a string, possibly starting ST
+};
+
+/**
+ * @brief State of a headless terminal.
+ */
+struct ti_vterm {
+   int rows;
+   int cols;
+   TI_CELL *cells;
+
+   int row;                  ///< cursor row
+   int col;                  ///< cursor column
+   int wrap_pending;         ///< set after writing the last column
+   unsigned short attr;      ///< TI_ATTR_ flags for new characters
+   int charsets[2];          ///< set for G0 or G1 when it is the DEC line-drawing set
+   int shift;                ///< 1 after SO selects G1, 0 after SI selects G0
+   unsigned int last;        ///< last character printed, for REP
+
+   int top, bottom;          ///< scroll region rows
+   int left, right;          ///< margin columns
+   int lr_mode;              ///< set when left and right margins are enabled (DECLRMM)
+   int autowrap;             ///< DECAWM
+
+   int saved_row, saved_col, saved_shift;
+   int saved_charsets[2];
+   unsigned short saved_attr;
+
+   int state;
+   int params[TI_VTERM_MAX_PARAMS];
+   int param_count;
+   char prefix;              ///< private marker of a control sequence: < = > ?
+   char inter;               ///< intermediate byte of a sequence
+
+   unsigned char utf8[4];    ///< bytes of an incomplete UTF-8 character
+   int utf8_len;
+   int utf8_need;
+
+   size_t bytes;             ///< bytes written to the terminal
+   int unknown;              ///< sequences skipped
+};
+
+static const TI_CELL empty_cell = { ' ', 0 };
+
+/** @brief Unicode of the DEC line-drawing characters 0x5F to 0x7E */
+static const unsigned short dec_graphics[32] = {
+   0x0020, 0x25C6, 0x2592, 0x2409, 0x240C, 0x240D, 0x240A, 0x00B0,
+   0x00B1, 0x2424, 0x240B, 0x2518, 0x2510, 0x250C, 0x2514, 0x253C,
+   0x23BA, 0x23BB, 0x2500, 0x23BC, 0x23BD, 0x251C, 0x2524, 0x2534,
+   0x252C, 0x2502, 0x2264, 0x2265, 0x03C0, 0x2260, 0x00A3, 0x00B7
+};
+
+static TI_CELL *cell_at(TI_VTERM *vt, int row, int col)
+{
+   return &vt->cells[row * vt->cols + col];
+}
+
+/**
+ * @brief Columns the cursor can't pass while printing or editing.
+ */
+static int left_edge(const TI_VTERM *vt)
+{
+   return vt->lr_mode && vt->col >= vt->left ? vt->left : 0;
+}
+
+static int right_edge(const TI_VTERM *vt)
+{
+   return vt->lr_mode && vt->col <= vt->right ? vt->right : vt->cols - 1;
+}
+
+/**
+ * @brief Blank cells @p from to @p to of a row, and the other halves of
+ *        wide characters cut at either end.
+ */
+static void erase_cells(TI_VTERM *vt, int row, int from, int to)
+{
+   if (from > to)
+      return;
+
+   TI_CELL *line = cell_at(vt, row, 0);
+   if (from > 0 && line[from].code == TI_CELL_WIDE_TAIL)
+      line[from - 1] = empty_cell;
+   if (to + 1 < vt->cols && line[to + 1].code == TI_CELL_WIDE_TAIL)
+      line[to + 1] = empty_cell;
+
+   for (int col=from; col<=to; ++col)
+      line[col] = empty_cell;
+}
+
+/**
+ * @brief Scroll a rectangle up by @p count lines, down if negative.
+ */
+static void scroll_rect(TI_VTERM *vt, int top, int bottom, int left, int right, int count)
+{
+   int height = bottom - top + 1;
+   int width = right - left + 1;
+   int lines = count > 0 ? count : -count;
+
+   if (height <= 0 || width <= 0)
+      return;
+   if (lines > height)
+      lines = height;
+
+   if (count > 0)
+   {
+      for (int row=top; row+lines<=bottom; ++row)
+         memcpy(cell_at(vt, row, left), cell_at(vt, row + lines, left), width * sizeof(TI_CELL));
+      for (int row=bottom-lines+1; row<=bottom; ++row)
+         erase_cells(vt, row, left, right);
+   }
+   else
+   {
+      for (int row=bottom; row-lines>=top; --row)
+         memcpy(cell_at(vt, row, left), cell_at(vt, row - lines, left), width * sizeof(TI_CELL));
+      for (int row=top; row<top+lines; ++row)
+         erase_cells(vt, row, left, right);
+   }
+}
+
+static void scroll_region(TI_VTERM *vt, int top, int count)
+{
+   int left = vt->lr_mode ? vt->left : 0;
+   int right = vt->lr_mode ? vt->right : vt->cols - 1;
+   scroll_rect(vt, top, vt->bottom, left, right, count);
+}
+
+static void line_feed(TI_VTERM *vt)
+{
+   vt->wrap_pending = 0;
+   if (vt->row == vt->bottom)
+      scroll_region(vt, vt->top, 1);
+   else if (vt->row < vt->rows - 1)
+      ++vt->row;
+}
+
+static void reverse_index(TI_VTERM *vt)
+{
+   vt->wrap_pending = 0;
+   if (vt->row == vt->top)
+      scroll_region(vt, vt->top, -1);
+   else if (vt->row > 0)
+      --vt->row;
+}
+
+static void move_cursor(TI_VTERM *vt, int row, int col)
+{
+   vt->row = row < 0 ? 0 : row >= vt->rows ? vt->rows - 1 : row;
+   vt->col = col < 0 ? 0 : col >= vt->cols ? vt->cols - 1 : col;
+   vt->wrap_pending = 0;
+}
+
+/**
+ * @brief Put a character at the cursor and advance it.
+ */
+static void put_glyph(TI_VTERM *vt, unsigned int code)
+{
+   int width = ti_char_width(code);
+   if (width <= 0)
+      return;
+
+   if (vt->wrap_pending && vt->autowrap)
+   {
+      vt->col = left_edge(vt);
+      line_feed(vt);
+   }
+   vt->wrap_pending = 0;
+
+   int right = right_edge(vt);
+   if (width == 2 && vt->col == right)
+   {
+      if (!vt->autowrap || right == left_edge(vt))
+         return;
+      erase_cells(vt, vt->row, vt->col, vt->col);
+      vt->col = left_edge(vt);
+      line_feed(vt);
+      right = right_edge(vt);
+   }
+
+   erase_cells(vt, vt->row, vt->col, vt->col + width - 1);
+   TI_CELL *cell = cell_at(vt, vt->row, vt->col);
+   cell[0].code = code;
+   cell[0].attr = vt->attr;
+   if (width == 2)
+   {
+      cell[1].code = TI_CELL_WIDE_TAIL;
+      cell[1].attr = vt->attr;
+   }
+
+   vt->last = code;
+   if (vt->col + width > right)
+      vt->wrap_pending = 1;
+   else
+      vt->col += width;
+}
+
+static void print(TI_VTERM *vt, unsigned int code)
+{
+   if (vt->charsets[vt->shift] && code >= 0x5F && code <= 0x7E)
+      code = dec_graphics[code - 0x5F];
+   put_glyph(vt, code);
+}
+
+static void control(TI_VTERM *vt, unsigned char chr)
+{
+   switch (chr)
+   {
+      case '\b':
+         if (vt->col > left_edge(vt))
+            --vt->col;
+         vt->wrap_pending = 0;
+         break;
+      case '\t':
+      {
+         int right = right_edge(vt);
+         int next = (vt->col / 8 + 1) * 8;
+         vt->col = next < right ? next : right;
+         break;
+      }
+      case '\n':
+      case '\v':
+      case '\f':
+         line_feed(vt);
+         break;
+      case '\r':
+         vt->col = left_edge(vt);
+         vt->wrap_pending = 0;
+         break;
+      case 0x0E:
+         vt->shift = 1;
+         break;
+      case 0x0F:
+         vt->shift = 0;
+         break;
+      case 0x07:
+      default:
+         break;
+   }
+}
+
+static int param(const TI_VTERM *vt, int index, int fallback)
+{
+   if (index >= vt->param_count || vt->params[index] <= 0)
+      return fallback;
+   return vt->params[index];
+}
+
+static void save_cursor(TI_VTERM *vt)
+{
+   vt->saved_row = vt->row;
+   vt->saved_col = vt->col;
+   vt->saved_attr = vt->attr;
+   vt->saved_shift = vt->shift;
+   memcpy(vt->saved_charsets, vt->charsets, sizeof(vt->charsets));
+}
+
+static void restore_cursor(TI_VTERM *vt)
+{
+   move_cursor(vt, vt->saved_row, vt->saved_col);
+   vt->attr = vt->saved_attr;
+   vt->shift = vt->saved_shift;
+   memcpy(vt->charsets, vt->saved_charsets, sizeof(vt->charsets));
+}
+
+static void reset(TI_VTERM *vt)
+{
+   for (int row=0; row<vt->rows; ++row)
+      erase_cells(vt, row, 0, vt->cols - 1);
+
+   vt->row = vt->col = 0;
+   vt->wrap_pending = 0;
+   vt->attr = 0;
+   // Terminals that switch to line drawing with SO expect it in G1
+   vt->charsets[0] = 0;
+   vt->charsets[1] = 1;
+   vt->shift = 0;
+   vt->last = ' ';
+   vt->top = 0;
+   vt->bottom = vt->rows - 1;
+   vt->left = 0;
+   vt->right = vt->cols - 1;
+   vt->lr_mode = 0;
+   vt->autowrap = 1;
+   save_cursor(vt);
+}
+
+static void set_attributes(TI_VTERM *vt)
+{
+   if (vt->param_count == 0)
+   {
+      vt->attr = 0;
+      return;
+   }
+
+   for (int i=0; i<vt->param_count; ++i)
+   {
+      switch (vt->params[i])
+      {
+         case 0:  vt->attr = 0; break;
+         case 1:  vt->attr |= TI_ATTR_BOLD; break;
+         case 2:  vt->attr |= TI_ATTR_DIM; break;
+         case 4:  vt->attr |= TI_ATTR_UNDERLINE; break;
+         case 7:  vt->attr |= TI_ATTR_REVERSE; break;
+         case 22: vt->attr &= ~(TI_ATTR_BOLD | TI_ATTR_DIM); break;
+         case 24: vt->attr &= ~TI_ATTR_UNDERLINE; break;
+         case 27: vt->attr &= ~TI_ATTR_REVERSE; break;
+         case 38:
+         case 48:
+         case 58:
+            // Skip the color that follows
+            if (i + 1 < vt->param_count)
+               i += vt->params[i + 1] == 5 ? 2 : vt->params[i + 1] == 2 ? 4 : 1;
+            break;
+         default:
+            break;
+      }
+   }
+}
+
+static void set_mode(TI_VTERM *vt, int on)
+{
+   if (vt->prefix != '?')
+      return;
+
+   for (int i=0; i<vt->param_count; ++i)
+   {
+      switch (vt->params[i])
+      {
+         case 7:
+            vt->autowrap = on;
+            break;
+         case 69:
+            vt->lr_mode = on;
+            vt->left = 0;
+            vt->right = vt->cols - 1;
+            break;
+         case 47:
+         case 1047:
+         case 1049:
+            // The alternate screen shares the grid: it starts and ends blank
+            if (on && vt->params[i] == 1049)
+               save_cursor(vt);
+            for (int row=0; row<vt->rows; ++row)
+               erase_cells(vt, row, 0, vt->cols - 1);
+            if (!on && vt->params[i] == 1049)
+               restore_cursor(vt);
+            break;
+         default:
+            break;
+      }
+   }
+}
+
+static void dispatch_csi(TI_VTERM *vt, unsigned char final)
+{
+   int count = param(vt, 0, 1);
+
+   if (vt->inter)
+   {
+      ++vt->unknown;
+      return;
+   }
+
+   // Private sequences the library sends, such as the keyboard
+   // protocol, don't change the screen
+   if (vt->prefix && final != 'h' && final != 'l')
+   {
+      if (final != 'u' && final != 'm')
+         ++vt->unknown;
+      return;
+   }
+
+   switch (final)
+   {
+      case 'A':
+      {
+         // Stop at the top margin if starting below it
+         int top = vt->row >= vt->top ? vt->top : 0;
+         move_cursor(vt, vt->row - count < top ? top : vt->row - count, vt->col);
+         break;
+      }
+      case 'B':
+      case 'e':
+      {
+         int bottom = vt->row <= vt->bottom ? vt->bottom : vt->rows - 1;
+         move_cursor(vt, vt->row + count > bottom ? bottom : vt->row + count, vt->col);
+         break;
+      }
+      case 'C':
+      case 'a':
+      {
+         int right = right_edge(vt);
+         move_cursor(vt, vt->row, vt->col + count > right ? right : vt->col + count);
+         break;
+      }
+      case 'D':
+      {
+         int left = left_edge(vt);
+         move_cursor(vt, vt->row, vt->col - count < left ? left : vt->col - count);
+         break;
+      }
+      case 'E':
+         move_cursor(vt, vt->row + count, left_edge(vt));
+         break;
+      case 'F':
+         move_cursor(vt, vt->row - count, left_edge(vt));
+         break;
+      case 'G':
+      case '`':
+         move_cursor(vt, vt->row, count - 1);
+         break;
+      case 'd':
+         move_cursor(vt, count - 1, vt->col);
+         break;
+      case 'H':
+      case 'f':
+         move_cursor(vt, param(vt, 0, 1) - 1, param(vt, 1, 1) - 1);
+         break;
+      case 'J':
+      {
+         int mode = vt->param_count ? vt->params[0] : 0;
+         if (mode == 0)
+         {
+            erase_cells(vt, vt->row, vt->col, vt->cols - 1);
+            for (int row=vt->row+1; row<vt->rows; ++row)
+               erase_cells(vt, row, 0, vt->cols - 1);
+         }
+         else if (mode == 1)
+         {
+            for (int row=0; row<vt->row; ++row)
+               erase_cells(vt, row, 0, vt->cols - 1);
+            erase_cells(vt, vt->row, 0, vt->col);
+         }
+         else
+            for (int row=0; row<vt->rows; ++row)
+               erase_cells(vt, row, 0, vt->cols - 1);
+         vt->wrap_pending = 0;
+         break;
+      }
+      case 'K':
+      {
+         int mode = vt->param_count ? vt->params[0] : 0;
+         erase_cells(vt, vt->row, mode == 0 ? vt->col : 0, mode == 1 ? vt->col : vt->cols - 1);
+         vt->wrap_pending = 0;
+         break;
+      }
+      case 'X':
+      {
+         int end = vt->col + count - 1;
+         erase_cells(vt, vt->row, vt->col, end < vt->cols ? end : vt->cols - 1);
+         vt->wrap_pending = 0;
+         break;
+      }
+      case '@':
+      case 'P':
+      {
+         int right = right_edge(vt);
+         TI_CELL *line = cell_at(vt, vt->row, 0);
+         int width = right - vt->col + 1;
+         if (count > width)
+            count = width;
+         if (final == '@')
+         {
+            memmove(line + vt->col + count, line + vt->col, (width - count) * sizeof(TI_CELL));
+            erase_cells(vt, vt->row, vt->col, vt->col + count - 1);
+         }
+         else
+         {
+            memmove(line + vt->col, line + vt->col + count, (width - count) * sizeof(TI_CELL));
+            erase_cells(vt, vt->row, right - count + 1, right);
+         }
+         vt->wrap_pending = 0;
+         break;
+      }
+      case 'L':
+      case 'M':
+         if (vt->row >= vt->top && vt->row <= vt->bottom)
+         {
+            scroll_region(vt, vt->row, final == 'L' ? -count : count);
+            vt->col = vt->lr_mode ? vt->left : 0;
+            vt->wrap_pending = 0;
+         }
+         break;
+      case 'S':
+         scroll_region(vt, vt->top, count);
+         break;
+      case 'T':
+         scroll_region(vt, vt->top, -count);
+         break;
+      case 'b':
+         for (int i=0; i<count; ++i)
+            put_glyph(vt, vt->last);
+         break;
+      case 'm':
+         set_attributes(vt);
+         break;
+      case 'r':
+      {
+         int top = param(vt, 0, 1) - 1;
+         int bottom = param(vt, 1, vt->rows) - 1;
+         if (bottom >= vt->rows)
+            bottom = vt->rows - 1;
+         if (top < bottom)
+         {
+            vt->top = top;
+            vt->bottom = bottom;
+            move_cursor(vt, 0, 0);
+         }
+         break;
+      }
+      case 's':
+         if (vt->lr_mode)
+         {
+            int left = param(vt, 0, 1) - 1;
+            int right = param(vt, 1, vt->cols) - 1;
+            if (right >= vt->cols)
+               right = vt->cols - 1;
+            if (left < right)
+            {
+               vt->left = left;
+               vt->right = right;
+               move_cursor(vt, 0, 0);
+            }
+         }
+         else
+            save_cursor(vt);
+         break;
+      case 'u':
+         restore_cursor(vt);
+         break;
+      case 'h':
+         set_mode(vt, 1);
+         break;
+      case 'l':
+         set_mode(vt, 0);
+         break;
+      default:
+         ++vt->unknown;
+         break;
+   }
+}
+
+static void dispatch_escape(TI_VTERM *vt, unsigned char chr)
+{
+   switch (chr)
+   {
+      case '7': save_cursor(vt); break;
+      case '8': restore_cursor(vt); break;
+      case 'D': line_feed(vt); break;
+      case 'E':
+         vt->col = left_edge(vt);
+         line_feed(vt);
+         break;
+      case 'M': reverse_index(vt); break;
+      case 'c': reset(vt); break;
+      case '=':   // keypad modes
+      case '>':
+      case '\\':  // stray string terminator
+         break;
+      default:
+         ++vt->unknown;
+         break;
+   }
+}
+
+/**
+ * @brief Feed one decoded character to the parser.
+ */
+static void consume(TI_VTERM *vt, unsigned int code)
+{
+   switch (vt->state)
+   {
+      case VT_GROUND:
+         if (code == 0x1B)
+            vt->state = VT_ESCAPE;
+         else if (code < 0x20)
+            control(vt, (unsigned char)code);
+         else if (code != 0x7F)
+            print(vt, code);
+         break;
+
+      case VT_ESCAPE:
+         vt->state = VT_GROUND;
+         vt->param_count = 0;
+         vt->prefix = vt->inter = 0;
+         if (code == '[')
+            vt->state = VT_CSI;
+         else if (code == ']' || code == 'P' || code == '_' || code == '^' || code == 'X')
+            vt->state = VT_STRING;
+         else if (code >= 0x20 && code <= 0x2F)
+         {
+            vt->inter = (char)code;
+            vt->state = VT_CHARSET;
+         }
+         else if (code == 0x1B)
+            vt->state = VT_ESCAPE;
+         else if (code < 0x20)
+         {
+            control(vt, (unsigned char)code);
+            vt->state = VT_ESCAPE;
+         }
+         else
+            dispatch_escape(vt, (unsigned char)code);
+         break;
+
+      case VT_CHARSET:
+         vt->state = VT_GROUND;
+         if (vt->inter == '(' || vt->inter == ')')
+            vt->charsets[vt->inter == ')'] = code == '0';
+         break;
+
+      case VT_CSI:
+         if (code >= '0' && code <= '9')
+         {
+            if (vt->param_count == 0)
+               vt->params[vt->param_count++] = 0;
+            int *value = &vt->params[vt->param_count - 1];
+            if (*value < 100000)
+               *value = *value * 10 + (int)(code - '0');
+         }
+         else if (code == ';' || code == ':')
+         {
+            if (vt->param_count == 0)
+               vt->params[vt->param_count++] = 0;
+            if (vt->param_count < TI_VTERM_MAX_PARAMS)
+               vt->params[vt->param_count++] = 0;
+         }
+         else if (code >= '<' && code <= '?')
+            vt->prefix = (char)code;
+         else if (code >= 0x20 && code <= 0x2F)
+            vt->inter = (char)code;
+         else if (code >= 0x40 && code <= 0x7E)
+         {
+            vt->state = VT_GROUND;
+            dispatch_csi(vt, (unsigned char)code);
+         }
+         else if (code == 0x1B)
+            vt->state = VT_ESCAPE;
+         else if (code < 0x20)
+            control(vt, (unsigned char)code);
+         else
+         {
+            vt->state = VT_GROUND;
+            ++vt->unknown;
+         }
+         break;
+
+      case VT_STRING:
+         if (code == 0x07)
+            vt->state = VT_GROUND;
+         else if (code == 0x1B)
+            vt->state = VT_STRING_ESC;
+         break;
+
+      case VT_STRING_ESC:
+         vt->state = code == '\\' ? VT_GROUND : VT_STRING;
+         break;
+   }
+}
+
+/**
+ * @brief Create a headless terminal, blank with the cursor at the top left.
+ * @param "rows"   number of rows
+ * @param "cols"   number of columns
+ * @return new terminal, or NULL if out of memory or the size is invalid.
+ */
+TI_VTERM *ti_vterm_create(int rows, int cols)
+{
+   if (rows <= 0 || cols <= 0)
+      return NULL;
+
+   TI_VTERM *vt = (TI_VTERM*)calloc(1, sizeof(TI_VTERM));
+   if (vt)
+   {
+      vt->cells = (TI_CELL*)malloc((size_t)rows * cols * sizeof(TI_CELL));
+      if (!vt->cells)
+      {
+         free(vt);
+         return NULL;
+      }
+
+      vt->rows = rows;
+      vt->cols = cols;
+      reset(vt);
+   }
+
+   return vt;
+}
+
+/**
+ * @brief Free a terminal made by @ref ti_vterm_create.
+ */
+void ti_vterm_destroy(TI_VTERM *vt)
+{
+   if (vt)
+   {
+      free(vt->cells);
+      free(vt);
+   }
+}
+
+/**
+ * @brief Show output on the terminal.
+ * @param "vt"     terminal
+ * @param "data"   output, as sent to a real terminal
+ * @param "len"    number of bytes in @p data
+ */
+void ti_vterm_write(TI_VTERM *vt, const char *data, size_t len)
+{
+   const unsigned char *ptr = (const unsigned char*)data;
+   const unsigned char *end = ptr + len;
+
+   vt->bytes += len;
+
+   for (; ptr < end; ++ptr)
+   {
+      unsigned char chr = *ptr;
+
+      if (vt->utf8_need)
+      {
+         if ((chr & 0xC0) == 0x80)
+         {
+            vt->utf8[vt->utf8_len++] = chr;
+            if (vt->utf8_len == vt->utf8_need)
+            {
+               unsigned int code;
+               ti_utf8_decode_n((const char*)vt->utf8, vt->utf8_len, &code);
+               vt->utf8_need = 0;
+               consume(vt, code);
+            }
+            continue;
+         }
+
+         // Interrupted sequence
+         vt->utf8_need = 0;
+         consume(vt, 0xFFFD);
+      }
+
+      if (chr < 0x80)
+         consume(vt, chr);
+      else if (chr >= 0xC2 && chr <= 0xF4)
+      {
+         vt->utf8[0] = chr;
+         vt->utf8_len = 1;
+         vt->utf8_need = chr < 0xE0 ? 2 : chr < 0xF0 ? 3 : 4;
+      }
+      else
+         consume(vt, 0xFFFD);
+   }
+}
+
+/**
+ * @brief Output sink for @ref ti_out_set_sink that writes to a terminal.
+ * @param "vt"      the @ref TI_VTERM
+ * @param "bytes"   output of one flush
+ * @param "len"     number of @p bytes
+ */
+void ti_vterm_sink(void *vt, const char *bytes, size_t len)
+{
+   ti_vterm_write((TI_VTERM*)vt, bytes, len);
+}
+
+/**
+ * @brief Get a cell of the terminal.
+ * @return the cell, or NULL if the position is outside the terminal.
+ */
+const TI_CELL *ti_vterm_cell(const TI_VTERM *vt, int row, int col)
+{
+   if (row < 0 || row >= vt->rows || col < 0 || col >= vt->cols)
+      return NULL;
+   return &vt->cells[row * vt->cols + col];
+}
+
+/**
+ * @brief Copy the text of a row as UTF-8, without trailing blanks.
+ * @param "vt"     terminal
+ * @param "row"    row to copy
+ * @param "buff"   set to the text, NULL-terminated
+ * @param "size"   bytes available at @p buff
+ * @return length of the text, or -1 if @p buff is too small or @p row
+ *         is outside the terminal.
+ */
+int ti_vterm_row_text(const TI_VTERM *vt, int row, char *buff, int size)
+{
+   if (row < 0 || row >= vt->rows || size <= 0)
+      return -1;
+
+   const TI_CELL *line = &vt->cells[row * vt->cols];
+   int end = vt->cols;
+   while (end > 0 && line[end - 1].code == ' ')
+      --end;
+
+   int len = 0;
+   for (int col=0; col<end; ++col)
+   {
+      if (line[col].code == TI_CELL_WIDE_TAIL)
+         continue;
+      if (len + 4 >= size)
+         return -1;
+      len += ti_utf8_encode(line[col].code, buff + len);
+   }
+
+   buff[len] = '\0';
+   return len;
+}
+
+/**
+ * @brief Get the position of the cursor.
+ */
+void ti_vterm_cursor(const TI_VTERM *vt, int *row, int *col)
+{
+   *row = vt->row;
+   *col = vt->col;
+}
+
+/**
+ * @brief Number of bytes written to the terminal so far.
+ */
+size_t ti_vterm_bytes(const TI_VTERM *vt)
+{
+   return vt->bytes;
+}
+
+/**
+ * @brief Number of sequences the terminal skipped because it doesn't
+ *        know them.
+ */
+int ti_vterm_unknown(const TI_VTERM *vt)
+{
+   return vt->unknown;
+}
+
+/**
+ * @brief Compare the terminal with the back buffer of a screen.
+ *
+ * Use after @ref ti_screen_render to check that the terminal shows
+ * what the screen should.  Clusters compare by their first codepoint,
+ * and standout compares as reverse.  The bottom-right cell, which the
+ * render leaves alone, is not compared.
+ *
+ * @param "vt"    terminal
+ * @param "scr"   screen of the same size
+ * @param "row"   if not NULL, set to the row of the first difference
+ * @param "col"   if not NULL, set to the column of the first difference
+ * @return number of cells that differ, or -1 if the sizes differ.
+ */
+int ti_vterm_diff(const TI_VTERM *vt, const TI_SCREEN *scr, int *row, int *col)
+{
+   int count = 0;
+
+   if (vt->rows != scr->rows || vt->cols != scr->cols)
+      return -1;
+
+   for (int r=0; r<vt->rows; ++r)
+   {
+      for (int c=0; c<vt->cols; ++c)
+      {
+         if (r == vt->rows - 1 && c == vt->cols - 1)
+            continue;
+
+         const TI_CELL *shown = &vt->cells[r * vt->cols + c];
+         const TI_CELL *wanted = &scr->back[r * scr->cols + c];
+
+         unsigned int code = wanted->code;
+         int len;
+         const char *cluster;
+         if (code >= TI_CELL_CLUSTER && code != TI_CELL_WIDE_TAIL
+             && (cluster = ti_gcache_cluster(scr->gcache, code, &len, NULL)))
+            ti_utf8_decode_n(cluster, len, &code);
+
+         unsigned short attr = wanted->attr;
+         if (attr & TI_ATTR_STANDOUT)
+            attr = (attr & ~TI_ATTR_STANDOUT) | TI_ATTR_REVERSE;
+
+         if (shown->code != code || shown->attr != attr)
+         {
+            if (count++ == 0)
+            {
+               if (row)
+                  *row = r;
+               if (col)
+                  *col = c;
+            }
+         }
+      }
+   }
+
+   return count;
+}
+
+// Hide debugging code from Doxygen
+/** @cond */
+
+#ifdef SL_VTERM_MAIN
+
+#include <stdio.h>
+
+#include "sl_caps.c"
+#include "sl_ioctl.c"
+#include "sl_libcaps.c"
+#include "sl_output.c"
+#include "sl_screen.c"
+#include "sl_utf8.c"
+#include "sl_gcache.c"
+#include "sl_frame.c"
+#include "sl_record.c"
+
+int main(int argc, const char **argv)
+{
+   TI_SCREEN screen;
+   char buff[256];
+   int rows = 12, cols = 40;
+
+   if (!TIV_setup(0, NULL))
+      return 1;
+
+   TI_VTERM *vt = ti_vterm_create(rows, cols);
+   if (vt && ti_screen_init(&screen, rows, cols) == 0)
+   {
+      ti_out_set_sink(ti_vterm_sink, vt);
+
+      long long total = 0;
+      int failures = 0;
+      for (int frame=0; frame<200; ++frame)
+      {
+         snprintf(buff, sizeof(buff), "frame %d", frame);
+         ti_screen_put(&screen, frame % rows, frame % 20, buff, frame % 3 ? 0 : TI_ATTR_BOLD);
+         ti_screen_fill(&screen, (frame + 5) % rows, 0, cols, 0x2500, 0);
+         if (frame % 7 == 0)
+            ti_screen_scroll(&screen, 1, rows - 2, 0, cols - 1, frame % 2 ? 1 : -1);
+         if (frame % 11 == 0)
+            ti_screen_scroll(&screen, 2, rows - 3, 5, 30, 2);
+
+         size_t before = ti_vterm_bytes(vt);
+         ti_screen_render(&screen);
+         total += ti_vterm_bytes(vt) - before;
+
+         int row, col;
+         if (ti_vterm_diff(vt, &screen, &row, &col))
+         {
+            printf("frame %d differs at %d,%d\n", frame, row, col);
+            ++failures;
+         }
+      }
+
+      ti_out_set_sink(NULL, NULL);
+
+      for (int row=0; row<rows; ++row)
+         if (ti_vterm_row_text(vt, row, buff, sizeof(buff)) >= 0)
+            printf("|%s\n", buff);
+
+      printf("%d frames differ, %lld bytes, %d unknown sequences\n",
+             failures, total, ti_vterm_unknown(vt));
+      ti_screen_destroy(&screen);
+   }
+
+   ti_vterm_destroy(vt);
+   TIV_destroy_arrays(0, NULL);
+   return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/* Local Variables:          */
+/* compile-command:   "gcc  \*/
+/* -Wall -Werror -pedantic  \*/
+/* -ggdb -std=c99           \*/
+/* -DSL_VTERM_MAIN          \*/
+/* -fsanitize=address       \*/
+/* -ltinfo                  \*/
+/* -o sl_vterm              \*/
+/* sl_vterm.c"               */
+/* End:                      */
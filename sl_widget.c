@@ -0,0 +1,454 @@
+/**
+ * @file sl_widget.c
+ * @brief Status line, progress bar and spinner widgets pinned below
+ *        scrolling output.
+ *
+ * A widget owns a span of a screen row and remembers what it last
+ * sent there.  Drawing a widget compares the new text against that
+ * memory and sends only the characters that changed, so a counter
+ * going from 12345 to 12346 costs one digit plus cursor save, move
+ * and restore.
+ *
+ * Drawing is paced to the frame rate (see @ref ti_frame_set_rate): a
+ * widget updated millions of times per second only composes its text
+ * in memory until the next frame is due.  Call @ref ti_widget_refresh
+ * to show the latest text immediately, for example before exiting.
+ *
+ * Use @ref ti_widget_pin_lines to take lines at the bottom of the
+ * terminal out of the scroll region, so ordinary output scrolls above
+ * the widgets without disturbing them.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "termintel.h"
+
+/** @brief Number of lines taken by @ref ti_widget_pin_lines */
+static int g_pinned_lines = 0;
+
+/**
+ * @brief Initialize a widget occupying part of a screen row.
+ * @param "wid"     widget to initialize
+ * @param "row"     screen row, often one returned by @ref ti_widget_pin_lines
+ * @param "col"     first column
+ * @param "width"   number of columns owned by the widget
+ * @param "attr"    TI_ATTR_ flags for the widget text
+ * @return 0 for success, otherwise errno.
+ */
+int ti_widget_init(TI_WIDGET *wid, int row, int col, int width, unsigned short attr)
+{
+   memset(wid, 0, sizeof(TI_WIDGET));
+   if (width <= 0)
+      return EINVAL;
+
+   wid->want = (unsigned int*)malloc(width * sizeof(unsigned int));
+   wid->shown = (unsigned int*)malloc(width * sizeof(unsigned int));
+   wid->gcache = ti_gcache_create();
+   if (!wid->want || !wid->shown || !wid->gcache)
+   {
+      ti_widget_destroy(wid);
+      return ENOMEM;
+   }
+
+   wid->row = row;
+   wid->col = col;
+   wid->width = width;
+   wid->attr = attr;
+   wid->memo = -1;
+   for (int i=0; i<width; ++i)
+      wid->want[i] = ' ';
+
+   return 0;
+}
+
+/**
+ * @brief Free memory allocated by @ref ti_widget_init.
+ */
+void ti_widget_destroy(TI_WIDGET *wid)
+{
+   free(wid->want);
+   free(wid->shown);
+   ti_gcache_destroy(wid->gcache);
+   wid->want = wid->shown = NULL;
+   wid->gcache = NULL;
+   wid->width = 0;
+}
+
+/**
+ * @brief Forget what the widget shows, so the next draw sends all of it.
+ *
+ * Use after the screen has been cleared.
+ */
+void ti_widget_invalidate(TI_WIDGET *wid)
+{
+   wid->valid = 0;
+   wid->memo = -1;
+}
+
+/**
+ * @brief Send the character in column @p col of @p cells, which is
+ *        @p want or @p shown.
+ * @return number of columns the character takes.
+ */
+static int send_cell(const TI_WIDGET *wid, const unsigned int *cells, int col)
+{
+   int len;
+   const char *cluster = ti_gcache_cluster(wid->gcache, cells[col], &len, NULL);
+   if (cluster)
+      ti_out_write(cluster, len);
+   else
+      ti_out_code(cells[col]);
+
+   return col + 1 < wid->width && cells[col + 1] == TI_CELL_WIDE_TAIL ? 2 : 1;
+}
+
+/**
+ * @brief Send the characters that differ between @p want and @p shown.
+ *
+ * The right half of a wide character is sent with its left half.
+ *
+ * @return number of characters sent.
+ */
+static int send_changes(TI_WIDGET *wid)
+{
+   int changed = 0;
+   int cursor = -1;   // widget column of the terminal cursor, -1 before the first move
+   unsigned short attr = 0;
+
+   for (int i=0; i<wid->width; ++i)
+   {
+      if (wid->want[i] == TI_CELL_WIDE_TAIL)
+      {
+         wid->shown[i] = TI_CELL_WIDE_TAIL;
+         continue;
+      }
+      if (wid->valid && wid->want[i] == wid->shown[i])
+         continue;
+
+      if (changed == 0)
+      {
+         ti_out_begin();
+         TIV_execute(caps_LIB, LIB_SAVE_CURSOR);
+         attr = ti_out_attr((unsigned short)~0, wid->attr);
+      }
+
+      int gap = i - cursor;
+      if (cursor >= 0 && gap > 0 && gap <= 4)
+      {
+         // Rewriting a few unchanged characters is cheaper than moving
+         while (cursor < i)
+            cursor += send_cell(wid, wid->shown, cursor);
+      }
+      else if (cursor != i)
+         TIV_execute_params(caps_LIB, LIB_CURSOR_ADDRESS, wid->row, wid->col + i);
+
+      cursor = i + send_cell(wid, wid->want, i);
+      wid->shown[i] = wid->want[i];
+      ++changed;
+   }
+
+   if (changed)
+   {
+      ti_out_attr(attr, 0);
+      TIV_execute(caps_LIB, LIB_RESTORE_CURSOR);
+      ti_out_end();
+   }
+
+   wid->valid = 1;
+   return changed;
+}
+
+/**
+ * @brief Lay out UTF-8 text in @p want from column @p col to the end
+ *        of the widget, padding with spaces.
+ *
+ * Each grapheme cluster takes one column, or two for a wide cluster,
+ * whose second column is @ref TI_CELL_WIDE_TAIL.  A wide cluster that
+ * doesn't fit before the end is left out.  Control characters are
+ * shown as `?`.
+ */
+static void compose_text(TI_WIDGET *wid, int col, const char *text)
+{
+   size_t len = strlen(text);
+   size_t pos = 0;
+
+   while (pos < len && col < wid->width)
+   {
+      int width;
+      int bytes = ti_grapheme_next(text + pos, len - pos, &width);
+      unsigned int code = '?';
+
+      if (width < 0)
+         width = 1;
+      else if (width > 0)
+         code = ti_gcache_intern(wid->gcache, text + pos, bytes, width);
+      pos += bytes;
+
+      if (width == 0)
+         continue;
+      if (col + width > wid->width)
+         break;
+
+      wid->want[col++] = code;
+      if (width == 2)
+         wid->want[col++] = TI_CELL_WIDE_TAIL;
+   }
+   while (col < wid->width)
+      wid->want[col++] = ' ';
+}
+
+/**
+ * @brief Send pending changes if the frame interval has passed.
+ */
+static int update(TI_WIDGET *wid)
+{
+   long long now = ti_clock_ns();
+   if (wid->valid && now < wid->next_draw)
+      return 0;
+
+   wid->next_draw = now + (long long)ti_frame_get_interval_ms() * 1000000;
+   return send_changes(wid);
+}
+
+/**
+ * @brief Send the widget's latest text now, ignoring the frame rate.
+ * @return number of characters sent.
+ */
+int ti_widget_refresh(TI_WIDGET *wid)
+{
+   wid->next_draw = ti_clock_ns() + (long long)ti_frame_get_interval_ms() * 1000000;
+   return send_changes(wid);
+}
+
+/**
+ * @brief Set the text of a widget, padded or clipped to its width.
+ *
+ * Control characters are shown as `?`.
+ *
+ * @param "wid"    widget
+ * @param "text"   UTF-8 string
+ * @return number of characters sent to the terminal, usually 0
+ *         between frames.
+ */
+int ti_widget_text(TI_WIDGET *wid, const char *text)
+{
+   compose_text(wid, 0, text);
+   return update(wid);
+}
+
+/**
+ * @brief Show a progress bar with a percentage.
+ *
+ * The bar is only composed when the filled length or the percentage
+ * changes, so calling this for every item of a large job is cheap.
+ *
+ * @param "wid"     widget
+ * @param "done"    units of work completed
+ * @param "total"   units of work in the job
+ * @return number of characters sent to the terminal.
+ */
+int ti_widget_progress(TI_WIDGET *wid, long long done, long long total)
+{
+   char buff[16];
+   int barwidth = wid->width - 7;   // room for brackets and " 100%"
+
+   if (total <= 0)
+      total = 1;
+   if (done < 0)
+      done = 0;
+   if (done > total)
+      done = total;
+
+   int percent = (int)(done * 100 / total);
+   int filled = barwidth > 0 ? (int)(done * barwidth / total) : 0;
+
+   long long memo = (long long)filled * 1000 + percent;
+   if (memo == wid->memo && wid->valid)
+      return update(wid);
+   wid->memo = memo;
+
+   int col = 0;
+   if (barwidth > 0)
+   {
+      wid->want[col++] = '[';
+      for (int i=0; i<barwidth; ++i)
+         wid->want[col++] = i < filled ? '#' : '.';
+      wid->want[col++] = ']';
+   }
+
+   snprintf(buff, sizeof(buff), " %3d%%", percent);
+   for (const char *ptr = buff; *ptr && col < wid->width; ++ptr)
+      wid->want[col++] = *ptr;
+   while (col < wid->width)
+      wid->want[col++] = ' ';
+
+   return update(wid);
+}
+
+/**
+ * @brief Show a spinner followed by an optional label.
+ *
+ * The spinner turns with time, ten steps per second, not with the
+ * number of calls.
+ *
+ * @param "wid"     widget
+ * @param "label"   text following the spinner, NULL to keep the current label
+ * @return number of characters sent to the terminal.
+ */
+int ti_widget_spinner(TI_WIDGET *wid, const char *label)
+{
+   static const char phases[] = "|/-\\";
+   long long phase = ti_clock_ns() / 100000000 % 4;
+
+   if (label)
+   {
+      if (wid->width > 1)
+         wid->want[1] = ' ';
+      compose_text(wid, 2, label);
+   }
+   else if (phase == wid->memo && wid->valid)
+      return 0;
+
+   wid->memo = phase;
+   wid->want[0] = phases[phase];
+   return update(wid);
+}
+
+/**
+ * @brief Reserve lines at the bottom of the terminal for widgets.
+ *
+ * The scroll region is reduced to exclude the reserved lines, so
+ * output that scrolls stays above them.  Existing text is scrolled
+ * up to make room.
+ *
+ * @param "count"   number of lines to reserve
+ * @return first reserved row, or -1 if the terminal can't do it.
+ */
+int ti_widget_pin_lines(int count)
+{
+   int rows, cols;
+   ti_get_screen_size(&rows, &cols);
+
+   if (count <= 0 || rows <= count || !TIV_get_sequence(&caps_LIB[LIB_CHANGE_SCROLL_REGION]))
+      return -1;
+
+   ti_out_begin();
+   // Scroll existing output out of the reserved lines
+   for (int i=0; i<count; ++i)
+      ti_out_putc('\n');
+   for (int i=0; i<count; ++i)
+      TIV_execute(caps_LIB, LIB_CURSOR_UP);
+   TIV_execute(caps_LIB, LIB_SAVE_CURSOR);
+   TIV_execute_params(caps_LIB, LIB_CHANGE_SCROLL_REGION, 0, rows - count - 1);
+   TIV_execute(caps_LIB, LIB_RESTORE_CURSOR);
+   ti_out_end();
+
+   g_pinned_lines = count;
+   return rows - count;
+}
+
+/**
+ * @brief Restore the full scroll region and clear the reserved lines.
+ */
+void ti_widget_unpin_lines(void)
+{
+   int rows, cols;
+
+   if (g_pinned_lines == 0)
+      return;
+
+   ti_get_screen_size(&rows, &cols);
+
+   ti_out_begin();
+   TIV_execute(caps_LIB, LIB_SAVE_CURSOR);
+   TIV_execute_params(caps_LIB, LIB_CHANGE_SCROLL_REGION, 0, rows - 1);
+   TIV_execute(caps_LIB, LIB_RESTORE_CURSOR);
+   TIV_execute(caps_LIB, LIB_SAVE_CURSOR);
+   for (int row=rows - g_pinned_lines; row<rows; ++row)
+   {
+      TIV_execute_params(caps_LIB, LIB_CURSOR_ADDRESS, row, 0);
+      TIV_execute(caps_LIB, LIB_CLR_EOL);
+   }
+   TIV_execute(caps_LIB, LIB_RESTORE_CURSOR);
+   ti_out_end();
+
+   g_pinned_lines = 0;
+}
+
+// Hide debugging code from Doxygen
+/** @cond */
+
+#ifdef SL_WIDGET_MAIN
+
+#include "sl_caps.c"
+#include "sl_ioctl.c"
+#include "sl_libcaps.c"
+#include "sl_output.c"
+#include "sl_screen.c"
+#include "sl_utf8.c"
+#include "sl_gcache.c"
+#include "sl_frame.c"
+#include "sl_record.c"
+
+int main(int argc, const char **argv)
+{
+   TI_WIDGET status, progress, spinner;
+   long long total = 5000000;
+   char buff[64];
+
+   if (!TIV_setup(0, NULL))
+      return 1;
+
+   int row = ti_widget_pin_lines(2);
+   if (row >= 0)
+   {
+      int rows, cols;
+      ti_get_screen_size(&rows, &cols);
+
+      ti_widget_init(&spinner, row, 0, 20, 0);
+      ti_widget_init(&status, row, 20, cols - 20, TI_ATTR_BOLD);
+      ti_widget_init(&progress, row + 1, 0, cols, TI_ATTR_REVERSE);
+
+      for (long long i=0; i<=total; ++i)
+      {
+         if (i % 1000000 == 0)
+            printf("Passed item %lld.\n", i);
+
+         snprintf(buff, sizeof(buff), "item %lld of %lld", i, total);
+         ti_widget_text(&status, buff);
+         ti_widget_progress(&progress, i, total);
+         ti_widget_spinner(&spinner, i == 0 ? "working" : NULL);
+      }
+
+      ti_widget_refresh(&status);
+      ti_widget_refresh(&progress);
+
+      ti_widget_destroy(&spinner);
+      ti_widget_destroy(&status);
+      ti_widget_destroy(&progress);
+      ti_widget_unpin_lines();
+   }
+
+   TIV_destroy_arrays(0, NULL);
+   return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/* Local Variables:          */
+/* compile-command:   "gcc  \*/
+/* -Wall -Werror -pedantic  \*/
+/* -ggdb -std=c99           \*/
+/* -DSL_WIDGET_MAIN         \*/
+/* -fsanitize=address       \*/
+/* -ltinfo                  \*/
+/* -o sl_widget             \*/
+/* sl_widget.c"              */
+/* End:                      */
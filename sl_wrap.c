@@ -0,0 +1,626 @@
+/**
+ * @file sl_wrap.c
+ * @brief Text shown in a @ref TI_PANE with long lines wrapped.
+ *
+ * A @ref TI_WRAP keeps a copy of its text and an index of where each
+ * line starts.  The number of rows a line takes when wrapped is
+ * measured only when it is needed, and remembered with the width it
+ * was measured at.  The view is anchored to a byte of the line at its
+ * top, not to a row number.
+ *
+ * When the pane changes width, nothing is rewrapped in advance.  The
+ * anchor is moved to the start of its row at the new width, and only
+ * the lines that are drawn, or skipped over by scrolling, are measured
+ * again.  A resize costs about the same however long the text is.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "termintel.h"
+
+#define TI_WRAP_TAB 8
+#define TI_WRAP_MAX_ROWS 0xFFFF
+
+/**
+ * @brief Get a line of the text.
+ */
+static const char *line_text(const TI_WRAP *wrap, long long line, size_t *len)
+{
+   *len = wrap->offsets[line + 1] - wrap->offsets[line];
+   return wrap->text + wrap->offsets[line];
+}
+
+/**
+ * @brief Lay out one row of text, wrapping at the width of the view.
+ * @param "wrap"      wrapped text
+ * @param "text"      rest of the line, from the start of the row
+ * @param "len"       bytes in @p text
+ * @param "scr_row"   screen row to draw the row on, or -1 to only measure
+ * @return bytes in the row, at least one unless @p len is 0.
+ */
+static size_t layout_row(TI_WRAP *wrap, const char *text, size_t len, int scr_row)
+{
+   TI_PANE *view = &wrap->view;
+   int cols = view->cols;
+   int column = 0;
+   size_t pos = 0;
+
+   if (cols <= 0)
+      return len;
+
+   while (pos < len && column < cols)
+   {
+      unsigned int code;
+      int width;
+      int bytes = ti_grapheme_next(text + pos, len - pos, &width);
+
+      if (text[pos] == '\t')
+      {
+         code = ' ';
+         width = (column / TI_WRAP_TAB + 1) * TI_WRAP_TAB - column;
+         if (column + width > cols)
+            width = cols - column;
+      }
+      else if (width < 0)
+      {
+         code = '?';
+         width = 1;
+      }
+      else
+      {
+         // Wrap before a character that doesn't fit, unless the row is empty
+         if (column + width > cols && column > 0)
+            break;
+         code = scr_row >= 0 ? ti_gcache_intern(view->screen->gcache, text + pos, bytes, width) : ' ';
+      }
+
+      if (scr_row >= 0)
+      {
+         if (width == 2 && column + 2 <= cols)
+            ti_screen_set_cell(view->screen, scr_row, view->left + column, code, 0);
+         else
+            ti_screen_fill(view->screen, scr_row, view->left + column,
+                           width < cols - column ? width : cols - column,
+                           width == 2 ? ' ' : code, 0);
+      }
+
+      column += width;
+      pos += bytes;
+   }
+
+   if (scr_row >= 0 && column < cols)
+      ti_screen_fill(view->screen, scr_row, view->left + column, cols - column, ' ', 0);
+
+   return pos;
+}
+
+/**
+ * @brief Rows taken by a line at the width of the view, measuring it
+ *        if it wasn't measured at this width.
+ */
+static int line_rows(TI_WRAP *wrap, long long line)
+{
+   int cols = wrap->view.cols;
+   if (cols <= 0)
+      return 1;
+   if (wrap->row_width[line] == cols)
+      return wrap->row_counts[line];
+
+   size_t len;
+   const char *text = line_text(wrap, line, &len);
+   size_t pos = 0;
+   int rows = 0;
+   do
+   {
+      pos += layout_row(wrap, text + pos, len - pos, -1);
+      ++rows;
+   }
+   while (pos < len && rows < TI_WRAP_MAX_ROWS);
+
+   wrap->row_counts[line] = (unsigned short)rows;
+   wrap->row_width[line] = (unsigned short)cols;
+   return rows;
+}
+
+/**
+ * @brief Offset in @p line of the start of the row containing @p offset.
+ * @param "previous"   if set, the start of the row before that one
+ */
+static size_t row_start(TI_WRAP *wrap, long long line, size_t offset, int previous)
+{
+   size_t len;
+   const char *text = line_text(wrap, line, &len);
+   size_t start = 0, before = 0;
+
+   for (;;)
+   {
+      size_t next = start + layout_row(wrap, text + start, len - start, -1);
+      if (next > offset || next >= len)
+         break;
+      before = start;
+      start = next;
+   }
+
+   return previous ? before : start;
+}
+
+/**
+ * @brief Move the anchor down by up to @p count rows.
+ * @return rows moved.
+ */
+static int advance(TI_WRAP *wrap, int count)
+{
+   int moved = 0;
+
+   if (wrap->count == 0)
+      return 0;
+
+   while (moved < count)
+   {
+      long long line = wrap->top_line;
+      if (line + 1 >= wrap->count)
+      {
+         // Last line: move within it
+         size_t len;
+         const char *text = line_text(wrap, line, &len);
+         size_t next = wrap->top_offset + layout_row(wrap, text + wrap->top_offset,
+                                                     len - wrap->top_offset, -1);
+         if (next >= len)
+            break;
+         wrap->top_offset = next;
+         ++moved;
+      }
+      else if (wrap->top_offset == 0 && count - moved >= line_rows(wrap, line))
+      {
+         // Skip the whole line
+         moved += line_rows(wrap, line);
+         ++wrap->top_line;
+      }
+      else
+      {
+         size_t len;
+         const char *text = line_text(wrap, line, &len);
+         size_t next = wrap->top_offset + layout_row(wrap, text + wrap->top_offset,
+                                                     len - wrap->top_offset, -1);
+         if (next >= len)
+         {
+            ++wrap->top_line;
+            wrap->top_offset = 0;
+         }
+         else
+            wrap->top_offset = next;
+         ++moved;
+      }
+   }
+
+   return moved;
+}
+
+/**
+ * @brief Move the anchor up by up to @p count rows.
+ * @return rows moved.
+ */
+static int retreat(TI_WRAP *wrap, int count)
+{
+   int moved = 0;
+
+   while (moved < count)
+   {
+      if (wrap->top_offset > 0)
+      {
+         wrap->top_offset = row_start(wrap, wrap->top_line, wrap->top_offset, 1);
+         ++moved;
+      }
+      else if (wrap->top_line == 0)
+         break;
+      else
+      {
+         long long line = --wrap->top_line;
+         int rows = line_rows(wrap, line);
+         if (count - moved >= rows)
+            moved += rows;
+         else
+         {
+            // Start at the last row of the line and keep going up
+            size_t len;
+            line_text(wrap, line, &len);
+            wrap->top_offset = row_start(wrap, line, len, 0);
+            ++moved;
+         }
+      }
+   }
+
+   return moved;
+}
+
+/**
+ * @brief Count the rows from the anchor to the end, up to @p limit.
+ */
+static int rows_below(TI_WRAP *wrap, int limit)
+{
+   if (wrap->count == 0)
+      return 0;
+
+   size_t len;
+   const char *text = line_text(wrap, wrap->top_line, &len);
+   int rows = 0;
+   for (size_t pos = wrap->top_offset; rows < limit; )
+   {
+      pos += layout_row(wrap, text + pos, len - pos, -1);
+      ++rows;
+      if (pos >= len)
+         break;
+   }
+
+   for (long long line = wrap->top_line + 1; line < wrap->count && rows < limit; ++line)
+      rows += line_rows(wrap, line);
+
+   return rows;
+}
+
+/**
+ * @brief Anchor the view so the last row of the text is at its bottom.
+ */
+static void anchor_bottom(TI_WRAP *wrap)
+{
+   if (wrap->count == 0)
+      return;
+
+   size_t len;
+   line_text(wrap, wrap->count - 1, &len);
+   wrap->top_line = wrap->count - 1;
+   wrap->top_offset = row_start(wrap, wrap->top_line, len, 0);
+   retreat(wrap, wrap->view.rows - 1);
+}
+
+/**
+ * @brief Draw the rows of the view from @p first to the bottom.
+ */
+static void draw_rows(TI_WRAP *wrap, int first)
+{
+   TI_PANE *view = &wrap->view;
+   long long line = wrap->top_line;
+   size_t pos = wrap->top_offset;
+   int row = 0;
+
+   while (row < view->rows && line < wrap->count)
+   {
+      size_t len;
+      const char *text = line_text(wrap, line, &len);
+
+      if (row < first && pos == 0 && row + line_rows(wrap, line) <= first)
+      {
+         // Skip the whole line without laying it out
+         row += line_rows(wrap, line);
+         ++line;
+         continue;
+      }
+
+      pos += layout_row(wrap, text + pos, len - pos, row >= first ? view->top + row : -1);
+      ++row;
+      if (pos >= len)
+      {
+         ++line;
+         pos = 0;
+      }
+   }
+
+   for (; row < view->rows; ++row)
+      if (row >= first)
+         ti_screen_fill(view->screen, view->top + row, view->left, view->cols, ' ', 0);
+}
+
+/**
+ * @brief Initialize an empty @ref TI_WRAP.
+ * @param "wrap"   wrapped text to initialize
+ * @param "view"   part of the screen that shows the text
+ * @return 0 for success, otherwise errno.
+ */
+int ti_wrap_init(TI_WRAP *wrap, const TI_PANE *view)
+{
+   memset(wrap, 0, sizeof(TI_WRAP));
+   wrap->view = *view;
+   wrap->capacity = 1024;
+   wrap->offsets = (size_t*)calloc(wrap->capacity + 1, sizeof(size_t));
+   wrap->row_counts = (unsigned short*)calloc(wrap->capacity, sizeof(unsigned short));
+   wrap->row_width = (unsigned short*)calloc(wrap->capacity, sizeof(unsigned short));
+   if (!wrap->offsets || !wrap->row_counts || !wrap->row_width)
+   {
+      ti_wrap_destroy(wrap);
+      return ENOMEM;
+   }
+
+   return 0;
+}
+
+/**
+ * @brief Free the text and index of a @ref TI_WRAP.
+ */
+void ti_wrap_destroy(TI_WRAP *wrap)
+{
+   free(wrap->text);
+   free(wrap->offsets);
+   free(wrap->row_counts);
+   free(wrap->row_width);
+   memset(wrap, 0, sizeof(TI_WRAP));
+}
+
+/**
+ * @brief Check whether the last row of the text is in the view.
+ */
+static int at_bottom(TI_WRAP *wrap)
+{
+   return rows_below(wrap, wrap->view.rows + 1) <= wrap->view.rows;
+}
+
+/**
+ * @brief Add a line to the end of the text.
+ *
+ * If @p follow is set and the end of the text was in view, the view
+ * scrolls to keep it there, and only the new rows are drawn.
+ *
+ * @param "wrap"   wrapped text
+ * @param "text"   line to add, without a newline
+ * @param "len"    bytes in @p text
+ * @return 0 for success, otherwise errno.
+ */
+int ti_wrap_append(TI_WRAP *wrap, const char *text, size_t len)
+{
+   if (wrap->count == wrap->capacity)
+   {
+      long long capacity = wrap->capacity * 2;
+      size_t *offsets = (size_t*)realloc(wrap->offsets, (capacity + 1) * sizeof(size_t));
+      if (!offsets)
+         return ENOMEM;
+      wrap->offsets = offsets;
+
+      unsigned short *counts = (unsigned short*)realloc(wrap->row_counts, capacity * sizeof(unsigned short));
+      if (!counts)
+         return ENOMEM;
+      wrap->row_counts = counts;
+
+      unsigned short *widths = (unsigned short*)realloc(wrap->row_width, capacity * sizeof(unsigned short));
+      if (!widths)
+         return ENOMEM;
+      wrap->row_width = widths;
+
+      wrap->capacity = capacity;
+   }
+
+   size_t used = wrap->offsets[wrap->count];
+   if (used + len > wrap->text_capacity)
+   {
+      size_t capacity = wrap->text_capacity ? wrap->text_capacity : 4096;
+      while (capacity < used + len)
+         capacity *= 2;
+      char *buff = (char*)realloc(wrap->text, capacity);
+      if (!buff)
+         return ENOMEM;
+      wrap->text = buff;
+      wrap->text_capacity = capacity;
+   }
+
+   int follow = wrap->follow && at_bottom(wrap);
+   int shown = follow ? rows_below(wrap, wrap->view.rows) : 0;
+
+   memcpy(wrap->text + used, text, len);
+   wrap->row_width[wrap->count] = 0;
+   wrap->offsets[++wrap->count] = used + len;
+
+   if (follow)
+   {
+      int rows = line_rows(wrap, wrap->count - 1);
+      int excess = shown + rows - wrap->view.rows;
+      if (excess <= 0)
+         draw_rows(wrap, shown);
+      else if (excess < wrap->view.rows)
+      {
+         // Let the terminal move the rows that stay
+         advance(wrap, excess);
+         ti_pane_scroll(&wrap->view, excess);
+         draw_rows(wrap, wrap->view.rows - rows < 0 ? 0 : wrap->view.rows - rows);
+      }
+      else
+      {
+         anchor_bottom(wrap);
+         draw_rows(wrap, 0);
+      }
+   }
+
+   return 0;
+}
+
+/**
+ * @brief Write every row of the view into the screen buffer.
+ */
+void ti_wrap_draw(TI_WRAP *wrap)
+{
+   draw_rows(wrap, 0);
+}
+
+/**
+ * @brief Move the view by @p count rows.
+ * @param "wrap"    wrapped text
+ * @param "count"   rows to move toward the end, negative to move
+ *                  toward the beginning
+ */
+void ti_wrap_scroll(TI_WRAP *wrap, int count)
+{
+   long long line = wrap->top_line;
+   size_t offset = wrap->top_offset;
+   int rows = wrap->view.rows;
+   int delta;
+
+   if (count > 0)
+   {
+      delta = advance(wrap, count);
+      // Keep the view full
+      int below = rows_below(wrap, rows);
+      if (below < rows)
+         delta -= retreat(wrap, rows - below);
+   }
+   else
+      delta = -retreat(wrap, -count);
+
+   if (line == wrap->top_line && offset == wrap->top_offset)
+      return;
+
+   if (delta > 0 && delta < rows)
+   {
+      ti_pane_scroll(&wrap->view, delta);
+      draw_rows(wrap, rows - delta);
+   }
+   else if (delta < 0 && -delta < rows)
+   {
+      ti_pane_scroll(&wrap->view, delta);
+      draw_rows(wrap, 0);
+   }
+   else
+      draw_rows(wrap, 0);
+}
+
+/**
+ * @brief Show the text in a new rectangle, usually after the screen
+ *        was resized with @ref ti_screen_resize.
+ *
+ * The line at the top of the view stays at the top.  If the view was
+ * following the end of the text, it still shows the end.  Only the
+ * lines in the view are wrapped at the new width.
+ *
+ * @param "wrap"   wrapped text
+ * @param "view"   new part of the screen for the text
+ */
+void ti_wrap_resize(TI_WRAP *wrap, const TI_PANE *view)
+{
+   int follow = wrap->follow && at_bottom(wrap);
+
+   wrap->view = *view;
+   if (wrap->count && view->cols > 0)
+   {
+      if (follow)
+         anchor_bottom(wrap);
+      else
+         wrap->top_offset = row_start(wrap, wrap->top_line, wrap->top_offset, 0);
+   }
+
+   draw_rows(wrap, 0);
+}
+
+// Hide debugging code from Doxygen
+/** @cond */
+
+#ifdef SL_WRAP_MAIN
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "sl_caps.c"
+#include "sl_ioctl.c"
+#include "sl_libcaps.c"
+#include "sl_output.c"
+#include "sl_screen.c"
+#include "sl_utf8.c"
+#include "sl_gcache.c"
+#include "sl_frame.c"
+#include "sl_record.c"
+#include "sl_pane.c"
+#include "sl_tios.c"
+#include "sl_input.c"
+
+int main(int argc, const char **argv)
+{
+   TI_SCREEN screen;
+   TI_PANE pane;
+   TI_WRAP wrap;
+   TI_INPUT input;
+   TI_EVENT event;
+   int rows, cols;
+   char buff[512];
+
+   if (!TIV_setup(0, NULL))
+      return 1;
+
+   ti_winch_init(50);
+   ti_get_screen_size(&rows, &cols);
+   if (ti_screen_init(&screen, rows, cols) == 0
+       && ti_input_init(&input, STDIN_FILENO, 0, NULL) == 0)
+   {
+      ti_pane_init(&pane, &screen, 0, 0, rows, cols);
+      if (ti_wrap_init(&wrap, &pane) == 0)
+      {
+         // A long document, wrapped only where it is shown
+         for (int i=0; i<1000000; ++i)
+         {
+            int len = snprintf(buff, sizeof(buff), "Line %d:", i);
+            for (int word=0; word < (i * 7) % 40; ++word)
+               len += snprintf(buff + len, sizeof(buff) - len, " word%d", word);
+            ti_wrap_append(&wrap, buff, len);
+         }
+
+         wrap.follow = 1;
+         ti_wrap_resize(&wrap, &pane);
+         ti_frame_present(&screen);
+
+         tios_save_incoming();
+         tios_disable_echo();
+
+         int quit = 0;
+         while (!quit && ti_input_next(&input, &event, -1) == 0)
+         {
+            if (event.type == TI_EVENT_RESIZE)
+            {
+               long long start = ti_clock_ns();
+               ti_screen_resize(&screen, event.row, event.col);
+               ti_pane_init(&pane, &screen, 0, 0, event.row, event.col);
+               ti_wrap_resize(&wrap, &pane);
+               ti_frame_present(&screen);
+               fprintf(stderr, "resize in %lld us\r\n", (ti_clock_ns() - start) / 1000);
+               continue;
+            }
+
+            switch(event.code)
+            {
+               case 'q': quit = 1; break;
+               case 'j': ti_wrap_scroll(&wrap, 1); break;
+               case 'k': ti_wrap_scroll(&wrap, -1); break;
+               case ' ': ti_wrap_scroll(&wrap, pane.rows - 1); break;
+               case 'b': ti_wrap_scroll(&wrap, 1 - pane.rows); break;
+               case 'a':
+                  snprintf(buff, sizeof(buff), "Appended at %lld", ti_clock_ns());
+                  ti_wrap_append(&wrap, buff, strlen(buff));
+                  break;
+            }
+            ti_frame_present(&screen);
+         }
+
+         tios_restore_incoming();
+         ti_wrap_destroy(&wrap);
+      }
+
+      ti_input_destroy(&input);
+      ti_screen_destroy(&screen);
+   }
+
+   ti_winch_release();
+   TIV_destroy_arrays(0, NULL);
+   return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/* Local Variables:          */
+/* compile-command:   "gcc  \*/
+/* -Wall -Werror -pedantic  \*/
+/* -ggdb -std=c99           \*/
+/* -DSL_WRAP_MAIN           \*/
+/* -fsanitize=address       \*/
+/* -ltinfo                  \*/
+/* -o sl_wrap               \*/
+/* sl_wrap.c"                */
+/* End:                      */
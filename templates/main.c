@@ -59,6 +59,7 @@ void main_deinit(int signal)
    // Release memory after last use
    TIV_destroy_arrays(g_capset_count, g_capsets);
 
+   ti_winch_release();
    tios_restore_incoming();
 
    if (signal)
@@ -91,7 +92,9 @@ int main_init(void)
       signal(SIGKILL, main_deinit);
       signal(SIGTSTP, main_deinit);
 
-      ti_get_screen_size(&g_stall, &g_stall);
+      // Cache the screen size, updated when the terminal is resized
+      ti_winch_init(50);
+      ti_get_screen_size(&g_stall, &g_swide);
 
       TIV_execute(caps_MODES, MODES_ENTER_CA_MODE);
       TIV_execute(caps_MODES, MODES_KEYPAD_XMIT);
@@ -22,6 +22,7 @@ typedef struct terminfo_value {
    char code[2];           ///< Termcap code
    char *sequence;         ///< escape sequence for this terminal for the code
    int  index;             ///< index reference into array containing this element.
+   int  padded;            ///< set if the sequence has `$<n>` padding, which needs tputs
 } TIV;
 
 int TIV_is_terminator(TIV *tiv);
@@ -49,6 +50,7 @@ void TIV_print_sequence(const char *seq);
 void TIV_translate_sequence(char *buff, int len, const char *seq);
 void TIV_dump(TIV *tiv, const char **names, int names_width);
 void TIV_dump_array(TIV *tiv, const char **names);
+void TIV_dump_array_packed(TIV *tiv, const char *strings, const unsigned short *offsets);
 
 // Searching functions
 int TIV_find_index_by_sequence(TIV *tiv, const char *sequence);
@@ -61,6 +63,7 @@ void TIV_execute(const TIV *tiv, int index);
 void TIV_execute_with_lines(const TIV *tiv, int index, int linecount);
 void TIV_execute_params(const TIV *tiv, int index,...);
 void TIV_execute_params_with_lines(const TIV *tiv, int index, int linecount,...);
+void TIV_execute_parm(const TIV *tiv, int index, int linecount, int count, const int *parms);
 
 /* sl_tios.c */
 void tios_save_incoming(void);
@@ -76,9 +79,689 @@ int ti_get_keypress(int *key_index,
                     char *typed_char,
                     TIV *recognized_keys,
                     const char **sequence);
+int ti_get_keypress_code(int *key_index,
+                         unsigned int *code,
+                         TIV *recognized_keys,
+                         const char **sequence);
 
 
 /* sl_ioctl.c */
+
+/**
+ * @brief Function called by @ref ti_winch_dispatch with the new size
+ *        of the terminal.
+ */
+typedef void (*TI_RESIZE_HANDLER)(int rows, int cols, void *data);
+
 void ti_get_screen_size(int *rows, int *cols);
+int  ti_winch_init(int debounce_ms);
+void ti_winch_release(void);
+int  ti_winch_fd(void);
+int  ti_winch_subscribe(TI_RESIZE_HANDLER handler, void *data);
+void ti_winch_unsubscribe(TI_RESIZE_HANDLER handler, void *data);
+int  ti_winch_dispatch(void);
+
+/* sl_libcaps.c */
+
+/**
+ * @brief Index values into @ref caps_LIB, the capset used by the library itself.
+ *
+ * The library cannot rely on the capsets generated for an application,
+ * so it keeps its own small set of entries for rendering.  The array
+ * is initialized by @ref TIV_setup.
+ */
+enum enum_LIB {
+   LIB_CURSOR_ADDRESS,
+   LIB_CLR_EOL,
+   LIB_CLEAR_SCREEN,
+   LIB_EXIT_ATTRIBUTE_MODE,
+   LIB_ENTER_BOLD_MODE,
+   LIB_ENTER_DIM_MODE,
+   LIB_ENTER_UNDERLINE_MODE,
+   LIB_ENTER_REVERSE_MODE,
+   LIB_ENTER_STANDOUT_MODE,
+   LIB_CURSOR_INVISIBLE,
+   LIB_CURSOR_NORMAL,
+   LIB_CHANGE_SCROLL_REGION,
+   LIB_SAVE_CURSOR,
+   LIB_RESTORE_CURSOR,
+   LIB_CURSOR_UP,
+   LIB_SCROLL_FORWARD,
+   LIB_SCROLL_REVERSE,
+   LIB_PARM_INDEX,
+   LIB_PARM_RINDEX,
+   LIB_SET_LR_MARGIN,
+   LIB_CLEAR_MARGINS,
+   LIB_BRACKETED_PASTE_ON,
+   LIB_BRACKETED_PASTE_OFF,
+   LIB_PASTE_START,
+   LIB_PASTE_END,
+   LIB_REPEAT_CHAR,
+   LIB_ENTER_ALT_CHARSET_MODE,
+   LIB_EXIT_ALT_CHARSET_MODE,
+   LIB_ACS_CHARS,
+   LIB_CURSOR_HOME,
+   LIB_CARRIAGE_RETURN,
+   LIB_CURSOR_DOWN,
+   LIB_CURSOR_LEFT,
+   LIB_CURSOR_RIGHT,
+   LIB_COLUMN_ADDRESS,
+   LIB_ROW_ADDRESS,
+   LIB_PARM_UP_CURSOR,
+   LIB_PARM_DOWN_CURSOR,
+   LIB_PARM_LEFT_CURSOR,
+   LIB_PARM_RIGHT_CURSOR,
+   LIB_END
+};
+
+extern TIV caps_LIB[];
+
+void ti_lib_measure(void);
+int  ti_lib_move(int from_row, int from_col, int row, int col);
+int  ti_lib_scroll_cost(int count);
+int  ti_lib_scroll(int count);
+
+/* sl_output.c */
+
+/**
+ * @brief Function that receives flushed output, see @ref ti_out_set_sink.
+ * @param "data"    pointer given to @ref ti_out_set_sink
+ * @param "bytes"   output of one flush
+ * @param "len"     number of @p bytes
+ */
+typedef void (*TI_OUT_SINK)(void *data, const char *bytes, size_t len);
+
+int  ti_out_putc(int chr);
+void ti_out_write(const char *data, size_t len);
+void ti_out_puts(const char *str);
+void ti_out_code(unsigned int code);
+void ti_out_repeat(unsigned int code, int count);
+void ti_out_map_acs(void);
+int  ti_out_acs_char(unsigned int code);
+void ti_out_begin(void);
+void ti_out_end(void);
+int  ti_out_flush(void);
+void ti_out_set_fd(int fd);
+void ti_out_set_sink(TI_OUT_SINK sink, void *data);
+int  ti_out_get_fd(void);
+size_t ti_out_buffered(void);
+size_t ti_out_pending(void);
+int  ti_out_take_dropped(void);
+void ti_out_set_pending_limit(size_t limit);
+int  ti_out_drain(int timeout_ms);
+int  ti_out_open_nonblocking(void);
+void ti_out_release(void);
+
+/* sl_utf8.c */
+int    ti_utf8_decode(const char *text, unsigned int *code);
+int    ti_utf8_decode_n(const char *text, size_t len, unsigned int *code);
+int    ti_utf8_encode(unsigned int code, char *buff);
+int    ti_utf8_sequence_length(const char *text, size_t len);
+size_t ti_utf8_valid_length(const char *text, size_t len);
+size_t ti_utf8_decode_span(const char *text, size_t len, unsigned int *codes, size_t max, size_t *used);
+int    ti_char_width(unsigned int code);
+int    ti_utf8_width(const char *text, size_t len);
+size_t ti_utf8_clip(const char *text, size_t len, int cols, int *width);
+
+/* sl_gcache.c */
+
+/**
+ * @brief One grapheme cluster of a string measured by @ref ti_gcache_layout.
+ */
+typedef struct ti_cluster {
+   unsigned int   code;     ///< code for a screen cell, see @ref ti_gcache_intern
+   unsigned short offset;   ///< byte offset of the cluster in the string
+   unsigned short len;      ///< bytes in the cluster
+   unsigned char  width;    ///< columns, control characters count as 1
+} TI_CLUSTER;
+
+/**
+ * @brief Grapheme clusters and total width of a string.
+ */
+typedef struct ti_layout {
+   TI_CLUSTER *clusters;
+   int count;               ///< number of @p clusters
+   int width;               ///< columns of the whole string
+} TI_LAYOUT;
+
+typedef struct ti_gcache TI_GCACHE;
+
+int  ti_grapheme_next(const char *text, size_t len, int *width);
+TI_GCACHE *ti_gcache_create(void);
+void ti_gcache_destroy(TI_GCACHE *cache);
+unsigned int ti_gcache_intern(TI_GCACHE *cache, const char *text, size_t len, int width);
+const char *ti_gcache_cluster(const TI_GCACHE *cache, unsigned int code, int *len, int *width);
+int  ti_gcache_layout(TI_GCACHE *cache, const char *text, size_t len, TI_LAYOUT *layout);
+
+/* sl_screen.c */
+
+/** @brief Attribute flags for @ref TI_CELL */
+#define TI_ATTR_BOLD      0x01
+#define TI_ATTR_DIM       0x02
+#define TI_ATTR_UNDERLINE 0x04
+#define TI_ATTR_REVERSE   0x08
+#define TI_ATTR_STANDOUT  0x10
+
+/**
+ * @brief One character position of a @ref TI_SCREEN.
+ */
+typedef struct ti_cell {
+   unsigned int   code;   ///< Unicode codepoint displayed in the cell
+   unsigned short attr;   ///< combination of TI_ATTR_ flags
+} TI_CELL;
+
+/** @brief Code of the cell covered by the right half of a wide character */
+#define TI_CELL_WIDE_TAIL 0xFFFFFFFFu
+
+/**
+ * @brief First cell code of clusters interned by @ref ti_gcache_intern.
+ *        Codes from here up to @ref TI_CELL_WIDE_TAIL are not codepoints.
+ */
+#define TI_CELL_CLUSTER 0x40000000u
+
+#define TI_SCREEN_MAX_SCROLLS 8
+
+/**
+ * @brief A scroll of a rectangle waiting to be sent by @ref ti_screen_render.
+ */
+typedef struct ti_scroll_op {
+   int top;      ///< first row of the rectangle
+   int bottom;   ///< last row of the rectangle
+   int left;     ///< first column of the rectangle
+   int right;    ///< last column of the rectangle
+   int count;    ///< lines scrolled up, negative for down
+} TI_SCROLL_OP;
+
+/**
+ * @brief Double-buffered model of the terminal screen.
+ *
+ * Drawing functions change the @p back buffer only.  @ref ti_screen_render
+ * compares @p back against @p front, which holds what the terminal is
+ * showing, and sends only the differences.
+ */
+typedef struct ti_screen {
+   int rows;                ///< number of rows in each buffer
+   int cols;                ///< number of columns in each buffer
+   TI_CELL *front;          ///< cells as last sent to the terminal
+   TI_CELL *back;           ///< cells to be shown by the next render
+   unsigned char *dirty;    ///< per-row flag, set when a back row changes
+   int dirty_rows;          ///< count of set @p dirty flags
+   int invalid;             ///< if set, @p front is unknown and all rows are sent
+   int cur_row;             ///< terminal cursor row, -1 if unknown
+   int cur_col;             ///< terminal cursor column, -1 if unknown
+   unsigned short cur_attr; ///< attributes in effect on the terminal
+   int park_row;            ///< where to leave the cursor after render, -1 to ignore
+   int park_col;            ///< where to leave the cursor after render
+   TI_SCROLL_OP scrolls[TI_SCREEN_MAX_SCROLLS];   ///< scrolls to try in hardware
+   int scroll_count;        ///< number of entries in @p scrolls
+   TI_GCACHE *gcache;       ///< measured strings and the clusters shown in cells
+   int use_acs;             ///< if set, line-drawing characters are sent in the alternate character set
+   int cur_acs;             ///< 1 if the alternate character set is on, 0 if off, -1 if unknown
+   size_t capacity;         ///< cells allocated for each buffer
+   int row_capacity;        ///< rows allocated for @p dirty
+} TI_SCREEN;
+
+unsigned short ti_out_attr(unsigned short current, unsigned short attr);
+int  ti_screen_init(TI_SCREEN *scr, int rows, int cols);
+void ti_screen_destroy(TI_SCREEN *scr);
+int  ti_screen_resize(TI_SCREEN *scr, int rows, int cols);
+void ti_screen_clear(TI_SCREEN *scr);
+void ti_screen_invalidate(TI_SCREEN *scr);
+void ti_screen_set_cell(TI_SCREEN *scr, int row, int col, unsigned int code, unsigned short attr);
+void ti_screen_fill(TI_SCREEN *scr, int row, int col, int count, unsigned int code, unsigned short attr);
+void ti_screen_set_attr(TI_SCREEN *scr, int row, int col, int count, unsigned short attr);
+int  ti_screen_put(TI_SCREEN *scr, int row, int col, const char *str, unsigned short attr);
+int  ti_screen_put_span(TI_SCREEN *scr, int row, int col, int width, const char *str, unsigned short attr);
+void ti_screen_scroll(TI_SCREEN *scr, int top, int bottom, int left, int right, int count);
+void ti_screen_park_cursor(TI_SCREEN *scr, int row, int col);
+int  ti_screen_render(TI_SCREEN *scr);
+
+/* sl_frame.c */
+long long ti_clock_ns(void);
+void ti_frame_set_rate(int fps);
+int  ti_frame_get_interval_ms(void);
+int  ti_frame_present(TI_SCREEN *scr);
+int  ti_frame_poll(TI_SCREEN *scr);
+
+/* sl_pane.c */
+
+/**
+ * @brief A rectangle of a @ref TI_SCREEN that scrolls independently.
+ */
+typedef struct ti_pane {
+   TI_SCREEN *screen;   ///< screen containing the pane
+   int top;             ///< first screen row of the pane
+   int left;            ///< first screen column of the pane
+   int rows;            ///< height of the pane
+   int cols;            ///< width of the pane
+} TI_PANE;
+
+void ti_pane_init(TI_PANE *pane, TI_SCREEN *scr, int top, int left, int rows, int cols);
+int  ti_pane_tile(TI_PANE *panes, int count, TI_SCREEN *scr, int side_by_side);
+void ti_pane_clear(TI_PANE *pane);
+int  ti_pane_put(TI_PANE *pane, int row, int col, const char *text, unsigned short attr);
+void ti_pane_scroll(TI_PANE *pane, int count);
+void ti_pane_append(TI_PANE *pane, const char *text, unsigned short attr);
+
+/* sl_pager.c */
+
+struct ti_pager_index;
+
+/**
+ * @brief A read-only view of a file, of any size, in a @ref TI_PANE.
+ */
+typedef struct ti_pager {
+   TI_PANE view;                   ///< part of the screen showing the file
+   const char *map;                ///< file contents, mapped read-only
+   size_t size;                    ///< bytes in the file
+   long long first;                ///< line shown at the top of the view
+   int shift;                      ///< columns hidden at the left
+   struct ti_pager_index *index;   ///< line offsets, built in the background
+} TI_PAGER;
+
+int  ti_pager_open(TI_PAGER *pager, const char *path, const TI_PANE *view);
+void ti_pager_close(TI_PAGER *pager);
+long long ti_pager_line_count(TI_PAGER *pager, int *complete);
+int  ti_pager_get_line(TI_PAGER *pager, long long line, const char **text, size_t *len);
+void ti_pager_draw(TI_PAGER *pager);
+void ti_pager_goto(TI_PAGER *pager, long long line);
+void ti_pager_scroll(TI_PAGER *pager, long long count);
+void ti_pager_shift(TI_PAGER *pager, int cols);
+
+/* sl_wrap.c */
+
+/**
+ * @brief Lines of text shown in a @ref TI_PANE, wrapped at its width.
+ */
+typedef struct ti_wrap {
+   TI_PANE view;                 ///< part of the screen showing the text
+   char *text;                   ///< the lines, one after another
+   size_t text_capacity;         ///< bytes allocated for @p text
+   size_t *offsets;              ///< start of each line in @p text, and the end
+   unsigned short *row_counts;   ///< rows each line takes when wrapped
+   unsigned short *row_width;    ///< width each row count was measured at, 0 if never
+   long long count;              ///< number of lines
+   long long capacity;           ///< lines allocated in the index
+   long long top_line;           ///< line at the top of the view
+   size_t top_offset;            ///< byte of @p top_line that starts the top row
+   int follow;                   ///< if set, keep the end of the text in view
+} TI_WRAP;
+
+int  ti_wrap_init(TI_WRAP *wrap, const TI_PANE *view);
+void ti_wrap_destroy(TI_WRAP *wrap);
+int  ti_wrap_append(TI_WRAP *wrap, const char *text, size_t len);
+void ti_wrap_draw(TI_WRAP *wrap);
+void ti_wrap_scroll(TI_WRAP *wrap, int count);
+void ti_wrap_resize(TI_WRAP *wrap, const TI_PANE *view);
+
+/* sl_widget.c */
+
+/**
+ * @brief A span of a screen row drawn independently of a @ref TI_SCREEN.
+ */
+typedef struct ti_widget {
+   int row;               ///< screen row
+   int col;               ///< first column
+   int width;             ///< number of columns owned by the widget
+   unsigned short attr;   ///< TI_ATTR_ flags for the widget text
+   unsigned int *want;    ///< cell codes to show, one per column, as in @ref TI_CELL
+   unsigned int *shown;   ///< cell codes last sent to the terminal
+   TI_GCACHE *gcache;     ///< clusters of more than one codepoint in the text
+   int valid;             ///< set when @p shown matches the terminal
+   long long memo;        ///< last progress or spinner state, to skip composing
+   long long next_draw;   ///< earliest time, from @ref ti_clock_ns, to send changes
+} TI_WIDGET;
+
+int  ti_widget_init(TI_WIDGET *wid, int row, int col, int width, unsigned short attr);
+void ti_widget_destroy(TI_WIDGET *wid);
+void ti_widget_invalidate(TI_WIDGET *wid);
+int  ti_widget_refresh(TI_WIDGET *wid);
+int  ti_widget_text(TI_WIDGET *wid, const char *text);
+int  ti_widget_progress(TI_WIDGET *wid, long long done, long long total);
+int  ti_widget_spinner(TI_WIDGET *wid, const char *label);
+int  ti_widget_pin_lines(int count);
+void ti_widget_unpin_lines(void);
+
+/* sl_render.c */
+int  ti_render_start(TI_SCREEN *scr);
+void ti_render_stop(void);
+int  ti_render_text(int row, int col, const char *text, unsigned short attr);
+int  ti_render_attr(int row, int col, int count, unsigned short attr);
+int  ti_render_status(const char *text, unsigned short attr);
+
+/* sl_input.c */
+
+/** @brief Types of @ref TI_EVENT */
+enum ti_event_type {
+   TI_EVENT_CHAR = 1,   ///< typed character in @p code
+   TI_EVENT_KEY,        ///< key of the capset given to @ref ti_input_init, in @p key_index,
+                        ///< or a decoded key, TI_KEY_ value in @p code
+   TI_EVENT_PASTE,      ///< pasted text in @p slices
+   TI_EVENT_UNKNOWN,    ///< escape sequence not recognized, in @p slices
+   TI_EVENT_MOUSE,      ///< mouse report, button in @p code, position in @p row and @p col
+   TI_EVENT_RESIZE      ///< terminal resized, after @ref ti_winch_init, new size in @p row and @p col
+};
+
+/** @brief Modifier flags of @ref TI_EVENT */
+#define TI_MOD_SHIFT 1
+#define TI_MOD_ALT   2
+#define TI_MOD_CTRL  4
+#define TI_MOD_SUPER 8
+#define TI_MOD_CAPS_LOCK 64
+#define TI_MOD_NUM_LOCK  128
+
+/**
+ * @brief Codes of keys decoded from escape sequences, in @p code of a
+ *        @ref TI_EVENT_KEY.
+ *
+ * Keys with control characters use those values.  Other keys are
+ * numbered after the last Unicode codepoint.  Keys that only the CSI u
+ * protocol reports, like F13 or the keypad keys, keep that protocol's
+ * private use codes.
+ */
+enum ti_key {
+   TI_KEY_TAB = 9,
+   TI_KEY_ENTER = 13,
+   TI_KEY_ESCAPE = 27,
+   TI_KEY_BACKSPACE = 127,
+   TI_KEY_INSERT = 0x110000,
+   TI_KEY_DELETE,
+   TI_KEY_LEFT,
+   TI_KEY_RIGHT,
+   TI_KEY_UP,
+   TI_KEY_DOWN,
+   TI_KEY_PAGE_UP,
+   TI_KEY_PAGE_DOWN,
+   TI_KEY_HOME,
+   TI_KEY_END,
+   TI_KEY_F1,
+   TI_KEY_F2,
+   TI_KEY_F3,
+   TI_KEY_F4,
+   TI_KEY_F5,
+   TI_KEY_F6,
+   TI_KEY_F7,
+   TI_KEY_F8,
+   TI_KEY_F9,
+   TI_KEY_F10,
+   TI_KEY_F11,
+   TI_KEY_F12
+};
+
+/** @brief Actions of a key event, when the terminal reports them */
+enum ti_key_action {
+   TI_KEY_PRESS = 1,
+   TI_KEY_REPEAT,
+   TI_KEY_RELEASE
+};
+
+/** @brief Progressive keyboard enhancement flags for @ref ti_input_set_keyboard */
+#define TI_KEYBOARD_DISAMBIGUATE   1   ///< report ambiguous keys, like ESC and Ctrl+I, as CSI u
+#define TI_KEYBOARD_EVENT_TYPES    2   ///< also report repeats and releases
+#define TI_KEYBOARD_ALTERNATES     4
+#define TI_KEYBOARD_ALL_KEYS       8   ///< report all keys, including text, as CSI u
+#define TI_KEYBOARD_TEXT          16
+
+/** @brief Mouse tracking modes for @ref ti_input_set_mouse */
+enum ti_mouse_mode {
+   TI_MOUSE_OFF = 0,
+   TI_MOUSE_BUTTONS,    ///< report presses, releases and the wheel
+   TI_MOUSE_DRAG,       ///< also report motion while a button is down
+   TI_MOUSE_MOTION      ///< report all motion
+};
+
+/** @brief Actions of a @ref TI_EVENT_MOUSE */
+enum ti_mouse_action {
+   TI_MOUSE_PRESS = 1,
+   TI_MOUSE_RELEASE,
+   TI_MOUSE_MOVE
+};
+
+/** @brief Buttons of a @ref TI_EVENT_MOUSE, in @p code */
+#define TI_BUTTON_LEFT       0
+#define TI_BUTTON_MIDDLE     1
+#define TI_BUTTON_RIGHT      2
+#define TI_BUTTON_NONE       3    ///< motion with no button down
+#define TI_BUTTON_WHEEL_UP   64
+#define TI_BUTTON_WHEEL_DOWN 65
+
+/**
+ * @brief Bytes of an event in the input buffer.
+ */
+typedef struct ti_slice {
+   const char *data;
+   size_t len;
+} TI_SLICE;
+
+/**
+ * @brief One keypress, paste or other input, from @ref ti_input_next.
+ *
+ * The slices point into the input buffer and are valid until the next
+ * call to @ref ti_input_next.  Input that wraps around the end of the
+ * buffer is in two slices.
+ */
+typedef struct ti_event {
+   int type;               ///< one of enum ti_event_type
+   unsigned int code;      ///< TI_EVENT_CHAR: Unicode codepoint, TI_EVENT_KEY: enum ti_key
+   int key_index;          ///< TI_EVENT_KEY: index into the capset, otherwise -1
+   int more;               ///< TI_EVENT_PASTE: set if the paste continues in later events
+   int mods;               ///< TI_MOD_ flags, if the terminal reported them
+   int action;             ///< enum ti_mouse_action or enum ti_key_action, 0 if not reported
+   int row;                ///< TI_EVENT_MOUSE: screen row, starting at 0, TI_EVENT_RESIZE: rows
+   int col;                ///< TI_EVENT_MOUSE: screen column, starting at 0, TI_EVENT_RESIZE: columns
+   TI_SLICE slices[2];     ///< raw bytes of the event
+} TI_EVENT;
+
+/**
+ * @brief Ring buffer and tokenizer state for reading terminal input.
+ */
+typedef struct ti_input {
+   int fd;                 ///< file descriptor to read, usually STDIN_FILENO
+   TIV *keys;              ///< capset of keys to recognize, may be NULL
+   char *ring;             ///< input buffer
+   size_t size;            ///< bytes in @p ring, a power of two
+   size_t head;            ///< position of the first unread byte, never wraps
+   size_t tail;            ///< position after the last byte read, never wraps
+   size_t release;         ///< bytes of the last event, dropped by the next call
+   int pasting;            ///< set between the paste start and end markers
+   int esc_delay;          ///< milliseconds to wait for the rest of a sequence
+   int keyboard;           ///< keyboard enhancement flags reported by the terminal
+   int resized;            ///< set when a resize is waiting to be returned
+} TI_INPUT;
+
+int  ti_input_init(TI_INPUT *in, int fd, size_t size, TIV *keys);
+void ti_input_destroy(TI_INPUT *in);
+int  ti_input_next(TI_INPUT *in, TI_EVENT *event, int timeout_ms);
+void ti_input_set_paste(int enable);
+void ti_input_set_mouse(int mode);
+void ti_input_set_keyboard(TI_INPUT *in, int flags);
+
+/* sl_keymap.c */
+
+/**
+ * @brief Function called for a binding of a @ref TI_KEYMAP.
+ * @param "event"   event that completed the binding, NULL if the
+ *                  binding is the start of a longer chord that timed
+ *                  out or was not completed
+ * @param "data"    pointer given when the binding was made
+ */
+typedef void (*TI_KEY_HANDLER)(const TI_EVENT *event, void *data);
+
+/** @brief Key for @ref ti_keymap_bind_keys from a code and TI_MOD_ flags */
+#define TI_KEYMAP_KEY(code, mods) ((unsigned int)(code) | ((unsigned int)(mods) & 0x0Fu) << 21)
+/** @brief Key for @ref ti_keymap_bind_keys from an index of the input's capset */
+#define TI_KEYMAP_CAPSET(index)   (0x80000000u | (unsigned int)(index))
+
+/** @brief Results of @ref ti_keymap_dispatch */
+enum ti_keymap_result {
+   TI_KEYMAP_UNBOUND = 0,   ///< no binding for the event
+   TI_KEYMAP_HANDLED,       ///< a handler was called
+   TI_KEYMAP_PENDING        ///< the event started or continued a chord
+};
+
+typedef struct ti_keymap TI_KEYMAP;
+
+TI_KEYMAP *ti_keymap_create(void);
+void ti_keymap_destroy(TI_KEYMAP *map);
+unsigned int ti_keymap_key(const TI_EVENT *event);
+int  ti_keymap_bind_keys(TI_KEYMAP *map, const unsigned int *keys, int count,
+                         TI_KEY_HANDLER handler, void *data);
+int  ti_keymap_bind(TI_KEYMAP *map, const char *spec, TI_KEY_HANDLER handler, void *data);
+int  ti_keymap_dispatch(TI_KEYMAP *map, const TI_EVENT *event);
+int  ti_keymap_timeout(const TI_KEYMAP *map);
+int  ti_keymap_expire(TI_KEYMAP *map);
+void ti_keymap_set_chord_timeout(TI_KEYMAP *map, int timeout_ms);
+
+/* sl_vterm.c */
+
+typedef struct ti_vterm TI_VTERM;
+
+TI_VTERM *ti_vterm_create(int rows, int cols);
+void ti_vterm_destroy(TI_VTERM *vt);
+void ti_vterm_write(TI_VTERM *vt, const char *data, size_t len);
+void ti_vterm_sink(void *vt, const char *bytes, size_t len);
+const TI_CELL *ti_vterm_cell(const TI_VTERM *vt, int row, int col);
+int  ti_vterm_row_text(const TI_VTERM *vt, int row, char *buff, int size);
+void ti_vterm_cursor(const TI_VTERM *vt, int *row, int *col);
+size_t ti_vterm_bytes(const TI_VTERM *vt);
+int  ti_vterm_unknown(const TI_VTERM *vt);
+int  ti_vterm_diff(const TI_VTERM *vt, const TI_SCREEN *scr, int *row, int *col);
+
+/* sl_stats.c */
+
+/** @brief Counters of @ref TI_STATS */
+enum ti_stat {
+   TI_STAT_WRITES = 0,      ///< write() calls to the terminal, none for a sink
+   TI_STAT_WRITE_BYTES,     ///< bytes written to the terminal
+   TI_STAT_READS,           ///< read() and readv() calls from the terminal
+   TI_STAT_READ_BYTES,      ///< bytes read from the terminal
+   TI_STAT_TCSETATTR,       ///< tcsetattr() calls
+   TI_STAT_IOCTL,           ///< ioctl() calls
+   TI_STAT_TIPARM,          ///< tiparm() calls
+   TI_STAT_FRAMES,          ///< flushes of the output buffer with something in it
+   TI_STAT_FRAME_BYTES,     ///< bytes in those flushes
+   TI_STAT_MAX_FRAME_BYTES, ///< bytes in the largest flush
+   TI_STAT_END
+};
+
+/**
+ * @brief Snapshot of the library's counters, from @ref ti_stats_get.
+ */
+typedef struct ti_stats {
+   long long counts[TI_STAT_END];   ///< indexed by enum ti_stat
+} TI_STATS;
+
+/**
+ * @brief Use of one capability, from @ref ti_stats_get_caps.
+ */
+typedef struct ti_cap_stats {
+   const TIV *cap;       ///< element executed
+   int index;            ///< index of the element in its capset, the capset's enum
+   char code[3];         ///< termcap code of the element
+   long long executes;   ///< number of TIV_execute calls
+   long long bytes;      ///< bytes of the sequences produced
+} TI_CAP_STATS;
+
+int  ti_stats_get(TI_STATS *stats);
+int  ti_stats_get_caps(TI_CAP_STATS *caps, int max);
+int  ti_stats_get_cap(const TIV *tiv, int index, TI_CAP_STATS *stats);
+void ti_stats_reset(void);
+void ti_stats_dump(int fd);
+void ti_stats_init(void);
+
+/*
+ * Counting is compiled in with -DTI_WITH_STATS (make STATS=1).  Otherwise
+ * the macros below do nothing and the functions above report ENOTSUP.
+ */
+#ifdef TI_WITH_STATS
+void ti_stats_add(int counter, long long amount);
+void ti_stats_frame(size_t bytes);
+void ti_stats_cap(const TIV *cap, size_t bytes);
+#define TI_STAT_ADD(counter, amount) ti_stats_add((counter), (long long)(amount))
+#define TI_STAT_FRAME(bytes)         ti_stats_frame(bytes)
+#define TI_STAT_CAP(cap, bytes)      ti_stats_cap((cap), (bytes))
+#else
+#define TI_STAT_ADD(counter, amount) ((void)0)
+#define TI_STAT_FRAME(bytes)         ((void)0)
+#define TI_STAT_CAP(cap, bytes)      ((void)0)
+#endif
+
+/* sl_trace.c */
+
+/** @brief Spans timed by @ref ti_trace_get */
+enum ti_trace_span {
+   TI_TRACE_INPUT_TO_PAINT = 0,   ///< input read until the output after it is written
+   TI_TRACE_BUILD,                ///< first output of a frame until its flush
+   TI_TRACE_FLUSH,                ///< writing a frame to the terminal
+   TI_TRACE_END
+};
+
+/** @brief Sub-buckets per power of two, for about 6% precision */
+#define TI_HISTOGRAM_SUB_BUCKETS 16
+/** @brief Buckets of a @ref TI_HISTOGRAM, enough for any nanosecond count */
+#define TI_HISTOGRAM_BUCKETS (64 * TI_HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * @brief Log-linear histogram of durations in nanoseconds.
+ *
+ * Values below @ref TI_HISTOGRAM_SUB_BUCKETS have a bucket each.
+ * Above that, each power of two is split into
+ * @ref TI_HISTOGRAM_SUB_BUCKETS buckets.
+ */
+typedef struct ti_histogram {
+   long long count;                           ///< number of values recorded
+   long long sum;                             ///< total of the values
+   long long min;                             ///< smallest value, 0 if none
+   long long max;                             ///< largest value
+   long long buckets[TI_HISTOGRAM_BUCKETS];   ///< counts by value range
+} TI_HISTOGRAM;
+
+int  ti_trace_get(int span, TI_HISTOGRAM *hist);
+long long ti_histogram_percentile(const TI_HISTOGRAM *hist, double percentile);
+void ti_trace_reset(void);
+int  ti_trace_open(const char *path);
+void ti_trace_close(void);
+void ti_trace_dump(int fd);
+void ti_trace_init(void);
+
+// Tracing is compiled in with the counters of sl_stats.c
+#ifdef TI_WITH_STATS
+void ti_trace_input(void);
+void ti_trace_flush_begin(size_t bytes);
+void ti_trace_flush_end(size_t pending);
+void ti_trace_frame_begin(void);
+#define TI_TRACE_INPUT()              ti_trace_input()
+#define TI_TRACE_FRAME_BEGIN()        ti_trace_frame_begin()
+#define TI_TRACE_FLUSH_BEGIN(bytes)   ti_trace_flush_begin(bytes)
+#define TI_TRACE_FLUSH_END(pending)   ti_trace_flush_end(pending)
+#else
+#define TI_TRACE_INPUT()              ((void)0)
+#define TI_TRACE_FRAME_BEGIN()        ((void)0)
+#define TI_TRACE_FLUSH_BEGIN(bytes)   ((void)0)
+#define TI_TRACE_FLUSH_END(pending)   ((void)0)
+#endif
+
+/* sl_record.c */
+
+/** @brief Event of a recording, from @ref ti_replay_next */
+typedef struct ti_record_event {
+   double time;          ///< seconds since the recording started
+   char type;            ///< 'o' for output, 'i' for input
+   const char *data;     ///< bytes of the event
+   size_t len;           ///< number of bytes in @p data
+} TI_RECORD_EVENT;
+
+typedef struct ti_replay TI_REPLAY;
+
+int  ti_record_open(const char *path);
+void ti_record_close(void);
+void ti_record_init(void);
+void ti_record_output(const char *data, size_t len);
+void ti_record_input(const char *data, size_t len);
+
+TI_REPLAY *ti_replay_open(const char *path);
+void ti_replay_close(TI_REPLAY *replay);
+const char *ti_replay_info(const TI_REPLAY *replay, int *rows, int *cols);
+int  ti_replay_next(TI_REPLAY *replay, TI_RECORD_EVENT *event);
 
 #endif
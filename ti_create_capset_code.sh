@@ -13,6 +13,8 @@ declare -i OUTPUT_TYPE="$OUTPUT_TYPE_COMBINED"
 
 declare -i INCLUDE_NAMES=0
 declare -i INCLUDE_DESCRIPTIONS=0
+declare -i INCLUDE_FUNCTIONS=0
+declare -i PACK_STRINGS=0
 
 show_usage()
 {
@@ -27,6 +29,13 @@ Options:
 
 -n    include array of capability name strings
 -d    include array of capability description strings
+-p    pack the names and descriptions of -n and -d into one
+      string, strings_set_name, with tables of unsigned short
+      offsets, names_set_name_offsets and desc_set_name_offsets,
+      which need no relocations in a shared library
+-f    include a typed inline function for each capability,
+      taking as many int arguments as the markers #1, #2...
+      numbered without gaps, or a range #1-#9, in its description
 
 -i    name of file to read for processing.  STDIN will
       be used in absence of the input option.
@@ -74,6 +83,8 @@ process_command_line_args()
                 case "$cur_option" in
                     d) INCLUDE_DESCRIPTIONS=1; continue ;;
                     n) INCLUDE_NAMES=1; continue ;;
+                    f) INCLUDE_FUNCTIONS=1; continue ;;
+                    p) PACK_STRINGS=1; continue ;;
                     h) show_usage; return 1; ;;
                     esac
 
@@ -302,6 +313,193 @@ code_strings_array()
     IFS="$OIFS"
 }
 
+# Generates one string holding the names and descriptions, each ending
+# with a NUL, and an array of offsets into it for each.  Unlike arrays of
+# pointers, neither needs relocating when loaded from a shared library.
+#
+# Args
+#    (name):    name of array containing capability data
+#    (string):  set name, for the array names
+code_packed_strings()
+{
+    local cps_caps_name="$1"
+    local cps_set_name="$2"
+
+    # Offsets count bytes, not characters
+    local LC_ALL=C
+    local -a cps_blob_lines=()
+    local -a cps_offset_lines=()
+    local -i cps_offset=0
+
+    # Args: field index of the strings, name of the offsets array
+    add_packed_field()
+    {
+        local -i apf_field="$1"
+        local -a apf_offsets=()
+        local -a apf_row=()
+        local -i apf_count=0
+        local val
+
+        for val in "${cps_caps[@]}"; do
+            apf_row+=( "$val" )
+            if (( ++apf_count == 4 )); then
+                local apf_text="${apf_row[$apf_field]}"
+                apf_offsets+=( "$cps_offset" )
+                cps_offset+=$(( ${#apf_text} + 1 ))
+
+                apf_text="${apf_text//\\/\\\\}"
+                apf_text="${apf_text//\"/\\\"}"
+                cps_blob_lines+=( "   \"${apf_text}\\0\"" )
+
+                apf_count=0
+                apf_row=()
+            fi
+        done
+
+        cps_offset_lines+=( "" )
+        cps_offset_lines+=( "const unsigned short ${2}[] = {" )
+        local -i apf_index
+        for (( apf_index=0; apf_index<${#apf_offsets[*]}; ++apf_index )); do
+            cps_offset_lines+=( "   ${apf_offsets[$apf_index]}," )
+        done
+        cps_offset_lines+=( "};" )
+    }
+
+    local -n cps_caps="$cps_caps_name"
+    if [ "$INCLUDE_NAMES" -eq 1 ]; then
+        add_packed_field 0 "names_${cps_set_name}_offsets"
+    fi
+    if [ "$INCLUDE_DESCRIPTIONS" -eq 1 ]; then
+        add_packed_field 3 "desc_${cps_set_name}_offsets"
+    fi
+
+    if [ "$cps_offset" -gt 65535 ]; then
+        echo $'   \e[31;1mPacked strings are too long for unsigned short offsets.\e[m' >&2
+        exit 1
+    fi
+
+    local -a cps_output_lines=()
+    cps_output_lines+=( "" )
+    cps_output_lines+=( "const char strings_${cps_set_name}[] =" )
+    cps_output_lines+=( "${cps_blob_lines[@]}" )
+    cps_output_lines+=( "   \"\";" )
+    cps_output_lines+=( "${cps_offset_lines[@]}" )
+
+    local OIFS="$IFS"
+    local IFS=$'\n'
+
+    if [ -n "$OUTPUT_FILE" ]; then
+        echo "${cps_output_lines[*]}" >> "$OUTPUT_FILE"
+    else
+        echo "${cps_output_lines[*]}"
+    fi
+
+    IFS="$OIFS"
+}
+
+# Writes inline functions returning the packed name and description of
+# a capability.
+#
+# Args
+#    (string):  set name, for the array names
+code_packed_accessors()
+{
+    local cpa_set="$1"
+    local cpa_lower="${cpa_set,,}"
+
+    if [ "$INCLUDE_NAMES" -eq 1 ]; then
+        write_text ""
+        write_text "static inline const char *ti_${cpa_lower}_cap_name(int index)"
+        write_text "{"
+        write_text "   return strings_${cpa_set} + names_${cpa_set}_offsets[index];"
+        write_text "}"
+    fi
+    if [ "$INCLUDE_DESCRIPTIONS" -eq 1 ]; then
+        write_text ""
+        write_text "static inline const char *ti_${cpa_lower}_cap_desc(int index)"
+        write_text "{"
+        write_text "   return strings_${cpa_set} + desc_${cpa_set}_offsets[index];"
+        write_text "}"
+    fi
+}
+
+# Callback function for walk_cap_rows() that generates a static inline
+# function for each capability.  The number of parameters is the highest
+# #n marker in the description, so a wrong argument count fails to compile
+# and no varargs are read at runtime.
+#
+# Args
+#    (name):    name of array containing capability data
+#    (string):  set name, for the caps array and enum prefix
+code_inline_functions()
+{
+    local cif_caps_name="$1"
+    local cif_set_name="$2"
+
+    add_function_lines()
+    {
+        local -n afl_output="$1"
+        local -n afl_row="$2"
+
+        local afl_desc="${afl_row[3]}"
+        local afl_enum="${cif_set_name}_${afl_row[0]^^}"
+        local afl_name="ti_${cif_set_name,,}_${afl_row[0]}"
+
+        # Parameters are numbered from #1 without gaps, or given as a
+        # range like #1-#9.  Other numbers, like "User string #7", are
+        # not parameters.
+        local -i afl_count=0
+        local -i afl_num
+        if [[ "$afl_desc" =~ \#1-\#([1-9]) ]]; then
+            afl_count="${BASH_REMATCH[1]}"
+        else
+            for afl_num in 1 2 3 4 5 6 7 8 9; do
+                if [[ "$afl_desc" != *"#${afl_num}"* ]]; then
+                    break
+                fi
+                afl_count="$afl_num"
+            done
+        fi
+
+        afl_output+=( "" )
+        if [ -n "$afl_desc" ]; then
+            afl_output+=( "/** @brief ${afl_desc} */" )
+        fi
+
+        if [ "$afl_count" -eq 0 ]; then
+            afl_output+=( "static inline void ${afl_name}(void)" )
+            afl_output+=( "{" )
+            afl_output+=( "   TIV_execute(caps_${cif_set_name}, ${afl_enum});" )
+        else
+            local afl_params="int parm1"
+            local afl_values="parm1"
+            for (( afl_num=2; afl_num<=afl_count; ++afl_num )); do
+                afl_params+=", int parm${afl_num}"
+                afl_values+=", parm${afl_num}"
+            done
+            afl_output+=( "static inline void ${afl_name}(${afl_params})" )
+            afl_output+=( "{" )
+            afl_output+=( "   const int parms[${afl_count}] = { ${afl_values} };" )
+            afl_output+=( "   TIV_execute_parm(caps_${cif_set_name}, ${afl_enum}, 1, ${afl_count}, parms);" )
+        fi
+        afl_output+=( "}" )
+    }
+
+    local -a cif_output_lines=()
+    walk_cap_rows "cif_output_lines" "$cif_caps_name" "add_function_lines"
+
+    local OIFS="$IFS"
+    local IFS=$'\n'
+
+    if [ -n "$OUTPUT_FILE" ]; then
+        echo "${cif_output_lines[*]}" >> "$OUTPUT_FILE"
+    else
+        echo "${cif_output_lines[*]}"
+    fi
+
+    IFS="$OIFS"
+}
+
 # Twice-used code to create a base name from the output file
 # for conditional compliling of main function.
 #
@@ -322,6 +520,20 @@ get_output_base_name()
     return 1
 }
 
+# Prints the call that dumps a capset with its names or descriptions.
+#
+# Args
+#    (string):  name of the caps array
+#    (string):  "names" or "desc"
+code_dump_call()
+{
+    if [ "$PACK_STRINGS" -eq 1 ]; then
+        echo "TIV_dump_array_packed(${1}, strings_${SET_NAME}, ${2}_${SET_NAME}_offsets);"
+    else
+        echo "TIV_dump_array(${1}, ${2}_${SET_NAME});"
+    fi
+}
+
 code_simple_main()
 {
     local array_name="${1:-caps_MISSING}"
@@ -359,12 +571,12 @@ EOF2
 
         if [ "$INCLUDE_NAMES" -eq 1 ]; then
             write_text "      printf(\"\\nTIV elements with names:\\n\");"
-            write_text "      TIV_dump_array(${array_name}, names_${SET_NAME});"
+            write_text "      $(code_dump_call "$array_name" names)"
             write_text ""
         fi
         if [ "$INCLUDE_DESCRIPTIONS" -eq 1 ]; then
             write_text "      printf(\"\\nTIV elements with descriptions:\\n\");"
-            write_text "      TIV_dump_array(${array_name}, desc_${SET_NAME});"
+            write_text "      $(code_dump_call "$array_name" desc)"
             write_text ""
         fi
         write_text "$main_end_code"
@@ -373,10 +585,10 @@ EOF2
     else
         write_text "$main_start_code"
         if [ "$INCLUDE_NAMES" -eq 1 ]; then
-            echo "      TIV_dump_array(${array_name}, names_${SET_NAME});"
+            echo "      $(code_dump_call "$array_name" names)"
         fi
         if [ "$INCLUDE_DESCRIPTIONS" -eq 1 ]; then
-            echo "      TIV_dump_array(${array_name}, desc_${SET_NAME});"
+            echo "      $(code_dump_call "$array_name" desc)"
         fi
         echo
         write_text "$main_end_code"
@@ -526,11 +738,23 @@ if process_command_line_args "$@"; then
             write_text "#include <termintel.h>"
             write_text ""
             write_text "extern TIV caps_${SET_NAME}[];"
-            if [ "$INCLUDE_NAMES" -ne 0 ]; then
-                write_text "extern const char * names_${SET_NAME}[];"
-            fi
-            if [ "$INCLUDE_DESCRIPTIONS" -ne 0 ]; then
-                write_text "extern const char * desc_${SET_NAME}[];"
+            if [ "$PACK_STRINGS" -ne 0 ]; then
+                if [ "$INCLUDE_NAMES" -ne 0 ] || [ "$INCLUDE_DESCRIPTIONS" -ne 0 ]; then
+                    write_text "extern const char strings_${SET_NAME}[];"
+                fi
+                if [ "$INCLUDE_NAMES" -ne 0 ]; then
+                    write_text "extern const unsigned short names_${SET_NAME}_offsets[];"
+                fi
+                if [ "$INCLUDE_DESCRIPTIONS" -ne 0 ]; then
+                    write_text "extern const unsigned short desc_${SET_NAME}_offsets[];"
+                fi
+            else
+                if [ "$INCLUDE_NAMES" -ne 0 ]; then
+                    write_text "extern const char * names_${SET_NAME}[];"
+                fi
+                if [ "$INCLUDE_DESCRIPTIONS" -ne 0 ]; then
+                    write_text "extern const char * desc_${SET_NAME}[];"
+                fi
             fi
         fi
 
@@ -538,15 +762,27 @@ if process_command_line_args "$@"; then
 
         if [ "$OUTPUT_TYPE" -gt "$OUTPUT_TYPE_CODE" ]; then
             code_enum "GLINES" "enum_${SET_NAME}" "${SET_NAME}"
+            if [ "$INCLUDE_FUNCTIONS" -eq 1 ]; then
+                code_inline_functions "GLINES" "${SET_NAME}"
+            fi
+            if [ "$PACK_STRINGS" -eq 1 ]; then
+                code_packed_accessors "${SET_NAME}"
+            fi
         fi
 
         if [ "$OUTPUT_TYPE" -ne "$OUTPUT_TYPE_HEADER" ]; then
             code_caps_array "GLINES" "caps_${SET_NAME}"
-            if [ "$INCLUDE_NAMES" -eq "$OUTPUT_TYPE_CODE" ]; then
-                code_strings_array "GLINES" "names_${SET_NAME}" 0
-            fi
-            if [ "$INCLUDE_DESCRIPTIONS" -eq 1 ]; then
-                code_strings_array "GLINES" "desc_${SET_NAME}" 3
+            if [ "$PACK_STRINGS" -eq 1 ]; then
+                if [ "$INCLUDE_NAMES" -eq 1 ] || [ "$INCLUDE_DESCRIPTIONS" -eq 1 ]; then
+                    code_packed_strings "GLINES" "${SET_NAME}"
+                fi
+            else
+                if [ "$INCLUDE_NAMES" -eq 1 ]; then
+                    code_strings_array "GLINES" "names_${SET_NAME}" 0
+                fi
+                if [ "$INCLUDE_DESCRIPTIONS" -eq 1 ]; then
+                    code_strings_array "GLINES" "desc_${SET_NAME}" 3
+                fi
             fi
         fi
 
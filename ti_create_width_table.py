@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""
+Print the character width table used by sl_utf8.c.
+
+The table assigns a class to every codepoint:
+   0   zero width (combining marks, format characters, Hangul jungseong)
+   1   one column
+   2   two columns (East Asian Wide and Fullwidth, which includes emoji
+       with default emoji presentation)
+   3   not printable (C0 and C1 controls, DEL, surrogates)
+
+Codepoints are grouped in blocks of 256.  Identical blocks are stored
+once, with four classes packed into each byte, and a first table
+gives the block for each group of 256 codepoints.
+
+Usage:
+   ./ti_create_width_table.py > table.txt
+
+and replace the tables in sl_utf8.c with the output.  The Unicode
+version is that of the Python unicodedata module.
+"""
+
+import unicodedata
+
+BLOCK = 256
+
+
+def width_class(code):
+    if code < 0x20 or 0x7f <= code <= 0x9f or 0xd800 <= code <= 0xdfff:
+        return 3
+    if code == 0xad:   # soft hyphen is shown by terminals
+        return 1
+
+    char = chr(code)
+    category = unicodedata.category(char)
+    if (category in ('Mn', 'Me', 'Cf')
+            or 0x1160 <= code <= 0x11ff
+            or 0xd7b0 <= code <= 0xd7ff
+            or code == 0x200b):
+        return 0
+    if unicodedata.east_asian_width(char) in ('W', 'F'):
+        return 2
+    # Unassigned codepoints of the ideographic planes are reserved as wide
+    if category == 'Cn' and (0x20000 <= code <= 0x2fffd or 0x30000 <= code <= 0x3fffd):
+        return 2
+    return 1
+
+
+def print_array(decl, values):
+    print(decl + " = {")
+    for start in range(0, len(values), 16):
+        print("   " + ",".join("0x%02x" % v for v in values[start:start + 16]) + ",")
+    print("};")
+
+
+def main():
+    blocks = {}
+    stage1 = []
+    for group in range(0x110000 // BLOCK):
+        classes = tuple(width_class(code) for code in range(group * BLOCK, (group + 1) * BLOCK))
+        stage1.append(blocks.setdefault(classes, len(blocks)))
+
+    stage2 = []
+    for classes in sorted(blocks, key=blocks.get):
+        for i in range(0, BLOCK, 4):
+            stage2.append(classes[i]
+                          | classes[i + 1] << 2
+                          | classes[i + 2] << 4
+                          | classes[i + 3] << 6)
+
+    print("// Generated by ti_create_width_table.py from Unicode %s" % unicodedata.unidata_version)
+    print_array("static const unsigned char width_blocks[%d]" % len(stage1), stage1)
+    print()
+    print_array("static const unsigned char width_classes[%d]" % len(stage2), stage2)
+
+
+if __name__ == '__main__':
+    main()
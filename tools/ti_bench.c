@@ -0,0 +1,489 @@
+/**
+ * @file ti_bench.c
+ * @brief Benchmarks of the library over a pseudo-terminal pair.
+ *
+ * Each workload runs against the slave side of a pty while threads
+ * on the master side play the terminal: one drains the output, and
+ * for the input workloads another types or pastes.  Results are time
+ * per operation, system calls per operation from the library's
+ * counters (sl_stats.c), and bytes out and in per operation.
+ *
+ * Build and run with `make bench`, which compiles the library into
+ * the program with -DTI_WITH_STATS.  Options:
+ *
+ * - `--json` prints the results as JSON, for tracking between releases,
+ * - `--scale N` multiplies the number of operations,
+ * - `--size ROWSxCOLS` sets the screen size, 50x160 by default.
+ *
+ * Workloads use the terminal named by TERM, xterm-256color if unset.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <curses.h>
+#include <term.h>
+
+#include "termintel.h"
+
+#define BENCH_MAX_RESULTS 16
+
+typedef struct bench_result {
+   const char *name;
+   long long ops;
+   long long ns;
+   long long syscalls;
+   long long bytes_out;
+   long long bytes_in;
+} BENCH_RESULT;
+
+static BENCH_RESULT g_results[BENCH_MAX_RESULTS];
+static int g_result_count = 0;
+
+static int g_master = -1;
+static int g_slave = -1;
+static int g_rows = 50;
+static int g_cols = 160;
+
+static long long g_drained = 0;     ///< bytes read from the master side
+static int g_stop_drain = 0;
+
+static struct feed {
+   const char *data;
+   size_t len;
+   int repeat;
+} g_feed;
+
+/**
+ * @brief Open a pty pair, with the slave side raw like an
+ *        application's terminal.
+ * @return 0 for success, otherwise errno.
+ */
+static int open_pty(void)
+{
+   g_master = posix_openpt(O_RDWR | O_NOCTTY);
+   if (g_master < 0 || grantpt(g_master) || unlockpt(g_master))
+      return errno;
+
+   const char *name = ptsname(g_master);
+   if (!name)
+      return errno;
+
+   g_slave = open(name, O_RDWR | O_NOCTTY);
+   if (g_slave < 0)
+      return errno;
+
+   struct termios tios;
+   tcgetattr(g_slave, &tios);
+   tios.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+   tios.c_oflag &= ~OPOST;
+   tios.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+   tios.c_cc[VMIN] = 1;
+   tios.c_cc[VTIME] = 0;
+   tcsetattr(g_slave, TCSANOW, &tios);
+
+   struct winsize size = { (unsigned short)g_rows, (unsigned short)g_cols, 0, 0 };
+   ioctl(g_master, TIOCSWINSZ, &size);
+   return 0;
+}
+
+/**
+ * @brief Read and discard what the library writes, like a fast terminal.
+ */
+static void *drain_thread(void *arg)
+{
+   char buff[65536];
+
+   while (!__atomic_load_n(&g_stop_drain, __ATOMIC_RELAXED))
+   {
+      struct pollfd pfd = { g_master, POLLIN, 0 };
+      if (poll(&pfd, 1, 20) <= 0)
+         continue;
+
+      ssize_t got = read(g_master, buff, sizeof(buff));
+      if (got > 0)
+         __atomic_fetch_add(&g_drained, got, __ATOMIC_RELAXED);
+   }
+
+   return NULL;
+}
+
+/**
+ * @brief Type @p g_feed into the terminal.
+ */
+static void *feed_thread(void *arg)
+{
+   for (int i=0; i<g_feed.repeat; ++i)
+   {
+      size_t done = 0;
+      while (done < g_feed.len)
+      {
+         ssize_t written = write(g_master, g_feed.data + done, g_feed.len - done);
+         if (written < 0 && errno == EINTR)
+            continue;
+         if (written <= 0)
+            return NULL;
+         done += written;
+      }
+   }
+
+   return NULL;
+}
+
+static long long syscall_count(void)
+{
+   TI_STATS stats;
+   ti_stats_get(&stats);
+   return stats.counts[TI_STAT_WRITES] + stats.counts[TI_STAT_READS]
+      + stats.counts[TI_STAT_IOCTL] + stats.counts[TI_STAT_TCSETATTR];
+}
+
+static long long written_bytes(void)
+{
+   TI_STATS stats;
+   ti_stats_get(&stats);
+   return stats.counts[TI_STAT_WRITE_BYTES];
+}
+
+/**
+ * @brief Wait for the drain thread to read what was written.
+ */
+static void wait_for_drain(long long bytes)
+{
+   while (__atomic_load_n(&g_drained, __ATOMIC_RELAXED) < bytes)
+      usleep(100);
+}
+
+/**
+ * @brief Start timing a workload.
+ */
+static BENCH_RESULT *begin_result(const char *name)
+{
+   BENCH_RESULT *result = &g_results[g_result_count++];
+   memset(result, 0, sizeof(BENCH_RESULT));
+   result->name = name;
+   result->ns = -ti_clock_ns();
+   result->syscalls = -syscall_count();
+   result->bytes_out = -written_bytes();
+   return result;
+}
+
+static void end_result(BENCH_RESULT *result, long long ops)
+{
+   result->ns += ti_clock_ns();
+   result->syscalls += syscall_count();
+   result->bytes_out += written_bytes();
+   result->ops = ops;
+}
+
+/**
+ * @brief Termcap codes of string capabilities to fill capsets for the
+ *        startup workload.
+ */
+static const char *startup_codes[] = {
+   "cl", "cm", "ce", "cd", "ho", "up", "do", "le", "nd", "sc",
+   "rc", "sf", "sr", "cs", "al", "dl", "ic", "dc", "ec", "me",
+   "md", "mr", "us", "so", "se", "ue", "mb", "mh", "vi", "ve",
+   "vs", "ti", "te", "ks", "ke", "ku", "kd", "kl", "kr", "kh",
+   "@7", "kD", "kI", "kN", "kP", "k1", "k2", "k3", "k4", "k5",
+   "k6", "k7", "k8", "k9", "k;", "F1", "F2", "bl", "vb", "as",
+   "ae", "ac", "rp", "ch", "cv", "DO", "UP", "LE", "RI", "SF",
+   "SR", "AL", "DL", "IC", "DC", "ZH", "ZR", "mk", "im", "ei"
+};
+
+static void bench_startup(int capset_size, int ops)
+{
+   static char names[4][32];
+   static int name_count = 0;
+   int code_count = (int)(sizeof(startup_codes) / sizeof(startup_codes[0]));
+
+   TIV *capset = (TIV*)calloc(capset_size + 1, sizeof(TIV));
+   if (!capset)
+      return;
+   for (int i=0; i<capset_size; ++i)
+      memcpy(capset[i].code, startup_codes[i % code_count], 2);
+
+   char *name = names[name_count++ % 4];
+   snprintf(name, 32, "startup_capset_%d", capset_size);
+
+   BENCH_RESULT *result = begin_result(name);
+   for (int i=0; i<ops; ++i)
+   {
+      TIV_setup(1, &capset);
+      TIV_destroy_array(capset);
+      TIV_destroy_array(caps_LIB);
+      del_curterm(cur_term);
+   }
+   end_result(result, ops);
+
+   free(capset);
+   TIV_setup(0, NULL);
+}
+
+static void bench_repaint(int ops)
+{
+   TI_SCREEN screen;
+   char line[512];
+
+   if (ti_screen_init(&screen, g_rows, g_cols))
+      return;
+   ti_out_set_fd(g_slave);
+
+   long long drained = __atomic_load_n(&g_drained, __ATOMIC_RELAXED);
+   long long before = written_bytes();
+   BENCH_RESULT *result = begin_result("full_repaint");
+   for (int i=0; i<ops; ++i)
+   {
+      // Alternate two pages so every cell changes
+      for (int row=0; row<g_rows; ++row)
+      {
+         int len = snprintf(line, sizeof(line), "%c%05d row %3d ", i % 2 ? '#' : '-', i, row);
+         while (len < g_cols && len < (int)sizeof(line) - 1)
+         {
+            line[len] = (char)('a' + (len + row + i) % 26);
+            ++len;
+         }
+         line[len] = '\0';
+         ti_screen_put(&screen, row, 0, line, (row + i) % 4 ? 0 : TI_ATTR_BOLD);
+      }
+      ti_screen_render(&screen);
+   }
+   wait_for_drain(drained + written_bytes() - before);
+   end_result(result, ops);
+
+   ti_out_set_fd(-1);
+   ti_screen_destroy(&screen);
+}
+
+static void bench_scroll(int ops)
+{
+   TI_SCREEN screen;
+   TI_PANE pane;
+   char line[256];
+
+   if (ti_screen_init(&screen, g_rows, g_cols))
+      return;
+   ti_pane_init(&pane, &screen, 1, 0, g_rows - 2, g_cols);
+   ti_screen_put(&screen, 0, 0, "log", TI_ATTR_REVERSE);
+   ti_screen_put(&screen, g_rows - 1, 0, "status", TI_ATTR_REVERSE);
+   ti_out_set_fd(g_slave);
+   ti_screen_render(&screen);
+
+   long long drained = __atomic_load_n(&g_drained, __ATOMIC_RELAXED);
+   long long before = written_bytes();
+   BENCH_RESULT *result = begin_result("log_pane_scroll");
+   for (int i=0; i<ops; ++i)
+   {
+      snprintf(line, sizeof(line), "%08d log message from the benchmark, level %d", i, i % 5);
+      ti_pane_append(&pane, line, i % 5 ? 0 : TI_ATTR_BOLD);
+      ti_screen_render(&screen);
+   }
+   wait_for_drain(drained + written_bytes() - before);
+   end_result(result, ops);
+
+   ti_out_set_fd(-1);
+   ti_screen_destroy(&screen);
+}
+
+/**
+ * @brief Read input until @p count events have arrived, counting a
+ *        paste once however many events it takes.
+ * @return 0 for success, otherwise errno.
+ */
+static int read_events(TI_INPUT *in, long long count, long long *bytes)
+{
+   TI_EVENT event;
+   long long seen = 0;
+
+   *bytes = 0;
+   while (seen < count)
+   {
+      int rval = ti_input_next(in, &event, 2000);
+      if (rval)
+         return rval;
+
+      *bytes += event.slices[0].len + event.slices[1].len;
+      if (event.type != TI_EVENT_PASTE || !event.more)
+         ++seen;
+   }
+
+   return 0;
+}
+
+static void bench_input(const char *name, const char *data, size_t len,
+                        int events_per_feed, int repeat, int paste)
+{
+   TI_INPUT input;
+   pthread_t feeder;
+   long long bytes;
+
+   if (ti_input_init(&input, g_slave, 0, NULL))
+      return;
+
+   ti_out_set_fd(g_slave);
+   if (paste)
+      ti_input_set_paste(1);
+
+   g_feed.data = data;
+   g_feed.len = len;
+   g_feed.repeat = repeat;
+
+   BENCH_RESULT *result = begin_result(name);
+   pthread_create(&feeder, NULL, feed_thread, NULL);
+   int rval = read_events(&input, (long long)events_per_feed * repeat, &bytes);
+   pthread_join(feeder, NULL);
+   end_result(result, (long long)events_per_feed * repeat);
+   result->bytes_in = bytes;
+
+   if (rval)
+      fprintf(stderr, "%s: %s\n", name, strerror(rval));
+
+   if (paste)
+      ti_input_set_paste(0);
+   ti_out_set_fd(-1);
+   ti_input_destroy(&input);
+}
+
+static void bench_keypress(int repeat)
+{
+   // Eight events: plain, UTF-8, arrows, modified, tilde, SS3, CSI u, control
+   static const char keys[] =
+      "a" "\xC3\xA9" "\033[A" "\033[1;5C" "\033[3~" "\033OP" "\033[97;5u" "\001";
+   bench_input("keypress_parse", keys, sizeof(keys) - 1, 8, repeat, 0);
+}
+
+static void bench_input_mix(int repeat)
+{
+   // Fifteen events: typing, navigation, mouse clicks and a short paste
+   static const char mix[] =
+      "ls -l" "\xC3\xA9" "\r" "\033[A" "\033[B" "\033[5~" "\033[1;2D"
+      "\033[<0;12;7M" "\033[<0;12;7m" "\033[<64;40;20M"
+      "\033[200~git log --oneline\n\033[201~";
+   bench_input("input_mix", mix, sizeof(mix) - 1, 15, repeat, 1);
+}
+
+static void bench_paste(int size, int repeat)
+{
+   static const char start[] = "\033[200~";
+   static const char end[] = "\033[201~";
+
+   char *data = (char*)malloc(size + sizeof(start) + sizeof(end));
+   if (!data)
+      return;
+
+   size_t len = 0;
+   memcpy(data, start, sizeof(start) - 1);
+   len += sizeof(start) - 1;
+   for (int i=0; i<size; ++i)
+      data[len++] = i % 64 == 63 ? '\n' : (char)('a' + i % 26);
+   memcpy(data + len, end, sizeof(end) - 1);
+   len += sizeof(end) - 1;
+
+   bench_input("paste_ingest", data, len, 1, repeat, 1);
+   free(data);
+}
+
+static void print_results(int json)
+{
+   if (json)
+   {
+      printf("{\n  \"term\": \"%s\",\n  \"rows\": %d,\n  \"cols\": %d,\n  \"benchmarks\": [\n",
+             getenv("TERM"), g_rows, g_cols);
+      for (int i=0; i<g_result_count; ++i)
+      {
+         const BENCH_RESULT *r = &g_results[i];
+         double ops = r->ops ? (double)r->ops : 1.0;
+         printf("    { \"name\": \"%s\", \"ops\": %lld, \"ns_per_op\": %.1f, "
+                "\"syscalls_per_op\": %.3f, \"bytes_out_per_op\": %.1f, \"bytes_in_per_op\": %.1f }%s\n",
+                r->name, r->ops, r->ns / ops, r->syscalls / ops,
+                r->bytes_out / ops, r->bytes_in / ops,
+                i + 1 < g_result_count ? "," : "");
+      }
+      printf("  ]\n}\n");
+   }
+   else
+   {
+      printf("%s, %dx%d\n", getenv("TERM"), g_rows, g_cols);
+      printf("%-22s %10s %12s %12s %12s %12s\n",
+             "benchmark", "ops", "ns/op", "syscalls/op", "out B/op", "in B/op");
+      for (int i=0; i<g_result_count; ++i)
+      {
+         const BENCH_RESULT *r = &g_results[i];
+         double ops = r->ops ? (double)r->ops : 1.0;
+         printf("%-22s %10lld %12.1f %12.3f %12.1f %12.1f\n",
+                r->name, r->ops, r->ns / ops, r->syscalls / ops,
+                r->bytes_out / ops, r->bytes_in / ops);
+      }
+   }
+}
+
+int main(int argc, const char **argv)
+{
+   int json = 0;
+   int scale = 1;
+   pthread_t drainer;
+
+   for (int i=1; i<argc; ++i)
+   {
+      if (strcmp(argv[i], "--json") == 0)
+         json = 1;
+      else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+         scale = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+         sscanf(argv[++i], "%dx%d", &g_rows, &g_cols);
+      else
+      {
+         fprintf(stderr, "usage: %s [--json] [--scale N] [--size ROWSxCOLS]\n", argv[0]);
+         return 1;
+      }
+   }
+
+   if (scale < 1 || g_rows < 3 || g_cols < 20)
+   {
+      fprintf(stderr, "%s: bad scale or size\n", argv[0]);
+      return 1;
+   }
+
+   if (!getenv("TERM"))
+      setenv("TERM", "xterm-256color", 1);
+
+   int rval = open_pty();
+   if (rval)
+   {
+      fprintf(stderr, "%s: can't open a pty: %s\n", argv[0], strerror(rval));
+      return 1;
+   }
+
+   if (!TIV_setup(0, NULL))
+      return 1;
+
+   pthread_create(&drainer, NULL, drain_thread, NULL);
+
+   bench_startup(0, 200 * scale);
+   bench_startup(16, 200 * scale);
+   bench_startup(64, 200 * scale);
+   bench_repaint(500 * scale);
+   bench_scroll(5000 * scale);
+   bench_keypress(25000 * scale);
+   bench_input_mix(10000 * scale);
+   bench_paste(1 << 20, 20 * scale);
+
+   __atomic_store_n(&g_stop_drain, 1, __ATOMIC_RELAXED);
+   pthread_join(drainer, NULL);
+
+   print_results(json);
+
+   TIV_destroy_arrays(0, NULL);
+   close(g_slave);
+   close(g_master);
+   return 0;
+}
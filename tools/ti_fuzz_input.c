@@ -0,0 +1,282 @@
+/**
+ * @file ti_fuzz_input.c
+ * @brief Fuzz target for the input tokenizer and key lookup.
+ *
+ * `LLVMFuzzerTestOneInput` feeds its data through a pipe to
+ * @ref ti_input_next with the smallest ring buffer, so that sequences
+ * wrap around its end.  The first byte of the data chooses how the
+ * rest is split into reads and how often events are taken between
+ * them, so sequences arrive whole, split, or cut off by the escape
+ * delay.  The events are checked to point into the ring and cover no
+ * more bytes than were fed.  The data is also looked up with
+ * @ref TIV_find_index_by_sequence and decoded as UTF-8, as
+ * @ref ti_get_keypress_code does.
+ *
+ * Build with `make fuzz`, which needs clang's libFuzzer, then run
+ * `tools/ti_fuzz_input_libfuzzer tools/fuzz_corpus`.  Built without
+ * libFuzzer (`make tools`), the program runs the files given as
+ * arguments once each, to reproduce a crash.  `--seed DIR [TEMPLATE]`
+ * writes a seed corpus of the key sequences of TEMPLATE, by default
+ * templates/capset_keys.txt, for the current `TERM`, with paste, mouse
+ * and keyboard reports.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "termintel.h"
+
+#define FUZZ_MAX_INPUT 65536
+
+/** @brief Termcap codes of the keys of templates/capset_keys.txt */
+static const char *key_codes[] = {
+   "ku", "kd", "kl", "kr", "kN", "kP", "kh", "@7", "kb", "kD", "kI",
+   "k1", "k2", "k3", "k4", "k5", "k6", "k7", "k8", "k9", "k;", "F1", "F2",
+   "kB", "kF", "kR", "#4", "%i", "kE", "kS"
+};
+
+#define KEY_COUNT ((int)(sizeof(key_codes) / sizeof(key_codes[0])))
+
+static TIV *g_keys = NULL;
+
+static void setup(void)
+{
+   if (g_keys)
+      return;
+
+   if (!getenv("TERM"))
+      setenv("TERM", "xterm-256color", 1);
+
+   g_keys = (TIV*)calloc(KEY_COUNT + 1, sizeof(TIV));
+   if (!g_keys)
+      abort();
+   for (int i=0; i<KEY_COUNT; ++i)
+   {
+      memcpy(g_keys[i].code, key_codes[i], 2);
+      g_keys[i].index = i;
+   }
+
+   if (!TIV_setup(1, &g_keys))
+      abort();
+}
+
+static void check_event(const TI_INPUT *in, const TI_EVENT *event, size_t *covered)
+{
+   if (event->type < TI_EVENT_CHAR || event->type > TI_EVENT_RESIZE)
+      abort();
+
+   for (int i=0; i<2; ++i)
+   {
+      const TI_SLICE *slice = &event->slices[i];
+      if (slice->len == 0)
+         continue;
+      if (slice->data < in->ring || slice->data + slice->len > in->ring + in->size)
+         abort();
+      *covered += slice->len;
+   }
+}
+
+/**
+ * @brief Take the events available, checking each.
+ * @return ETIMEDOUT when the input is used up, EIO at its end.
+ */
+static int take_events(TI_INPUT *in, size_t *covered, long long *events)
+{
+   TI_EVENT event;
+   int rval;
+
+   while ((rval = ti_input_next(in, &event, 0)) == 0)
+   {
+      check_event(in, &event, covered);
+      // No byte can make more than one event
+      if (++*events > FUZZ_MAX_INPUT + 16)
+         abort();
+   }
+
+   return rval;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+   static char text[FUZZ_MAX_INPUT + 1];
+   TI_INPUT input;
+   int pipefd[2];
+
+   if (size < 1 || size > FUZZ_MAX_INPUT)
+      return 0;
+
+   setup();
+
+   // Lookups take the read as one NUL-terminated string
+   memcpy(text, data + 1, size - 1);
+   text[size - 1] = '\0';
+   int index = TIV_find_index_by_sequence(g_keys, text);
+   if (index >= KEY_COUNT)
+      abort();
+   if (size > 1)
+   {
+      unsigned int code;
+      if (ti_utf8_decode_n(text, size - 1, &code) < 1)
+         abort();
+   }
+
+   if (pipe(pipefd))
+      return 0;
+   fcntl(pipefd[1], F_SETFL, fcntl(pipefd[1], F_GETFL) | O_NONBLOCK);
+
+   if (ti_input_init(&input, pipefd[0], 1, g_keys))
+      abort();
+   input.esc_delay = 0;
+
+   size_t chunk = (data[0] & 0x3f) + 1;
+   int take_every = (data[0] >> 6) + 1;
+   size_t fed = 1, covered = 0;
+   long long events = 0;
+   int rval = 0;
+
+   for (int count=1; fed < size; ++count)
+   {
+      size_t len = size - fed < chunk ? size - fed : chunk;
+      ssize_t written = write(pipefd[1], data + fed, len);
+      if (written > 0)
+         fed += written;
+
+      if (written <= 0 || count % take_every == 0)
+      {
+         rval = take_events(&input, &covered, &events);
+         if (rval != ETIMEDOUT)
+            abort();
+      }
+   }
+
+   close(pipefd[1]);
+   while ((rval = take_events(&input, &covered, &events)) == ETIMEDOUT)
+      ;
+   if (rval != EIO || covered > size - 1)
+      abort();
+
+   ti_input_destroy(&input);
+   close(pipefd[0]);
+   return 0;
+}
+
+#ifndef TI_WITH_LIBFUZZER
+
+static int write_seed(const char *dir, int number, const char *data, size_t len)
+{
+   char path[1024];
+   snprintf(path, sizeof(path), "%s/seed-%03d", dir, number);
+
+   FILE *file = fopen(path, "w");
+   if (!file)
+   {
+      int rval = errno;
+      fprintf(stderr, "%s: %s\n", path, strerror(rval));
+      return rval;
+   }
+
+   // First byte: whole reads, events taken after each
+   fputc(0x3f, file);
+   fwrite(data, 1, len, file);
+   fclose(file);
+   return 0;
+}
+
+/**
+ * @brief Write a seed corpus to @p dir, reporting the file that
+ *        can't be read or written.
+ * @return 0 for success, otherwise errno.
+ */
+static int make_corpus(const char *dir, const char *template_path)
+{
+   static const char *extras[] = {
+      "a", "\xc3\xa9", "\xe6\xbc\xa2", "\033", "\033\033", "\033[", "\033O",
+      "\033[200~pasted text\n\033[201~", "\033[200~\033[A\033[201~",
+      "\033[<0;10;5M", "\033[<0;10;5m", "\033[<35;80;24M", "\033[M !!",
+      "\033[97;5u", "\033[127;1:3u", "\033[?1u", "\033[1;5C", "\033[3~",
+      "\033[15;2~", "\033OP", "\x7f", "\x01", "\xff\xfe"
+   };
+   char line[256];
+   int number = 0;
+   int rval = 0;
+
+   setup();
+
+   FILE *file = fopen(template_path, "r");
+   if (!file)
+   {
+      rval = errno;
+      fprintf(stderr, "%s: %s\n", template_path, strerror(rval));
+      return rval;
+   }
+
+   // Commented lines count: the template leaves most keys off
+   while (!rval && fgets(line, sizeof(line), file))
+   {
+      char name[64], info[16], code[16];
+      const char *ptr = line[0] == '#' ? line + 1 : line;
+      const char *sequence;
+
+      if (sscanf(ptr, "%63s %15s %15s", name, info, code) == 3
+          && strncmp(name, "key_", 4) == 0 && strlen(code) == 2
+          && TIV_get_sequence_from_code(&sequence, code) == 0)
+         rval = write_seed(dir, number++, sequence, strlen(sequence));
+   }
+   fclose(file);
+
+   for (int i=0; !rval && i<(int)(sizeof(extras) / sizeof(extras[0])); ++i)
+      rval = write_seed(dir, number++, extras[i], strlen(extras[i]));
+
+   if (!rval)
+      printf("%d seeds written to %s\n", number, dir);
+   return rval;
+}
+
+static int run_file(const char *path)
+{
+   static uint8_t data[FUZZ_MAX_INPUT + 1];
+
+   FILE *file = fopen(path, "r");
+   if (!file)
+      return errno;
+
+   size_t len = fread(data, 1, sizeof(data), file);
+   fclose(file);
+
+   LLVMFuzzerTestOneInput(data, len);
+   return 0;
+}
+
+int main(int argc, const char **argv)
+{
+   if ((argc == 3 || argc == 4) && strcmp(argv[1], "--seed") == 0)
+   {
+      const char *template_path = argc == 4 ? argv[3] : "templates/capset_keys.txt";
+      return make_corpus(argv[2], template_path) ? 1 : 0;
+   }
+
+   if (argc < 2)
+   {
+      fprintf(stderr, "usage: %s FILE...\n       %s --seed DIR [TEMPLATE]\n", argv[0], argv[0]);
+      return 1;
+   }
+
+   for (int i=1; i<argc; ++i)
+   {
+      int rval = run_file(argv[i]);
+      if (rval)
+         fprintf(stderr, "%s: %s\n", argv[i], strerror(rval));
+   }
+
+   printf("%d inputs run\n", argc - 1);
+   return 0;
+}
+
+#endif  // TI_WITH_LIBFUZZER
@@ -0,0 +1,381 @@
+/**
+ * @file ti_replay.c
+ * @brief Replays a session recorded by sl_record.c at full speed.
+ *
+ * The recorded output goes into a headless terminal (sl_vterm.c) and
+ * the recorded input through the input tokenizer (sl_input.c), so a
+ * slow redraw or a mis-parsed key seen in use can be reproduced and
+ * timed.  Key sequences are looked up in the terminfo entry of the
+ * recording's `TERM`, for the keys of templates/capset_keys.txt.
+ *
+ * Input read apart by more than the escape delay is fed apart, so the
+ * tokenizer sees a lone ESC or a split sequence the way it did when
+ * the session was recorded.
+ *
+ * Options:
+ *
+ * - `--events` prints each input event,
+ * - `--screen` prints the screen at the end,
+ * - `--repeat N` replays N times, for steadier timings.
+ *
+ * Build with `make tools/ti_replay`.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "termintel.h"
+
+/** @brief Termcap codes of the keys of templates/capset_keys.txt */
+static const char *key_codes[] = {
+   "ku", "kd", "kl", "kr", "kN", "kP", "kh", "@7", "kb", "kD", "kI",
+   "k1", "k2", "k3", "k4", "k5", "k6", "k7", "k8", "k9", "k;", "F1", "F2",
+   "kB", "kF", "kR", "#4", "%i", "kE", "kS"
+};
+
+#define KEY_COUNT ((int)(sizeof(key_codes) / sizeof(key_codes[0])))
+
+static TIV *g_keys = NULL;
+
+typedef struct replay_event {
+   double time;
+   char type;
+   size_t offset;      ///< position of the bytes in the blob
+   size_t len;
+} REPLAY_EVENT;
+
+static REPLAY_EVENT *g_events = NULL;
+static int g_event_count = 0;
+static char *g_blob = NULL;
+static size_t g_blob_len = 0;
+
+typedef struct replay_totals {
+   long long output_ns;
+   long long input_ns;
+   long long input_events;
+} REPLAY_TOTALS;
+
+/**
+ * @brief Read the whole recording into memory, so that replaying
+ *        times the library rather than the file reads.
+ * @return 0 for success, otherwise errno.
+ */
+static int load_events(TI_REPLAY *replay)
+{
+   TI_RECORD_EVENT event;
+   int capacity = 0;
+   size_t blob_size = 0;
+   int rval;
+
+   while ((rval = ti_replay_next(replay, &event)) == 0)
+   {
+      if (event.type != 'o' && event.type != 'i')
+         continue;
+
+      if (g_event_count == capacity)
+      {
+         capacity = capacity ? capacity * 2 : 1024;
+         REPLAY_EVENT *events = (REPLAY_EVENT*)realloc(g_events, capacity * sizeof(REPLAY_EVENT));
+         if (!events)
+            return ENOMEM;
+         g_events = events;
+      }
+
+      if (g_blob_len + event.len > blob_size)
+      {
+         blob_size = (g_blob_len + event.len) * 2;
+         char *blob = (char*)realloc(g_blob, blob_size);
+         if (!blob)
+            return ENOMEM;
+         g_blob = blob;
+      }
+
+      REPLAY_EVENT *saved = &g_events[g_event_count++];
+      saved->time = event.time;
+      saved->type = event.type;
+      saved->offset = g_blob_len;
+      saved->len = event.len;
+      memcpy(g_blob + g_blob_len, event.data, event.len);
+      g_blob_len += event.len;
+   }
+
+   return rval == ENODATA ? 0 : rval;
+}
+
+static void print_bytes(const char *data, size_t len)
+{
+   for (size_t i=0; i<len; ++i)
+   {
+      unsigned char chr = (unsigned char)data[i];
+      if (chr == 0x1b)
+         printf("\\e");
+      else if (chr < 0x20 || chr >= 0x7f)
+         printf("\\x%02x", chr);
+      else
+         putchar(chr);
+   }
+}
+
+static void print_event(double time, const TI_EVENT *event)
+{
+   static const char *names[] = {
+      "", "char", "key", "paste", "unknown", "mouse", "resize"
+   };
+
+   printf("%10.6f %-7s code %-6u mods %d  ", time,
+          event->type > 0 && event->type <= TI_EVENT_RESIZE ? names[event->type] : "?",
+          event->code, event->mods);
+   if (event->key_index >= 0 && event->key_index < KEY_COUNT)
+      printf("%s  ", key_codes[event->key_index]);
+   if (event->type == TI_EVENT_PASTE)
+      printf("%zu bytes%s", event->slices[0].len + event->slices[1].len,
+             event->more ? ", more" : "");
+   else
+   {
+      print_bytes(event->slices[0].data, event->slices[0].len);
+      print_bytes(event->slices[1].data, event->slices[1].len);
+   }
+   printf("\n");
+}
+
+/**
+ * @brief Take every event the tokenizer can make of the input so far.
+ */
+static int drain_input(TI_INPUT *in, double time, int print, REPLAY_TOTALS *totals)
+{
+   TI_EVENT event;
+   int rval;
+
+   while ((rval = ti_input_next(in, &event, 0)) == 0)
+   {
+      ++totals->input_events;
+      if (print)
+         print_event(time, &event);
+   }
+
+   return rval == ETIMEDOUT ? 0 : rval;
+}
+
+/**
+ * @brief Feed input bytes to the tokenizer's pipe, taking events when
+ *        the pipe is full.
+ */
+static int feed_input(int fd, TI_INPUT *in, const char *data, size_t len,
+                      double time, int print, REPLAY_TOTALS *totals)
+{
+   while (len > 0)
+   {
+      ssize_t written = write(fd, data, len);
+      if (written < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         if (errno != EAGAIN)
+            return errno;
+
+         int rval = drain_input(in, time, print, totals);
+         if (rval)
+            return rval;
+         continue;
+      }
+      data += written;
+      len -= written;
+   }
+
+   return 0;
+}
+
+/**
+ * @brief Replay the recording once.
+ * @return 0 for success, otherwise errno.
+ */
+static int replay_once(TI_VTERM *vt, int print, REPLAY_TOTALS *totals)
+{
+   TI_INPUT input;
+   int pipefd[2];
+
+   if (pipe(pipefd))
+      return errno;
+   fcntl(pipefd[1], F_SETFL, fcntl(pipefd[1], F_GETFL) | O_NONBLOCK);
+
+   int rval = ti_input_init(&input, pipefd[0], 0, g_keys);
+   if (rval)
+   {
+      close(pipefd[0]);
+      close(pipefd[1]);
+      return rval;
+   }
+
+   // Gaps shorter than this were read as one sequence
+   double delay = input.esc_delay / 1000.0;
+   // Bytes fed are taken at once, so a partial sequence is final
+   input.esc_delay = 0;
+
+   for (int i=0; i<g_event_count && !rval; ++i)
+   {
+      const REPLAY_EVENT *event = &g_events[i];
+      long long start = ti_clock_ns();
+
+      if (event->type == 'o')
+      {
+         ti_vterm_write(vt, g_blob + event->offset, event->len);
+         totals->output_ns += ti_clock_ns() - start;
+         continue;
+      }
+
+      rval = feed_input(pipefd[1], &input, g_blob + event->offset, event->len,
+                        event->time, print, totals);
+
+      int next = i + 1;
+      while (next < g_event_count && g_events[next].type != 'i')
+         ++next;
+      if (!rval && (next == g_event_count || g_events[next].time - event->time >= delay))
+         rval = drain_input(&input, event->time, print, totals);
+
+      totals->input_ns += ti_clock_ns() - start;
+   }
+
+   ti_input_destroy(&input);
+   close(pipefd[0]);
+   close(pipefd[1]);
+   return rval;
+}
+
+static void print_screen(const TI_VTERM *vt, int rows, int cols)
+{
+   int size = cols * 4 + 1;
+   char *buff = (char*)malloc(size);
+   int row, col;
+
+   if (!buff)
+      return;
+
+   for (row=0; row<rows; ++row)
+   {
+      if (ti_vterm_row_text(vt, row, buff, size) >= 0)
+         printf("%3d|%s\n", row, buff);
+   }
+
+   ti_vterm_cursor(vt, &row, &col);
+   printf("cursor at row %d, column %d\n", row, col);
+   free(buff);
+}
+
+int main(int argc, const char **argv)
+{
+   const char *path = NULL;
+   int print_events = 0;
+   int print_final = 0;
+   int repeat = 1;
+   int usage = 0;
+
+   for (int i=1; i<argc; ++i)
+   {
+      if (strcmp(argv[i], "--events") == 0)
+         print_events = 1;
+      else if (strcmp(argv[i], "--screen") == 0)
+         print_final = 1;
+      else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+         repeat = atoi(argv[++i]);
+      else if (argv[i][0] != '-' && !path)
+         path = argv[i];
+      else
+         usage = 1;
+   }
+
+   if (usage || !path || repeat < 1)
+   {
+      fprintf(stderr, "usage: %s [--events] [--screen] [--repeat N] recording.cast\n", argv[0]);
+      return 1;
+   }
+
+   TI_REPLAY *replay = ti_replay_open(path);
+   if (!replay)
+   {
+      fprintf(stderr, "%s: %s\n", path, strerror(errno));
+      return 1;
+   }
+
+   int rows, cols;
+   char term[64];
+   snprintf(term, sizeof(term), "%s", ti_replay_info(replay, &rows, &cols));
+   if (*term)
+      setenv("TERM", term, 1);
+   // Replaying must not record over the recording
+   unsetenv("TERMINTEL_RECORD");
+
+   int rval = load_events(replay);
+   ti_replay_close(replay);
+   if (rval)
+   {
+      fprintf(stderr, "%s: %s\n", path, strerror(rval));
+      return 1;
+   }
+
+   g_keys = (TIV*)calloc(KEY_COUNT + 1, sizeof(TIV));
+   if (!g_keys)
+      return 1;
+   for (int i=0; i<KEY_COUNT; ++i)
+   {
+      memcpy(g_keys[i].code, key_codes[i], 2);
+      g_keys[i].index = i;
+   }
+
+   if (!TIV_setup(1, &g_keys))
+      return 1;
+
+   REPLAY_TOTALS totals = { 0, 0, 0 };
+   TI_VTERM *vt = NULL;
+   for (int i=0; i<repeat && !rval; ++i)
+   {
+      ti_vterm_destroy(vt);
+      vt = ti_vterm_create(rows, cols);
+      if (!vt)
+         rval = ENOMEM;
+      else
+         rval = replay_once(vt, print_events && i == 0, &totals);
+   }
+
+   if (rval)
+      fprintf(stderr, "%s: %s\n", path, strerror(rval));
+   else
+   {
+      size_t output_bytes = 0, input_bytes = 0;
+      int output_count = 0;
+      for (int i=0; i<g_event_count; ++i)
+      {
+         if (g_events[i].type == 'o')
+         {
+            output_bytes += g_events[i].len;
+            ++output_count;
+         }
+         else
+            input_bytes += g_events[i].len;
+      }
+
+      if (print_final)
+         print_screen(vt, rows, cols);
+
+      double seconds = g_event_count ? g_events[g_event_count - 1].time : 0;
+      printf("%s: %dx%d, TERM %s, %.3f seconds recorded\n", path, rows, cols, term, seconds);
+      printf("output: %d flushes, %zu bytes, %d unknown sequences, %.1f MB/s\n",
+             output_count, output_bytes, ti_vterm_unknown(vt),
+             totals.output_ns ? output_bytes * 1e3 * repeat / totals.output_ns : 0.0);
+      printf("input:  %zu bytes, %lld events, %.0f ns per event\n",
+             input_bytes, totals.input_events / repeat,
+             totals.input_events ? (double)totals.input_ns / totals.input_events : 0.0);
+   }
+
+   ti_vterm_destroy(vt);
+   TIV_destroy_arrays(1, &g_keys);
+   free(g_keys);
+   free(g_events);
+   free(g_blob);
+   return rval ? 1 : 0;
+}